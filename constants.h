@@ -16,6 +16,34 @@
 #define SSU_BOARD_MAPPING_CONFIGURATION "/usr/share/ssu/board-mappings.ini"
 /// Path to config.d for board mappings
 #define SSU_BOARD_MAPPING_CONFIGURATION_DIR "/usr/share/ssu/board-mappings.d"
+/// Path to the cache file for the detected device identity
+#define SSU_DEVICE_IDENTITY_CACHE "/var/cache/ssu/device-identity.ini"
+/// Path to the cache file for the device UID read from the modem
+#define SSU_DEVICE_UID_CACHE "/var/cache/ssu/device-uid"
+/// Path to the file recording that no modem was found when looking up the device UID
+#define SSU_DEVICE_UID_MISSING "/var/cache/ssu/device-uid.missing"
+/// Path to the file keeping frequently changing state, like credentials, outside of ssu.ini
+#define SSU_STATE "/var/lib/ssu/ssu-state.ini"
+/// Path to the compiled snapshot of the static configuration files
+#define SSU_CONFIGURATION_SNAPSHOT "/var/cache/ssu/configuration.snapshot"
+/// Maximum time in milliseconds to wait for the modem when looking up the device UID
+#define SSU_DEVICE_UID_TIMEOUT 3000
+/// Lock file serializing credential updates between processes
+#define SSU_CREDENTIALS_LOCK "/var/lock/ssu-credentials.lock"
+/// Maximum time in milliseconds to wait for another process updating credentials
+#define SSU_CREDENTIALS_LOCK_TIMEOUT 60000
+/// Maximum size in bytes of a response from the SSU server
+#define SSU_MAX_RESPONSE_SIZE 1048576
+/// Local socket the optional ssuurlresolver daemon listens on
+#define SSU_URLRESOLVER_SOCKET "/run/ssu/urlresolver.socket"
+/// Time in milliseconds the ssuurlresolver daemon stays around without requests
+#define SSU_URLRESOLVER_IDLE_TIMEOUT 60000
+/// Maximum time in milliseconds to wait for the ssuurlresolver daemon to answer before resolving in process. The daemon may be updating credentials for the request, which can take as long as waiting for the credentials lock and asking the server
+#define SSU_URLRESOLVER_TIMEOUT (SSU_CREDENTIALS_LOCK_TIMEOUT + 30000)
+/// Maximum time in milliseconds for connecting to the ssuurlresolver daemon, and for sending a request
+#define SSU_URLRESOLVER_FORWARD_TIMEOUT 100
+/// Maximum time in milliseconds the ssuurlresolver daemon waits for a complete request
+#define SSU_URLRESOLVER_REQUEST_TIMEOUT 5000
 /// Directory where all the non-user modifiable data sits
 #define SSU_DATA_DIR "/usr/share/ssu/"
 /// The SSU protocol version used by the ssu client libraries
@@ -1,19 +1,29 @@
 TARGET = ssu
 include(../ssulibrary.pri)
 
+# Ssu changed its layout, and ssu.h no longer includes QtXml
+VERSION = 2.0.0
+
 # TODO: which headers are public? i.e. to be installed
 public_headers = \
         ssu.h \
         ssudeviceinfo.h \
+        ssudevicequery.h \
         ssulog.h \
         ssurepomanager.h \
+        ssureporesolver.h \
         ssusettings.h \
+        ssusettingsview.h \
         ssuvariables.h
 
 HEADERS = \
         $${public_headers} \
         sandbox_p.h \
         ssucoreconfig.h \
+        ssupatternmatcher_p.h \
+        ssuserverresponse_p.h \
+        ssusettingssnapshot_p.h \
+        ssuvariabletemplate_p.h \
         mobility-booty/qofonoservice_linux_p.h \
         mobility-booty/qsysteminfo_linux_common_p.h \
         mobility-booty/qsysteminfo_dbus_p.h
@@ -23,16 +33,23 @@ SOURCES = \
         ssu.cpp \
         ssucoreconfig.cpp \
         ssudeviceinfo.cpp \
+        ssudevicequery.cpp \
         ssulog.cpp \
+        ssupatternmatcher.cpp \
+        ssuserverresponse.cpp \
         ssuvariables.cpp \
+        ssuvariabletemplate.cpp \
         ssurepomanager.cpp \
+        ssureporesolver.cpp \
         ssusettings.cpp \
+        ssusettingssnapshot.cpp \
+        ssusettingsview.cpp \
         mobility-booty/qofonoservice_linux.cpp \
         mobility-booty/qsysteminfo_linux_common.cpp \
 
 #CONFIG += mobility link_pkgconfig
 CONFIG += link_pkgconfig
-QT += network xml dbus
+QT += network dbus
 #MOBILITY += systeminfo
 PKGCONFIG += libsystemd-journal boardname
 
@@ -6,31 +6,44 @@
  */
 
 #include <QtNetwork>
-#include <QtXml/QDomDocument>
 
 #if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
 #include <QUrlQuery>
 #endif
 
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/file.h>
+#include <unistd.h>
+
 #include "ssu.h"
 #include "ssulog.h"
 #include "ssuvariables.h"
 #include "ssucoreconfig.h"
 #include "ssurepomanager.h"
+#include "ssuserverresponse_p.h"
+#include "sandbox_p.h"
 
 #include "../constants.h"
 
 Ssu::Ssu(): QObject(){
   errorFlag = false;
   pendingRequests = 0;
+  credentialsLock = -1;
+  credentialsReply = 0;
 
 #ifdef SSUCONFHACK
   // dirty hack to make sure we can write to the configuration
   // this is currently required since there's no global gconf,
   // and we migth not yet have users on bootstrap
   QFileInfo settingsInfo(SSU_CONFIGURATION);
+  QFileInfo stateInfo(SSU_STATE);
   if (settingsInfo.groupId() != SSU_GROUP_ID ||
-      !settingsInfo.permission(QFile::WriteGroup)){
+      !settingsInfo.permission(QFile::WriteGroup) ||
+      (stateInfo.exists() &&
+       (stateInfo.groupId() != SSU_GROUP_ID ||
+        !stateInfo.permission(QFile::WriteGroup)))){
     QProcess proc;
     proc.start("/usr/bin/ssuconfperm");
     proc.waitForFinished();
@@ -140,25 +153,26 @@ QString Ssu::lastError(){
   return errorString;
 }
 
-bool Ssu::registerDevice(QDomDocument *response){
-  QString certificateString = response->elementsByTagName("certificate").at(0).toElement().text();
-  QSslCertificate certificate(certificateString.toLatin1());
+bool Ssu::registerDevice(const SsuServerResponse &response){
+  QSslCertificate certificate(response.certificate.toLatin1());
   SsuLog *ssuLog = SsuLog::instance();
   SsuCoreConfig *settings = SsuCoreConfig::instance();
 
+  settings->beginBatch();
   if (certificate.isNull()){
     // make sure device is in unregistered state on failed registration
     settings->setValue("registered", false);
+    settings->endBatch();
     setError("Certificate is invalid");
     return false;
   } else
     settings->setValue("certificate", certificate.toPem());
 
-  QString privateKeyString = response->elementsByTagName("privateKey").at(0).toElement().text();
-  QSslKey privateKey(privateKeyString.toLatin1(), QSsl::Rsa);
+  QSslKey privateKey(response.privateKey.toLatin1(), QSsl::Rsa);
 
   if (privateKey.isNull()){
     settings->setValue("registered", false);
+    settings->endBatch();
     setError("Private key is invalid");
     return false;
   } else
@@ -166,12 +180,11 @@ bool Ssu::registerDevice(QDomDocument *response){
 
   // oldUser is just for reference purposes, in case we want to notify
   // about owner changes for the device
-  QString oldUser = response->elementsByTagName("user").at(0).toElement().text();
-  ssuLog->print(LOG_DEBUG, QString("Old user for your device was: %1").arg(oldUser));
+  ssuLog->print(LOG_DEBUG, QString("Old user for your device was: %1").arg(response.user));
 
   // if we came that far everything required for device registration is done
   settings->setValue("registered", true);
-  settings->sync();
+  settings->endBatch();
   emit registrationStatusChanged();
   return true;
 }
@@ -185,11 +198,35 @@ QString Ssu::repoUrl(QString repoName, bool rndRepo,
   return manager.url(repoName, rndRepo, repoParameters, parametersOverride);
 }
 
+void Ssu::limitResponseSize(QNetworkReply *reply){
+  connect(reply, SIGNAL(downloadProgress(qint64, qint64)),
+          this, SLOT(checkResponseSize(qint64, qint64)));
+}
+
+// responses are small; don't let a broken server make us buffer arbitrary
+// amounts of data. total is the announced size, if any
+void Ssu::checkResponseSize(qint64 received, qint64 total){
+  QNetworkReply *reply = qobject_cast<QNetworkReply*>(sender());
+  if (!reply)
+    return;
+
+  if (received > SSU_MAX_RESPONSE_SIZE || total > SSU_MAX_RESPONSE_SIZE){
+    reply->setProperty("oversized", true);
+    reply->abort();
+  }
+}
+
 void Ssu::requestFinished(QNetworkReply *reply){
   QSslConfiguration sslConfiguration = reply->sslConfiguration();
   SsuLog *ssuLog = SsuLog::instance();
   SsuCoreConfig *settings = SsuCoreConfig::instance();
 
+  // the credentials lock is held until this reply was handled, including
+  // storing the new credentials
+  bool isCredentialsReply = reply == credentialsReply;
+  if (isCredentialsReply)
+    credentialsReply = 0;
+
 #if QT_VERSION >= QT_VERSION_CHECK(5, 0, 0)
   ssuLog->print(LOG_DEBUG, QString("Certificate used was issued for '%1' by '%2'. Complete chain:")
                 .arg(sslConfiguration.peerCertificate().subjectInfo(QSslCertificate::CommonName).join(""))
@@ -208,6 +245,8 @@ void Ssu::requestFinished(QNetworkReply *reply){
   }
 #endif
 
+  QString error;
+
   /// @TODO: indicate that the device is not registered if there's a 404 on credentials update url
   // what sucks more, this or goto?
   do {
@@ -225,40 +264,47 @@ void Ssu::requestFinished(QNetworkReply *reply){
       }
     }
 
-    if (reply->error() > 0){
-      pendingRequests--;
-      setError(reply->errorString());
-      return;
+    if (reply->property("oversized").toBool()){
+      error = tr("Server response exceeds %1 bytes").arg(SSU_MAX_RESPONSE_SIZE);
+      break;
+    } else if (reply->error() > 0){
+      error = reply->errorString();
+      break;
     } else {
       QByteArray data = reply->readAll();
       qDebug() << "RequestOutput" << data;
 
-      QDomDocument doc;
-      QString xmlError;
-      if (!doc.setContent(data, &xmlError)){
-        pendingRequests--;
-        setError(tr("Unable to parse server response (%1)").arg(xmlError));
-        return;
+      SsuServerResponse response;
+      if (!response.parse(data)){
+        error = response.errorString();
+        break;
       }
 
-      QString action = doc.elementsByTagName("action").at(0).toElement().text();
+      QString action = response.action;
 
-      if (!verifyResponse(&doc)) break;
+      if (!verifyResponse(response)) break;
 
       if (action == "register"){
-        if (!registerDevice(&doc)) break;
+        if (!registerDevice(response)) break;
       } else if (action == "credentials"){
-        if (!setCredentials(&doc)) break;
+        if (!setCredentials(response)) break;
       } else {
-        pendingRequests--;
-        setError(tr("Response to unknown action encountered: %1").arg(action));
-        return;
+        error = tr("Response to unknown action encountered: %1").arg(action);
+        break;
       }
     }
   } while (false);
 
+  if (isCredentialsReply)
+    releaseCredentialsLock();
+
   pendingRequests--;
 
+  if (!error.isEmpty()){
+    setError(error);
+    return;
+  }
+
   ssuLog->print(LOG_DEBUG, QString("Request finished, pending requests: %1").arg(pendingRequests));
   if (pendingRequests == 0)
     emit done();
@@ -353,6 +399,7 @@ void Ssu::sendRegistration(QString usernameDomain, QString password){
   reply = manager->post(request, form.encodedQuery());
 #endif
   // we could expose downloadProgress() from reply in case we want progress info
+  limitResponseSize(reply);
 
   QString homeUrl = settings->value("home-url").toString().arg(username);
   if (!homeUrl.isEmpty()){
@@ -361,49 +408,22 @@ void Ssu::sendRegistration(QString usernameDomain, QString password){
     request.setUrl(homeUrl + "/authorized_keys");
     ssuLog->print(LOG_DEBUG, QString("Trying to get SSH keys from %1").arg(request.url().toString()));
     pendingRequests++;
-    manager->get(request);
+    limitResponseSize(manager->get(request));
   }
 }
 
-bool Ssu::setCredentials(QDomDocument *response){
+bool Ssu::setCredentials(const SsuServerResponse &response){
   SsuCoreConfig *settings = SsuCoreConfig::instance();
   // generate list with all scopes for generic section, add sections
-  QDomNodeList credentialsList = response->elementsByTagName("credentials");
+  // the response was validated while parsing, so all entries are complete
   QStringList credentialScopes;
-  for (int i=0;i<credentialsList.size();i++){
-    QDomNode node = credentialsList.at(i);
-    QString scope;
-
-    QDomNamedNodeMap attributes = node.attributes();
-    if (attributes.contains("scope")){
-      scope = attributes.namedItem("scope").toAttr().value();
-    } else {
-      setError(tr("Credentials element does not have scope"));
-      return false;
-    }
-
-    if (node.hasChildNodes()){
-      QDomElement username = node.firstChildElement("username");
-      QDomElement password = node.firstChildElement("password");
-      if (username.isNull() || password.isNull()){
-        setError(tr("Username and/or password not set"));
-        return false;
-      } else {
-        settings->beginGroup("credentials-" + scope);
-        settings->setValue("username", username.text());
-        settings->setValue("password", password.text());
-        settings->endGroup();
-        settings->sync();
-        credentialScopes.append(scope);
-      }
-    } else {
-      setError("");
-      return false;
-    }
+  settings->beginBatch();
+  foreach (const SsuServerResponse::Credentials &entry, response.credentials){
+    settings->setCredentials(entry.scope, entry.username, entry.password);
+    credentialScopes.append(entry.scope);
   }
-  settings->setValue("credentialScopes", credentialScopes);
-  settings->setValue("lastCredentialsUpdate", QDateTime::currentDateTime());
-  settings->sync();
+  settings->setCredentialScopes(credentialScopes);
+  settings->endBatch();
   emit credentialsChanged();
 
   return true;
@@ -449,11 +469,19 @@ void Ssu::storeAuthorizedKeys(QByteArray data){
 
 void Ssu::updateCredentials(bool force){
   SsuCoreConfig *settings = SsuCoreConfig::instance();
-  errorFlag = false;
-
   SsuLog *ssuLog = SsuLog::instance();
 
-  if (deviceInfo.deviceUid() == ""){
+  // flock() on the descriptor we already hold would succeed again, so don't
+  // let a second update run alongside; its done() comes with the first one
+  if (credentialsLock != -1 || credentialsReply != 0){
+    ssuLog->print(LOG_DEBUG, "Credentials update already in progress");
+    return;
+  }
+
+  errorFlag = false;
+
+  QString IMEI = deviceInfo.deviceUid();
+  if (IMEI == ""){
     setError("No valid UID available for your device. For phones: is your modem online?");
     return;
   }
@@ -483,18 +511,62 @@ void Ssu::updateCredentials(bool force){
     // skip updating if the last update was less than 30 minutes ago
     QDateTime now = QDateTime::currentDateTime();
 
-    if (settings->contains("lastCredentialsUpdate")){
-      QDateTime last = settings->value("lastCredentialsUpdate").toDateTime();
-      if (last >= now.addSecs(-1800)){
-        ssuLog->print(LOG_DEBUG, QString("Skipping credentials update, last update was at %1")
-                     .arg(last.toString()));
-        emit done();
-        return;
-      }
+    QDateTime last = settings->lastCredentialsUpdate();
+    if (last.isValid() && last >= now.addSecs(-1800)){
+      ssuLog->print(LOG_DEBUG, QString("Skipping credentials update, last update was at %1")
+                   .arg(last.toString()));
+      emit done();
+      return;
     }
   }
 
-  // check when the last update was, decide if an update is required
+  credentialsRequestUrl = ssuCredentialsUrl.arg(IMEI);
+  credentialsCaCertificate = ssuCaCertificate;
+  credentialsLastUpdate = settings->lastCredentialsUpdate();
+  credentialsLockWait.start();
+  acquireCredentialsLock();
+}
+
+void Ssu::acquireCredentialsLock(){
+  SsuLog *ssuLog = SsuLog::instance();
+  SsuCoreConfig *settings = SsuCoreConfig::instance();
+
+  if (credentialsLock == -1){
+    QString lockPath = Sandbox::map(SSU_CREDENTIALS_LOCK);
+    QDir().mkpath(QFileInfo(lockPath).path());
+
+    // flock() works on read only descriptors, which allows unprivileged
+    // processes to use a lock file created by root
+    credentialsLock = ::open(qPrintable(lockPath), O_RDONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (credentialsLock == -1)
+      ssuLog->print(LOG_WARNING, QString("Unable to open %1 (%2), updating credentials unlocked")
+                    .arg(lockPath)
+                    .arg(strerror(errno)));
+  }
+
+  if (credentialsLock != -1 && flock(credentialsLock, LOCK_EX | LOCK_NB) == -1){
+    if (errno == EWOULDBLOCK &&
+        credentialsLockWait.elapsed() < SSU_CREDENTIALS_LOCK_TIMEOUT){
+      // poll instead of blocking, as this may run in an UI process
+      QTimer::singleShot(100, this, SLOT(acquireCredentialsLock()));
+      return;
+    }
+
+    ssuLog->print(LOG_WARNING, "Timeout waiting for credentials lock, updating credentials unlocked");
+    releaseCredentialsLock();
+  }
+
+  // another process might have updated credentials while we were waiting
+  settings->syncAll();
+  if (settings->lastCredentialsUpdate() != credentialsLastUpdate){
+    ssuLog->print(LOG_DEBUG, QString("Credentials were updated by another process at %1")
+                  .arg(settings->lastCredentialsUpdate().toString()));
+    releaseCredentialsLock();
+    emit credentialsChanged();
+    emit done();
+    return;
+  }
+
   QSslConfiguration sslConfiguration;
   if (!useSslVerify())
     sslConfiguration.setPeerVerifyMode(QSslSocket::VerifyNone);
@@ -503,37 +575,46 @@ void Ssu::updateCredentials(bool force){
   QSslCertificate certificate(settings->value("certificate").toByteArray());
 
   QList<QSslCertificate> caCertificates;
-  caCertificates << QSslCertificate::fromPath(ssuCaCertificate);
+  caCertificates << QSslCertificate::fromPath(credentialsCaCertificate);
   sslConfiguration.setCaCertificates(caCertificates);
 
   sslConfiguration.setPrivateKey(privateKey);
   sslConfiguration.setLocalCertificate(certificate);
 
   QNetworkRequest request;
-  request.setUrl(QUrl(ssuCredentialsUrl.arg(deviceInfo.deviceUid())));
+  request.setUrl(QUrl(credentialsRequestUrl));
 
   ssuLog->print(LOG_DEBUG, QString("Sending credential update request to %1")
                .arg(request.url().toString()));
   request.setSslConfiguration(sslConfiguration);
 
   pendingRequests++;
-  manager->get(request);
+  credentialsReply = manager->get(request);
+  limitResponseSize(credentialsReply);
+}
+
+void Ssu::releaseCredentialsLock(){
+  if (credentialsLock == -1)
+    return;
+
+  // closing the descriptor drops the lock
+  ::close(credentialsLock);
+  credentialsLock = -1;
 }
 
 
 void Ssu::unregister(){
   SsuCoreConfig *settings = SsuCoreConfig::instance();
+  settings->beginBatch();
   settings->setValue("privateKey", "");
   settings->setValue("certificate", "");
   settings->setValue("registered", false);
-  settings->sync();
+  settings->endBatch();
   emit registrationStatusChanged();
 }
 
-bool Ssu::verifyResponse(QDomDocument *response){
-  QString action = response->elementsByTagName("action").at(0).toElement().text();
-  QString deviceId = response->elementsByTagName("deviceId").at(0).toElement().text();
-  QString protocolVersion = response->elementsByTagName("protocolVersion").at(0).toElement().text();
+bool Ssu::verifyResponse(const SsuServerResponse &response){
+  QString protocolVersion = response.protocolVersion;
   // compare device ids
 
   if (protocolVersion != SSU_PROTOCOL_VERSION){
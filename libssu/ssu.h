@@ -9,15 +9,15 @@
 #define _Ssu_H
 
 #include <QDateTime>
+#include <QElapsedTimer>
 #include <QObject>
 #include <QDebug>
 
-#include <QtXml/QDomDocument>
-
 #include "ssudeviceinfo.h"
 
 class QNetworkAccessManager;
 class QNetworkReply;
+class SsuServerResponse;
 
 class Ssu: public QObject {
     Q_OBJECT
@@ -138,13 +138,35 @@ class Ssu: public QObject {
     QNetworkAccessManager *manager;
     int pendingRequests;
     SsuDeviceInfo deviceInfo;
-    bool registerDevice(QDomDocument *response);
-    bool setCredentials(QDomDocument *response);
-    bool verifyResponse(QDomDocument *response);
+    /// File descriptor of SSU_CREDENTIALS_LOCK while updating credentials, or -1
+    int credentialsLock;
+    /// The credentials request in flight, or 0
+    QNetworkReply *credentialsReply;
+    QElapsedTimer credentialsLockWait;
+    QDateTime credentialsLastUpdate;
+    QString credentialsRequestUrl;
+    QString credentialsCaCertificate;
+    bool registerDevice(const SsuServerResponse &response);
+    bool setCredentials(const SsuServerResponse &response);
+    bool verifyResponse(const SsuServerResponse &response);
     void storeAuthorizedKeys(QByteArray data);
+    /// Abort reply once the response exceeds SSU_MAX_RESPONSE_SIZE
+    void limitResponseSize(QNetworkReply *reply);
+    /**
+     * Drop the credentials lock. Only done once the credentials reply was
+     * handled, or no request is sent after all
+     */
+    void releaseCredentialsLock();
 
   private slots:
     void requestFinished(QNetworkReply *reply);
+    void checkResponseSize(qint64 received, qint64 total);
+    /**
+     * Send the credentials request once no other process is updating
+     * credentials. If another process updated them while waiting for the
+     * lock its result is reused, and no request is sent.
+     */
+    void acquireCredentialsLock();
     /**
      * Set errorString returned by lastError to errorMessage, set
      * errorFlag returned by error() to true, and emit done()
@@ -167,6 +189,9 @@ class Ssu: public QObject {
      * for this to work. updateCredentials remembers the time of the last credentials
      * update, and skips updating if only little time has elapsed since the last update.
      * An update may be forced by setting @a force to true
+     *
+     * Only one process updates credentials at a time; if another process is
+     * already updating them this waits for it and uses its result.
      * @param force force credentials updating
      *
      * When the operation has finished the done() signal will be sent. You can call
@@ -5,30 +5,173 @@
  * @date 2013
  */
 
+#include <QDir>
 #include <QFile>
+#include <QFileInfo>
+#include <QMutex>
+#include <QMutexLocker>
 #include <QTextStream>
 
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
 #include "ssucoreconfig.h"
 #include "ssulog.h"
 
+#include "../constants.h"
+
 SsuCoreConfig *SsuCoreConfig::ssuCoreConfig = 0;
 
+SsuCoreConfig::SsuCoreConfig():
+  SsuSettings(SSU_CONFIGURATION, QSettings::IniFormat, SSU_DEFAULT_CONFIGURATION),
+  batchDepth(0){
+  state = new SsuSettings(SSU_STATE, QSettings::IniFormat, this);
+  migrateState();
+}
+
 SsuCoreConfig *SsuCoreConfig::instance(){
+  static QMutex mutex;
+  QMutexLocker locker(&mutex);
+
   if (!ssuCoreConfig)
     ssuCoreConfig = new SsuCoreConfig();
 
   return ssuCoreConfig;
 }
 
+void SsuCoreConfig::beginBatch(){
+  batchDepth++;
+}
+
+void SsuCoreConfig::endBatch(){
+  if (batchDepth > 0)
+    batchDepth--;
+
+  if (batchDepth == 0)
+    syncAll();
+}
+
+void SsuCoreConfig::syncAll(){
+  SsuSettings::sync();
+  state->sync();
+
+  // the file may not be writable, so its stamp doesn't tell about changes
+  QMutexLocker locker(&viewMutex);
+  cachedView.clear();
+}
+
+QSharedPointer<SsuSettingsView> SsuCoreConfig::view(){
+  // stamped before copying, so a change while copying gets the next call
+  // to copy the file again
+  SsuSettingsSnapshot::Stamp stamp = SsuSettingsSnapshot::Stamp::read(fileName());
+
+  QMutexLocker locker(&viewMutex);
+  if (!cachedView.isNull() && batchDepth == 0 && stamp.exists && stamp == viewStamp)
+    return cachedView;
+
+  QSharedPointer<SsuSettingsView> view(new SsuSettingsView(*this));
+
+  // inside a batch changes may not be synced yet
+  if (batchDepth == 0){
+    cachedView = view;
+    viewStamp = stamp;
+  } else
+    cachedView.clear();
+
+  return view;
+}
+
+void SsuCoreConfig::createStateFile(){
+  // only done before writing, readers are fine without the state file
+  QString path = state->fileName();
+  QDir directory = QFileInfo(path).dir();
+  if (!directory.exists())
+    directory.mkpath(".");
+
+  // QSettings would create the file with the umask of the first writer,
+  // usually root. Like ssu.ini it needs to be writable for the ssu group;
+  // the group is inherited from the setgid state directory
+  if (QFileInfo(path).exists())
+    return;
+
+  int fd = ::open(QFile::encodeName(path).constData(), O_WRONLY | O_CREAT | O_EXCL, 0664);
+  if (fd != -1){
+    ::fchmod(fd, 0664);
+    ::close(fd);
+  }
+}
+
+bool SsuCoreConfig::isStateKey(const QString &key){
+  return key == "lastCredentialsUpdate" || key == "credentialScopes" ||
+    (key.startsWith("credentials-") && key.contains('/'));
+}
+
+void SsuCoreConfig::migrateState(){
+  // the top level tells if there is anything to move, which spares looking
+  // at all keys on every start
+  bool hasState = contains("lastCredentialsUpdate") || contains("credentialScopes");
+  foreach (const QString &group, childGroups()){
+    if (group.startsWith("credentials-")){
+      hasState = true;
+      break;
+    }
+  }
+
+  if (!hasState)
+    return;
+
+  QStringList stateKeys;
+  foreach (const QString &key, allKeys()){
+    if (isStateKey(key))
+      stateKeys.append(key);
+  }
+
+  if (stateKeys.isEmpty())
+    return;
+
+  foreach (const QString &key, stateKeys){
+    if (!state->contains(key))
+      state->setValue(key, value(key));
+  }
+
+  // keep the keys in ssu.ini if they can't be stored elsewhere; they are
+  // still found there
+  createStateFile();
+  state->sync();
+  if (state->status() != QSettings::NoError || !QFileInfo(state->fileName()).isWritable()){
+    SsuLog::instance()->print(LOG_DEBUG, QString("Unable to write %1, keeping state in ssu.ini")
+                              .arg(state->fileName()));
+    return;
+  }
+
+  SsuLog::instance()->print(LOG_INFO, QString("Moving credentials from ssu.ini to %1")
+                            .arg(state->fileName()));
+  foreach (const QString &key, stateKeys)
+    remove(key);
+  SsuSettings::sync();
+}
+
 QPair<QString, QString> SsuCoreConfig::credentials(QString scope){
   QPair<QString, QString> ret;
-  beginGroup("credentials-" + scope);
-  ret.first = value("username").toString();
-  ret.second = value("password").toString();
-  endGroup();
+  QSettings *settings = state;
+  if (!state->childGroups().contains("credentials-" + scope))
+    settings = this;
+
+  settings->beginGroup("credentials-" + scope);
+  ret.first = settings->value("username").toString();
+  ret.second = settings->value("password").toString();
+  settings->endGroup();
   return ret;
 }
 
+QStringList SsuCoreConfig::credentialScopes(){
+  if (state->contains("credentialScopes"))
+    return state->value("credentialScopes").toStringList();
+  else
+    return value("credentialScopes").toStringList();
+}
+
 QString SsuCoreConfig::credentialsScope(QString repoName, bool rndRepo){
   if (contains("credentials-scope"))
     return value("credentials-scope").toString();
@@ -76,7 +219,10 @@ bool SsuCoreConfig::isRegistered(){
 }
 
 QDateTime SsuCoreConfig::lastCredentialsUpdate(){
-  return value("lastCredentialsUpdate").toDateTime();
+  if (state->contains("lastCredentialsUpdate"))
+    return state->value("lastCredentialsUpdate").toDateTime();
+  else
+    return value("lastCredentialsUpdate").toDateTime();
 }
 
 QString SsuCoreConfig::release(bool rnd){
@@ -87,6 +233,7 @@ QString SsuCoreConfig::release(bool rnd){
 }
 
 void SsuCoreConfig::setDeviceMode(int mode, int editMode){
+  beginBatch();
   int oldMode = value("deviceMode").toInt();
 
   if ((editMode & Ssu::Add) == Ssu::Add){
@@ -97,17 +244,19 @@ void SsuCoreConfig::setDeviceMode(int mode, int editMode){
     oldMode = mode;
 
   setValue("deviceMode", oldMode);
-  sync();
+  endBatch();
 }
 
 void SsuCoreConfig::setFlavour(QString flavour){
+  beginBatch();
   setValue("flavour", flavour);
   // flavour is RnD only, so enable RnD mode
   setDeviceMode(Ssu::RndMode, Ssu::Add);
-  sync();
+  endBatch();
 }
 
 void SsuCoreConfig::setRelease(QString release, bool rnd){
+  beginBatch();
   if (rnd) {
     setValue("rndRelease", release);
     // switch rndMode on/off when setting releases
@@ -116,14 +265,34 @@ void SsuCoreConfig::setRelease(QString release, bool rnd){
     setValue("release", release);
     setDeviceMode(Ssu::RndMode, Ssu::Remove);
   }
-  sync();
+  endBatch();
 }
 
 void SsuCoreConfig::setDomain(QString domain){
+  beginBatch();
   // - in domain messes with default section autodetection,
   // so change it to :
   setValue("domain", domain.replace("-", ":"));
-  sync();
+  endBatch();
+}
+
+void SsuCoreConfig::setCredentials(const QString &scope, const QString &username,
+                                   const QString &password){
+  createStateFile();
+  beginBatch();
+  state->beginGroup("credentials-" + scope);
+  state->setValue("username", username);
+  state->setValue("password", password);
+  state->endGroup();
+  endBatch();
+}
+
+void SsuCoreConfig::setCredentialScopes(const QStringList &scopes){
+  createStateFile();
+  beginBatch();
+  state->setValue("credentialScopes", scopes);
+  state->setValue("lastCredentialsUpdate", QDateTime::currentDateTime());
+  endBatch();
 }
 
 bool SsuCoreConfig::useSslVerify(){
@@ -8,9 +8,13 @@
 #ifndef _SSUCORECONFIG_H
 #define _SSUCORECONFIG_H
 
+#include <QMutex>
 #include <QObject>
+#include <QSharedPointer>
 
 #include "ssusettings.h"
+#include "ssusettingssnapshot_p.h"
+#include "ssusettingsview.h"
 #include "ssu.h"
 
 #ifndef SSU_CONFIGURATION
@@ -28,11 +32,31 @@ class SsuCoreConfig: public SsuSettings {
 
   public:
     static SsuCoreConfig *instance();
+    /**
+     * Start batching syncs: the setters skip their sync() until the matching
+     * endBatch(), so several changes are written with a single sync.
+     * Batches may be nested.
+     *
+     * QSettings may still write pending changes earlier, e.g. from the event
+     * loop or on destruction, and ssu.ini and the state file are synced one
+     * after the other; each file is replaced as a whole, but a reader may see
+     * one of them updated and the other not yet.
+     */
+    void beginBatch();
+    /**
+     * End a batch started with beginBatch(). Ending the outermost batch
+     * calls sync() once for all changes made since it started
+     */
+    void endBatch();
     /**
      * Find a username/password pair for the given scope
      * @return a QPair with username and password, or an empty QPair if scope is invalid
      */
     QPair<QString, QString> credentials(QString scope);
+    /**
+     * Return the scopes of the credentials received with the last update
+     */
+    QStringList credentialScopes();
     /**
      * Get the scope for a repository, taking into account different scopes for
      * release and RnD repositories
@@ -94,6 +118,27 @@ class SsuCoreConfig: public SsuSettings {
      * Set the domain string (usually something like nemo, jolla, ..)
      */
     Q_INVOKABLE void setDomain(QString domain);
+    /**
+     * Store the username/password pair for scope
+     */
+    void setCredentials(const QString &scope, const QString &username, const QString &password);
+    /**
+     * Replace the list of credential scopes, keeping the given order, and set
+     * the time of the last credentials update to now
+     */
+    void setCredentialScopes(const QStringList &scopes);
+    /**
+     * Write pending changes, and pick up changes other processes made to
+     * ssu.ini and the state file. Unlike sync() this includes the state file.
+     */
+    void syncAll();
+    /**
+     * Return a read only copy of ssu.ini, e.g. for an SsuDeviceQuery. The
+     * copy is shared by all callers as long as ssu.ini did not change on
+     * disk, no batch is open, and syncAll() was not called since; changes
+     * made with setValue() outside of a batch show up after syncing them.
+     */
+    QSharedPointer<SsuSettingsView> view();
     /**
      * Return configuration settings regarding ssl verification
      * @retval true SSL verification must be used; that's the default if not configured
@@ -103,10 +148,26 @@ class SsuCoreConfig: public SsuSettings {
 
 
   private:
-    SsuCoreConfig(): SsuSettings(SSU_CONFIGURATION, QSettings::IniFormat, SSU_DEFAULT_CONFIGURATION) {};
+    SsuCoreConfig();
     SsuCoreConfig(const SsuCoreConfig &); // hide copy constructor
 
     static SsuCoreConfig *ssuCoreConfig;
+    int batchDepth;
+    /// Copy of ssu.ini returned by view(), and the stamp of the file it was read from
+    QMutex viewMutex;
+    QSharedPointer<SsuSettingsView> cachedView;
+    SsuSettingsSnapshot::Stamp viewStamp;
+    /**
+     * Credentials and the time of their last update, in SSU_STATE. Keys not
+     * found there are looked up in ssu.ini, where older versions kept them
+     */
+    SsuSettings *state;
+
+    /// Move state keys from ssu.ini to the state file
+    void migrateState();
+    /// Create the state file and its directory, writable for the ssu group
+    void createStateFile();
+    static bool isStateKey(const QString &key);
 };
 
 
@@ -8,16 +8,27 @@
 
 #include <QTextStream>
 #include <QDir>
-
+#include <QFileInfo>
+#include <QCryptographicHash>
+#include <QDBusReply>
+#include <QMutex>
+#include <QMutexLocker>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <sys/utsname.h>
 
 extern "C" {
 #include <boardname.h>
 }
 
+#include "sandbox_p.h"
 #include "ssudeviceinfo.h"
 #include "ssucoreconfig.h"
+#include "ssudevicequery.h"
 #include "ssulog.h"
+#include "ssupatternmatcher_p.h"
 #include "ssuvariables.h"
 
 #include "../constants.h"
@@ -29,7 +40,11 @@ extern "C" {
 
 SsuDeviceInfo::SsuDeviceInfo(QString model): QObject(){
 
-    boardMappings = new SsuSettings(SSU_BOARD_MAPPING_CONFIGURATION, SSU_BOARD_MAPPING_CONFIGURATION_DIR);
+    // board mappings are shared between all instances, and only re-read if
+    // the configuration changed. board-mappings.d is layered on top in memory,
+    // so looking up the device never writes to /usr
+    boardMappings = SsuSettingsView::shared(SSU_BOARD_MAPPING_CONFIGURATION,
+                                            SSU_BOARD_MAPPING_CONFIGURATION_DIR);
     if (!model.isEmpty())
       cachedModel = model;
 }
@@ -46,54 +61,7 @@ QStringList SsuDeviceInfo::adaptationRepos(){
 }
 
 QString SsuDeviceInfo::adaptationVariables(const QString &adaptationName, QHash<QString, QString> *storageHash){
-  SsuLog *ssuLog = SsuLog::instance();
-  QStringList adaptationRepoList = adaptationRepos();
-  // special handling for adaptation-repositories
-  // - check if repo is in right format (adaptation\d*)
-  // - check if the configuration has that many adaptation repos
-  // - export the entry in the adaptation list as %(adaptation)
-  // - look up variables for that adaptation, and export matching
-  //   adaptation variable
-  QRegExp regex("adaptation\\\d*", Qt::CaseSensitive, QRegExp::RegExp2);
-  if (regex.exactMatch(adaptationName)){
-    regex.setPattern("\\\d*");
-    regex.lastIndexIn(adaptationName);
-    int n = regex.cap().toInt();
-
-    if (!adaptationRepoList.isEmpty()){
-      if (adaptationRepoList.size() <= n) {
-        ssuLog->print(LOG_INFO, "Note: repo index out of bounds, substituting 0" + adaptationName);
-        n = 0;
-      }
-
-      QString adaptationRepo = adaptationRepoList.at(n);
-      storageHash->insert("adaptation", adaptationRepo);
-      ssuLog->print(LOG_DEBUG, "Found first adaptation " + adaptationName);
-
-      QString model = deviceVariant(true);
-      QHash<QString, QString> h;
-
-      // add global variables for this model
-      if (boardMappings->contains(model + "/variables")){
-        QStringList sections = boardMappings->value(model + "/variables").toStringList();
-        foreach(const QString &section, sections)
-          variableSection(section, &h);
-      }
-
-      // override with variables specific to this repository
-      variableSection(adaptationRepo, &h);
-
-      QHash<QString, QString>::const_iterator i = h.constBegin();
-      while (i != h.constEnd()){
-        storageHash->insert(i.key(), i.value());
-        i++;
-      }
-    } else
-      ssuLog->print(LOG_INFO, "Note: adaptation repo for invalid repo requested " + adaptationName);
-
-    return "adaptation";
-  }
-  return adaptationName;
+  return SsuDeviceQuery().adaptationVariablesOf(deviceModel(), adaptationName, storageHash);
 }
 
 void SsuDeviceInfo::clearCache(){
@@ -103,24 +71,7 @@ void SsuDeviceInfo::clearCache(){
 }
 
 bool SsuDeviceInfo::contains(const QString &model){
-  QString oldModel = deviceModel();
-  bool found = false;
-
-  if (!model.isEmpty()){
-    clearCache();
-    setDeviceModel(model);
-  }
-
-  if (!deviceVariant(false).isEmpty())
-    found = true;
-  if (boardMappings->childGroups().contains(deviceModel()))
-    found = true;
-
-  if (!model.isEmpty()){
-    clearCache();
-    setDeviceModel(oldModel);
-  }
-  return found;
+  return SsuDeviceQuery().contains(model.isEmpty() ? deviceModel() : model);
 }
 
 QString SsuDeviceInfo::deviceFamily(){
@@ -154,27 +105,39 @@ QString SsuDeviceInfo::deviceVariant(bool fallback){
 }
 
 QString SsuDeviceInfo::deviceModel(){
+  if (!cachedModel.isEmpty())
+    return cachedModel;
+
+  QString fingerprint = identityFingerprint();
+  if (readIdentityCache(fingerprint))
+    return cachedModel;
+
+  detectModel();
+  // a device not recognized (yet) should be probed again next time, e.g.
+  // if detection ran before everything it depends on was available
+  if (cachedModel != "UNKNOWN")
+    writeIdentityCache(fingerprint);
+
+  return cachedModel;
+}
+
+void SsuDeviceInfo::detectModel(){
   QDir dir;
   QFile procCpuinfo;
   QStringList keys;
   QStringList sections;
 
-  if (!cachedModel.isEmpty())
-    return cachedModel;
-
-  boardMappings->beginGroup("file.exists");
-  keys = boardMappings->allKeys();
+  keys = boardMappings->allKeys("file.exists");
 
   // check if the device can be identified by testing for a file
   foreach (const QString &key, keys){
-    QString value = boardMappings->value(key).toString();
+    QString value = boardMappings->value("file.exists/" + key).toString();
     if (dir.exists(value)){
       cachedModel = key;
       break;
     }
   }
-  boardMappings->endGroup();
-  if (!cachedModel.isEmpty()) return cachedModel;
+  if (!cachedModel.isEmpty()) return;
 
   // check if boardname matches/contains
   QString boardName(getboardname());
@@ -182,26 +145,21 @@ QString SsuDeviceInfo::deviceModel(){
   sections.clear();
   sections << "boardname.equals" << "boardname.contains";
   foreach (const QString &section, sections){
-    boardMappings->beginGroup(section);
-    keys = boardMappings->allKeys();
-    foreach (const QString &key, keys){
-      QString value = boardMappings->value(key).toString();
-      if (section.endsWith(".contains")){
-        if (boardName.contains(value)){
-          cachedModel = key;
-          break;
-        }
-      } else if (section.endsWith(".equals")){
+    if (section.endsWith(".contains")){
+      cachedModel = matchContains(section, boardName);
+    } else if (section.endsWith(".equals")){
+      keys = boardMappings->allKeys(section);
+      foreach (const QString &key, keys){
+        QString value = boardMappings->value(section + "/" + key).toString();
         if (boardName == value){
           cachedModel = key;
           break;
         }
       }
     }
-    boardMappings->endGroup();
     if (!cachedModel.isEmpty()) break;
   }
-  if (!cachedModel.isEmpty()) return cachedModel;
+  if (!cachedModel.isEmpty()) return;
 
   // check if the QSystemInfo model is useful
   //QSystemDeviceInfo devInfo;
@@ -213,17 +171,15 @@ QString SsuDeviceInfo::deviceModel(){
   /*
   QSystemDeviceInfoLinuxCommonPrivate devInfo;
   QString model = devInfo.model();
-  boardMappings->beginGroup("systeminfo.equals");
-  keys = boardMappings->allKeys();
+  keys = boardMappings->allKeys("systeminfo.equals");
   foreach (const QString &key, keys){
-    QString value = boardMappings->value(key).toString();
+    QString value = boardMappings->value("systeminfo.equals/" + key).toString();
     if (model == value){
       cachedModel = key;
       break;
     }
   }
-  boardMappings->endGroup();
-  if (!cachedModel.isEmpty()) return cachedModel;
+  if (!cachedModel.isEmpty()) return;
   */
 
   // check if the device can be identified by a string in /proc/cpuinfo
@@ -232,158 +188,304 @@ QString SsuDeviceInfo::deviceModel(){
   if (procCpuinfo.isOpen()){
     QTextStream in(&procCpuinfo);
     QString cpuinfo = in.readAll();
-    boardMappings->beginGroup("cpuinfo.contains");
-    keys = boardMappings->allKeys();
-
-    foreach (const QString &key, keys){
-      QString value = boardMappings->value(key).toString();
-      if (cpuinfo.contains(value)){
-        cachedModel = key;
-        break;
-      }
-    }
-    boardMappings->endGroup();
+    cachedModel = matchContains("cpuinfo.contains", cpuinfo);
   }
-  if (!cachedModel.isEmpty()) return cachedModel;
+  if (!cachedModel.isEmpty()) return;
 
   // check if the device can be identified by the kernel version string
   struct utsname buf;
   if (!uname(&buf)){
     QString utsRelease(buf.release);
-    boardMappings->beginGroup("uname-release.contains");
-    keys = boardMappings->allKeys();
-
-    foreach (const QString &key, keys){
-      QString value = boardMappings->value(key).toString();
-      if (utsRelease.contains(value)){
-        cachedModel = key;
-        break;
-      }
-    }
-    boardMappings->endGroup();
+    cachedModel = matchContains("uname-release.contains", utsRelease);
   }
-  if (!cachedModel.isEmpty()) return cachedModel;
+  if (!cachedModel.isEmpty()) return;
 
   // check if there's a match on arch of generic fallback. This probably
   // only makes sense for x86
-  boardMappings->beginGroup("arch.equals");
-  keys = boardMappings->allKeys();
+  keys = boardMappings->allKeys("arch.equals");
 
   SsuCoreConfig *settings = SsuCoreConfig::instance();
   foreach (const QString &key, keys){
-    QString value = boardMappings->value(key).toString();
+    QString value = boardMappings->value("arch.equals/" + key).toString();
     if (settings->value("arch").toString() == value){
       cachedModel = key;
       break;
     }
   }
-  boardMappings->endGroup();
   if (cachedModel.isEmpty()) cachedModel = "UNKNOWN";
+}
 
-  return cachedModel;
+namespace {
+  // keys of a *.contains section, and the matcher for their values
+  struct ContainsSection {
+    QStringList keys;
+    SsuPatternMatcher matcher;
+
+    ContainsSection(): matcher(QStringList()) {}
+  };
+}
+
+QString SsuDeviceInfo::matchContains(const QString &section, const QString &text){
+  static QMutex mutex;
+  static QSharedPointer<SsuSettingsView> cachedMappings;
+  static QHash<QString, ContainsSection> compiled;
+
+  ContainsSection entry;
+  {
+    // shared() returns the same object as long as the board mappings did not
+    // change, so the matchers are only built again after a change
+    QMutexLocker locker(&mutex);
+    if (cachedMappings != boardMappings){
+      compiled.clear();
+      cachedMappings = boardMappings;
+    }
+
+    QHash<QString, ContainsSection>::const_iterator it = compiled.constFind(section);
+    if (it == compiled.constEnd()){
+      ContainsSection built;
+      QStringList patterns;
+
+      built.keys = boardMappings->allKeys(section);
+      foreach (const QString &key, built.keys)
+        patterns.append(boardMappings->value(section + "/" + key).toString());
+
+      built.matcher = SsuPatternMatcher(patterns);
+      it = compiled.insert(section, built);
+    }
+    entry = it.value();
+  }
+
+  // all patterns are checked in one pass over text; the first key in the
+  // section matching wins, as when checking the keys one by one
+  int match = entry.matcher.firstMatch(text);
+  if (match == -1)
+    return "";
+
+  return entry.keys.at(match);
 }
 
 QString SsuDeviceInfo::deviceUid(){
+  static QMutex mutex;
+  static QString uid;
+
+  // concurrent callers wait for the first lookup instead of querying the
+  // modem again. Only the IMEI is remembered, so a later call picks it up
+  // once the modem is available
+  QMutexLocker locker(&mutex);
+  if (!uid.isEmpty())
+    return uid;
+
+  QFile uidCache(Sandbox::map(SSU_DEVICE_UID_CACHE));
+  if (uidCache.open(QIODevice::ReadOnly | QIODevice::Text)){
+    uid = QString::fromUtf8(uidCache.readAll()).trimmed();
+    uidCache.close();
+    if (!uid.isEmpty())
+      return uid;
+  }
+
+  // don't wait for the modem again if oFono reported none earlier in this boot
   QString IMEI;
-  //QSystemDeviceInfo devInfo;
-  QSystemDeviceInfoLinuxCommonPrivate devInfo;
+  QString missingKey = missingModemKey();
+  QFile missing(Sandbox::map(SSU_DEVICE_UID_MISSING));
+  bool knownMissing = false;
+  if (missing.open(QIODevice::ReadOnly | QIODevice::Text)){
+    knownMissing = QString::fromUtf8(missing.readAll()).trimmed() == missingKey;
+    missing.close();
+  }
 
-  IMEI = devInfo.imei();
+  bool noModem = false;
+  if (!knownMissing)
+    IMEI = modemSerial(SSU_DEVICE_UID_TIMEOUT, &noModem);
+
+  if (!IMEI.isEmpty()){
+    // the IMEI is only readable by the owner; fchmod() covers a cache file
+    // created with other permissions earlier
+    QDir().mkpath(QFileInfo(uidCache).absolutePath());
+    int fd = ::open(QFile::encodeName(uidCache.fileName()).constData(),
+                    O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd != -1){
+      ::fchmod(fd, 0600);
+      if (uidCache.open(fd, QIODevice::WriteOnly, QFile::AutoCloseHandle)){
+        uidCache.write(IMEI.toUtf8());
+        uidCache.close();
+      } else
+        ::close(fd);
+    }
+    QFile::remove(missing.fileName());
 
-  // this might not be completely unique (or might change on reflash), but works for now
-  if (IMEI == ""){
-      IMEI = devInfo.uniqueDeviceID();
+    uid = IMEI;
+    return uid;
+  }
+
+  // a timeout, a D-Bus error or a modem which isn't powered yet may resolve
+  // later in this boot, so only a device without any modem is recorded
+  if (noModem){
+    QDir().mkpath(QFileInfo(missing).absolutePath());
+    if (missing.open(QIODevice::WriteOnly | QIODevice::Text | QIODevice::Truncate)){
+      missing.write(missingKey.toUtf8());
+      missing.close();
+    }
   }
 
-  return IMEI;
+  // this might not be completely unique (or might change on reflash), but works for now
+  //QSystemDeviceInfo devInfo;
+  QSystemDeviceInfoLinuxCommonPrivate devInfo;
+  return devInfo.uniqueDeviceID();
 }
 
-QStringList SsuDeviceInfo::disabledRepos(){
-  QStringList result;
+QString SsuDeviceInfo::missingModemKey(){
+  QString bootId;
+  QFile file("/proc/sys/kernel/random/boot_id");
+  if (file.open(QIODevice::ReadOnly | QIODevice::Text))
+    bootId = QString::fromUtf8(file.readAll()).trimmed();
 
-  QString model = deviceVariant(true);
+  return identityFingerprint() + " " + bootId;
+}
 
-  if (boardMappings->contains(model + "/disabled-repos"))
-    result = boardMappings->value(model + "/disabled-repos").toStringList();
+// GetModems already returns the properties of all modems, so a single call is
+// enough to find the serial of the first powered modem. The call is synchronous
+// and blocks until oFono replied, or timeout ms passed. noModem is only set if
+// oFono replied without any modem
+QString SsuDeviceInfo::modemSerial(int timeout, bool *noModem){
+  *noModem = false;
 
-  return result;
-}
+  QOfonoManagerInterface ofonoManager;
+  ofonoManager.setTimeout(timeout);
 
-// this half belongs into repo-manager, as it not only handles board-specific
-// repositories. Right now this one looks like the better place due to the
-// connection to board specific stuff, though
-QStringList SsuDeviceInfo::repos(bool rnd, int filter){
-  int adaptationCount = adaptationRepos().size();
-  QStringList result;
+  QDBusReply<QOfonoPropertyMap> reply = ofonoManager.call(QLatin1String("GetModems"));
 
-  if (filter == SsuRepoManager::NoFilter ||
-      filter == SsuRepoManager::BoardFilter ||
-      filter == SsuRepoManager::BoardFilterUserBlacklist){
-    // for repo names we have adaptation0, adaptation1, ..., adaptationN
-    for (int i=0; i<adaptationCount; i++)
-      result.append(QString("adaptation%1").arg(i));
-
-    // now read the release/rnd repos
-    SsuSettings repoSettings(SSU_REPO_CONFIGURATION, QSettings::IniFormat);
-    QString repoKey = (rnd ? "default-repos/rnd" : "default-repos/release");
-    if (repoSettings.contains(repoKey))
-      result.append(repoSettings.value(repoKey).toStringList());
-
-    // TODO: add specific repos (developer, sdk, ..)
-
-    // add device configured repos
-    if (boardMappings->contains(deviceVariant(true) + "/repos"))
-      result.append(boardMappings->value(deviceVariant(true) + "/repos").toStringList());
-
-    // read the disabled repositories for this device
-    // user can override repositories disabled here in the user configuration
-    foreach (const QString &key, disabledRepos())
-      result.removeAll(key);
+  if (!reply.isValid()){
+    SsuLog::instance()->print(LOG_DEBUG, QString("Unable to query modems: %1")
+                              .arg(reply.error().message()));
+    return QString();
   }
 
-  // read user-defined repositories from ssu.ini
-  // TODO: in strict mode, filter the repository list from there
-  SsuCoreConfig *ssuSettings = SsuCoreConfig::instance();
+  *noModem = reply.value().isEmpty();
+  foreach (const QOfonoProperties &modem, reply.value()){
+    if (!modem.properties.value("Powered").toBool())
+      continue;
 
-  if (filter == SsuRepoManager::NoFilter ||
-      filter == SsuRepoManager::UserFilter){
-    ssuSettings->beginGroup("repository-urls");
-    result.append(ssuSettings->allKeys());
-    ssuSettings->endGroup();
+    QString serial = modem.properties.value("Serial").toString();
+    if (!serial.isEmpty())
+      return serial;
+  }
+
+  return QString();
+}
 
-    // read user-enabled repositories from ssu.ini
-    if (ssuSettings->contains("enabled-repos"))
-      result.append(ssuSettings->value("enabled-repos").toStringList());
+// fingerprint of everything model detection depends on which can be checked
+// without probing the device. The board mappings are covered by the stamps of
+// their files, and the probe inputs are only read once per process, or again
+// after the board mappings changed or refresh is set
+QString SsuDeviceInfo::identityFingerprint(bool refresh){
+  static QMutex mutex;
+  static QSharedPointer<SsuSettingsView> cachedMappings;
+  static QString cachedFingerprint;
+
+  QMutexLocker locker(&mutex);
+  if (!refresh && cachedMappings == boardMappings && !cachedFingerprint.isEmpty())
+    return cachedFingerprint;
+
+  QCryptographicHash hash(QCryptographicHash::Sha1);
+
+  foreach (const QString &fileName, boardMappings->sourceFiles()){
+    QFileInfo info(fileName);
+    hash.addData(QFile::encodeName(fileName));
+    hash.addData(QString(" %1 %2\n")
+                 .arg(info.size())
+                 .arg(info.lastModified().toMSecsSinceEpoch()).toUtf8());
   }
 
-  if (filter == SsuRepoManager::NoFilter ||
-      filter == SsuRepoManager::UserFilter ||
-      filter == SsuRepoManager::BoardFilterUserBlacklist){
-    // read the disabled repositories from user configuration
-    if (ssuSettings->contains("disabled-repos")){
-      foreach (const QString &key, ssuSettings->value("disabled-repos").toStringList())
-        result.removeAll(key);
-    }
+  // results of the file.exists probes, as those files may appear later
+  foreach (const QString &key, boardMappings->allKeys("file.exists")){
+    QString value = boardMappings->value("file.exists/" + key).toString();
+    hash.addData(QFile::encodeName(value));
+    hash.addData(QDir().exists(value) ? "=1\n" : "=0\n");
   }
 
-  result.removeDuplicates();
+  struct utsname buf;
+  if (!uname(&buf))
+    hash.addData(buf.release);
+  hash.addData("\n");
+
+  hash.addData(QByteArray(getboardname()).trimmed());
+  hash.addData("\n");
+
+  SsuCoreConfig *settings = SsuCoreConfig::instance();
+  hash.addData(settings->value("arch").toString().toUtf8());
+
+  cachedMappings = boardMappings;
+  cachedFingerprint = hash.result().toHex();
+  return cachedFingerprint;
+}
+
+bool SsuDeviceInfo::readIdentityCache(const QString &fingerprint){
+  QString cacheFile = Sandbox::map(SSU_DEVICE_IDENTITY_CACHE);
+  if (!QFile::exists(cacheFile))
+    return false;
+
+  QSettings cache(cacheFile, QSettings::IniFormat);
+  if (cache.value("fingerprint").toString() != fingerprint)
+    return false;
+
+  cachedModel = cache.value("model").toString();
+  cachedVariant = cache.value("variant").toString();
+  cachedFamily = cache.value("family").toString();
+
+  SsuLog::instance()->print(LOG_DEBUG, QString("Using cached device model %1").arg(cachedModel));
+  return !cachedModel.isEmpty();
+}
+
+void SsuDeviceInfo::writeIdentityCache(const QString &fingerprint){
+  QString cacheFile = Sandbox::map(SSU_DEVICE_IDENTITY_CACHE);
+
+  // failing to write the cache is not an error, detection will just be
+  // done again next time
+  QDir().mkpath(QFileInfo(cacheFile).absolutePath());
+  QSettings cache(cacheFile, QSettings::IniFormat);
+  cache.setValue("fingerprint", fingerprint);
+  cache.setValue("model", cachedModel);
+  cache.setValue("variant", deviceVariant());
+  cache.setValue("family", deviceFamily());
+  cache.sync();
+}
+
+QStringList SsuDeviceInfo::disabledRepos(){
+  QStringList result;
+
+  QString model = deviceVariant(true);
+
+  if (boardMappings->contains(model + "/disabled-repos"))
+    result = boardMappings->value(model + "/disabled-repos").toStringList();
+
   return result;
 }
 
+QStringList SsuDeviceInfo::repos(bool rnd, int filter){
+  return SsuDeviceQuery().reposOf(deviceModel(), rnd, filter);
+}
+
 QVariant SsuDeviceInfo::variable(QString section, const QString &key){
   /// @todo compat-setting as ssudeviceinfo guaranteed to prepend sections with var-;
   ///       SsuVariables does not have this guarantee. Remove from here as well.
   if (!section.startsWith("var-"))
     section = "var-" + section;
 
-  return SsuVariables::variable(boardMappings, section, key);
+  return SsuVariables::variable(boardMappings.data(), section, key);
 }
 
 void SsuDeviceInfo::variableSection(QString section, QHash<QString, QString> *storageHash){
   if (!section.startsWith("var-"))
     section = "var-" + section;
 
-  SsuVariables::variableSection(boardMappings, section, storageHash);
+  SsuVariables::variableSection(boardMappings.data(), section, storageHash);
+}
+
+QString SsuDeviceInfo::redetectDeviceModel(){
+  QFile::remove(Sandbox::map(SSU_DEVICE_IDENTITY_CACHE));
+  identityFingerprint(true);
+  clearCache();
+  return deviceModel();
 }
 
 void SsuDeviceInfo::setDeviceModel(QString model){
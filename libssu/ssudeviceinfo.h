@@ -11,6 +11,7 @@
 #include <QObject>
 
 #include "ssusettings.h"
+#include "ssusettingsview.h"
 #include "ssurepomanager.h"
 
 class SsuDeviceInfo: public QObject {
@@ -38,8 +39,8 @@ class SsuDeviceInfo: public QObject {
     bool contains(const QString &model="");
     /**
      * Try to find the device family for the system this is running on. This function
-     * temporarily changes the detected model, and therefore should not be used in a
-     * multithreaded environment, unless you like funny results.
+     * changes cached values of this object, and therefore should not be used in a
+     * multithreaded environment; use SsuDeviceQuery::familyOf() there.
      */
     Q_INVOKABLE QString deviceFamily();
     /**
@@ -50,11 +51,33 @@ class SsuDeviceInfo: public QObject {
     Q_INVOKABLE QString deviceVariant(bool fallback=false);
     /**
      * Try to find out ond what kind of system this is running
+     *
+     * The result of the autodetection is persisted, together with a fingerprint
+     * of the board mapping file stamps, file.exists probes, kernel release and
+     * boardname, computed once per process. As long as the fingerprint
+     * matches the persisted model, variant and family are used without
+     * probing the device again. An UNKNOWN model is not persisted. Use redetectDeviceModel() to force a new detection.
      */
     Q_INVOKABLE QString deviceModel();
     /**
      * Calculate the device ID used in SSU requests
-     * @return QSystemDeviceInfo::imei(), if available, or QSystemDeviceInfo::uniqueDeviceID()
+     *
+     * The IMEI of the first powered modem is queried from oFono with a
+     * synchronous D-Bus call, which blocks the calling thread until oFono
+     * replied, for at most SSU_DEVICE_UID_TIMEOUT ms. A found IMEI is
+     * remembered for the lifetime of the process, and persisted in
+     * SSU_DEVICE_UID_CACHE (mode 0600), so later lookups don't need the modem
+     * at all. If oFono reports no modem at all this is recorded in
+     * SSU_DEVICE_UID_MISSING for the device identity and the current boot, so
+     * only the first lookup after booting waits for oFono. Timeouts, D-Bus
+     * errors and unpowered modems are not recorded, and the fallback is not
+     * remembered, so the next lookup asks the modem again.
+     *
+     * Returning the fallback while the modem is still queried would identify
+     * the device with different UIDs in consecutive requests, so the lookup
+     * is not asynchronous. Concurrent callers wait for the first lookup.
+     *
+     * @return the IMEI, if available, or QSystemDeviceInfo::uniqueDeviceID()
      */
     Q_INVOKABLE QString deviceUid();
     /**
@@ -67,8 +90,15 @@ class SsuDeviceInfo: public QObject {
      * Depending on the filter options, all repostories (user and board),
      * only board-specific, or only user-specific are returned.
      * Disabled repositories are excluded depending on filter settings.
+     *
+     * @see SsuDeviceQuery::reposOf()
      */
     QStringList repos(bool rnd=false, int filter=SsuRepoManager::NoFilter);
+    /**
+     * Drop the persisted device identity, and run model autodetection again
+     * @return the newly detected device model
+     */
+    Q_INVOKABLE QString redetectDeviceModel();
     /**
      * Override device model autodetection
      */
@@ -93,9 +123,21 @@ class SsuDeviceInfo: public QObject {
 
 
   private:
-    SsuSettings *boardMappings;
+    QSharedPointer<SsuSettingsView> boardMappings;
     QString cachedFamily, cachedModel, cachedVariant;
 
     void clearCache();
+    void detectModel();
+    /**
+     * Return the first key in section with a value contained in text, or an
+     * empty string
+     */
+    QString matchContains(const QString &section, const QString &text);
+    static QString modemSerial(int timeout, bool *noModem);
+    /// Key for remembering a failed modem lookup: device identity and boot
+    QString missingModemKey();
+    QString identityFingerprint(bool refresh=false);
+    bool readIdentityCache(const QString &fingerprint);
+    void writeIdentityCache(const QString &fingerprint);
 };
 #endif
@@ -0,0 +1,360 @@
+/**
+ * @file ssudevicequery.cpp
+ * @copyright 2013 Jolla Ltd.
+ * @author Bernd Wachter <bwachter@lart.info>
+ * @date 2013
+ */
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QRegExp>
+#include <QSet>
+
+#include "ssudevicequery.h"
+#include "ssucoreconfig.h"
+#include "ssulog.h"
+#include "ssusettingsview.h"
+#include "ssuvariables.h"
+
+#include "../constants.h"
+
+struct SsuDeviceQueryData {
+  /// All keys of the board mappings, and the sections in them
+  QHash<QString, QVariant> boardMappings;
+  QSet<QString> sections;
+  QStringList models;
+  QStringList releaseRepos, rndRepos;
+  /// Repositories from the user configuration
+  QStringList userRepos, enabledRepos, disabledRepos;
+  /**
+   * Read only views of the configuration files, for variable lookups; the
+   * variable sections flattened from them are cached in these objects
+   */
+  QSharedPointer<SsuSettingsView> boardMappingSettings, repoSettings, configuration;
+};
+
+static QStringList deviceModels(const SsuDeviceQueryData *data){
+  QSet<QString> models;
+
+  // models are what detection and the variants map to, and the sections
+  // setting keys of a model; other sections, like kickstart-defaults or
+  // var-*, are no models
+  foreach (const QString &key, data->boardMappings.keys()){
+    QString section = key.section('/', 0, 0);
+    QString name = key.section('/', 1);
+
+    if (section == "variants" || section.endsWith(".exists") ||
+        section.endsWith(".equals") || section.endsWith(".contains"))
+      models.insert(name);
+    else if (name == "family" || name == "adaptation-repos")
+      models.insert(section);
+  }
+
+  models.remove("UNKNOWN");
+
+  QStringList result;
+  foreach (const QString &model, models)
+    result.append(model);
+  result.sort();
+  return result;
+}
+
+SsuDeviceQuery::SsuDeviceQuery(): inputs(0){
+  static QMutex mutex;
+  static QSharedPointer<SsuDeviceQueryData> cachedData;
+
+  QSharedPointer<SsuSettingsView> boardMappings =
+    SsuSettingsView::shared(SSU_BOARD_MAPPING_CONFIGURATION,
+                            SSU_BOARD_MAPPING_CONFIGURATION_DIR);
+  QSharedPointer<SsuSettingsView> repoSettings = SsuSettingsView::shared(SSU_REPO_CONFIGURATION);
+
+  QSharedPointer<SsuDeviceQueryData> data(new SsuDeviceQueryData);
+
+  {
+    // shared() returns the same views as long as the files did not change,
+    // so indexing the board mappings is only needed after a change
+    QMutexLocker locker(&mutex);
+    if (cachedData.isNull() || cachedData->boardMappingSettings != boardMappings ||
+        cachedData->repoSettings != repoSettings){
+      cachedData = QSharedPointer<SsuDeviceQueryData>(new SsuDeviceQueryData);
+      foreach (const QString &key, boardMappings->allKeys())
+        cachedData->boardMappings.insert(key, boardMappings->value(key));
+      cachedData->boardMappingSettings = boardMappings;
+      foreach (const QString &section, boardMappings->childGroups())
+        cachedData->sections.insert(section);
+      cachedData->models = deviceModels(cachedData.data());
+      cachedData->repoSettings = repoSettings;
+      cachedData->releaseRepos = repoSettings->value("default-repos/release").toStringList();
+      cachedData->rndRepos = repoSettings->value("default-repos/rnd").toStringList();
+    }
+    *data = *cachedData;
+  }
+
+  // ssu.ini is changed by ssu itself; the copy is only made again after
+  // a change
+  data->configuration = SsuCoreConfig::instance()->view();
+  data->userRepos = data->configuration->allKeys("repository-urls");
+  data->enabledRepos = data->configuration->value("enabled-repos").toStringList();
+  data->disabledRepos = data->configuration->value("disabled-repos").toStringList();
+
+  d = data;
+}
+
+bool SsuDeviceQuery::contains(const QString &model) const {
+  if (!variantOf(model).isEmpty())
+    return true;
+
+  record("keys", BoardMappings, model);
+  return d->sections.contains(model);
+}
+
+QStringList SsuDeviceQuery::models() const {
+  return d->models;
+}
+
+QString SsuDeviceQuery::variantOf(const QString &model, bool fallback) const {
+  QString variant = boardValue("variants/" + model).toString();
+
+  if (variant.isEmpty() && fallback)
+    return model;
+
+  return variant;
+}
+
+QString SsuDeviceQuery::familyOf(const QString &model) const {
+  return boardValue(variantOf(model, true) + "/family", "UNKNOWN").toString();
+}
+
+QStringList SsuDeviceQuery::adaptationReposOf(const QString &model) const {
+  return boardValue(variantOf(model, true) + "/adaptation-repos").toStringList();
+}
+
+QStringList SsuDeviceQuery::disabledReposOf(const QString &model) const {
+  return boardValue(variantOf(model, true) + "/disabled-repos").toStringList();
+}
+
+QStringList SsuDeviceQuery::reposOf(const QString &model, bool rnd, int filter) const {
+  QStringList result;
+
+  if (filter == SsuRepoManager::NoFilter ||
+      filter == SsuRepoManager::BoardFilter ||
+      filter == SsuRepoManager::BoardFilterUserBlacklist){
+    // for repo names we have adaptation0, adaptation1, ..., adaptationN
+    int adaptationCount = adaptationReposOf(model).size();
+    for (int i=0; i<adaptationCount; i++)
+      result.append(QString("adaptation%1").arg(i));
+
+    record("value", RepoConfiguration, rnd ? "default-repos/rnd" : "default-repos/release");
+    result.append(rnd ? d->rndRepos : d->releaseRepos);
+    result.append(boardValue(variantOf(model, true) + "/repos").toStringList());
+
+    // user can override repositories disabled here in the user configuration
+    foreach (const QString &key, disabledReposOf(model))
+      result.removeAll(key);
+  }
+
+  if (filter == SsuRepoManager::NoFilter ||
+      filter == SsuRepoManager::UserFilter){
+    record("keys", Configuration, "repository-urls");
+    record("value", Configuration, "enabled-repos");
+    result.append(d->userRepos);
+    result.append(d->enabledRepos);
+  }
+
+  if (filter == SsuRepoManager::NoFilter ||
+      filter == SsuRepoManager::UserFilter ||
+      filter == SsuRepoManager::BoardFilterUserBlacklist){
+    record("value", Configuration, "disabled-repos");
+    foreach (const QString &key, d->disabledRepos)
+      result.removeAll(key);
+  }
+
+  result.removeDuplicates();
+  return result;
+}
+
+QVariant SsuDeviceQuery::valueOf(const QString &model, const QString &key,
+                                 const QVariant &value) const {
+  QString variant = variantOf(model);
+
+  if (!variant.isEmpty()){
+    QVariant result = boardValue(variant + "/" + key);
+    if (result.isValid())
+      return result;
+  }
+
+  return boardValue(model + "/" + key, value);
+}
+
+QString SsuDeviceQuery::adaptationVariablesOf(const QString &model, const QString &adaptationName,
+                                              QHash<QString, QString> *storageHash) const {
+  SsuLog *ssuLog = SsuLog::instance();
+  QStringList adaptationRepoList = adaptationReposOf(model);
+  // special handling for adaptation-repositories
+  // - check if repo is in right format (adaptation\d*)
+  // - check if the configuration has that many adaptation repos
+  // - export the entry in the adaptation list as %(adaptation)
+  // - look up variables for that adaptation, and export matching
+  //   adaptation variable
+  QRegExp regex("adaptation\\\d*", Qt::CaseSensitive, QRegExp::RegExp2);
+  if (regex.exactMatch(adaptationName)){
+    regex.setPattern("\\\d*");
+    regex.lastIndexIn(adaptationName);
+    int n = regex.cap().toInt();
+
+    if (!adaptationRepoList.isEmpty()){
+      if (adaptationRepoList.size() <= n) {
+        ssuLog->print(LOG_INFO, "Note: repo index out of bounds, substituting 0" + adaptationName);
+        n = 0;
+      }
+
+      QString adaptationRepo = adaptationRepoList.at(n);
+      storageHash->insert("adaptation", adaptationRepo);
+      ssuLog->print(LOG_DEBUG, "Found first adaptation " + adaptationName);
+
+      QHash<QString, QString> h;
+
+      // add global variables for this model
+      QStringList sections = boardValue(variantOf(model, true) + "/variables").toStringList();
+      foreach (const QString &section, sections)
+        variableSection(BoardMappings, section.startsWith("var-") ? section : "var-" + section, &h);
+
+      // override with variables specific to this repository
+      variableSection(BoardMappings, "var-" + adaptationRepo, &h);
+
+      QHash<QString, QString>::const_iterator i = h.constBegin();
+      while (i != h.constEnd()){
+        storageHash->insert(i.key(), i.value());
+        i++;
+      }
+    } else
+      ssuLog->print(LOG_INFO, "Note: adaptation repo for invalid repo requested " + adaptationName);
+
+    return "adaptation";
+  }
+  return adaptationName;
+}
+
+QStringList SsuDeviceQuery::repoVariables(QHash<QString, QString> *storageHash, bool rnd) const {
+  QStringList configSections;
+
+  // fill in all arbitrary variables from ssu.ini
+  variableSection(Configuration, "repository-url-variables", storageHash);
+
+  // add/overwrite some of the variables with sane ones
+  if (rnd){
+    QString flavour = value(Configuration, "flavour", "release").toString();
+    QString flavourPattern =
+      value(RepoConfiguration, flavour + "-flavour/flavour-pattern").toString();
+    storageHash->insert("flavour", flavourPattern);
+    storageHash->insert("flavourPattern", flavourPattern);
+    storageHash->insert("flavourName", flavour);
+    configSections << flavour + "-flavour" << "rnd" << "all";
+
+    // Make it possible to give any values with the flavour as well.
+    // These values can be overridden later with domain if needed.
+    variableSection(RepoConfiguration, flavour + "-flavour", storageHash);
+  } else {
+    configSections << "release" << "all";
+  }
+
+  storageHash->insert("release",
+                      value(Configuration, rnd ? "rndRelease" : "release").toString());
+
+  if (!storageHash->contains("debugSplit"))
+    storageHash->insert("debugSplit", "packages");
+
+  if (!storageHash->contains("arch"))
+    storageHash->insert("arch", value(Configuration, "arch").toString());
+
+  return configSections;
+}
+
+QVariant SsuDeviceQuery::value(Source source, const QString &key, const QVariant &value) const {
+  record("value", source, key);
+  return settings(source)->value(key, value);
+}
+
+QVariant SsuDeviceQuery::variable(Source source, const QString &section, const QString &key) const {
+  record("variable", source, section + "/" + key);
+  return SsuVariables::variable(settings(source), section, key);
+}
+
+void SsuDeviceQuery::variableSection(Source source, const QString &section,
+                                     QHash<QString, QString> *storageHash) const {
+  record("variables", source, section);
+  SsuVariables::variableSection(settings(source), section, storageHash);
+}
+
+void SsuDeviceQuery::setInputs(QSet<QString> *inputs){
+  this->inputs = inputs;
+}
+
+QByteArray SsuDeviceQuery::inputHash(const QString &input) const {
+  // kind:source:name, as added by record(); names may contain ':'
+  QString kind = input.section(':', 0, 0);
+  QString sourceName = input.section(':', 1, 1);
+  QString name = input.section(':', 2);
+
+  Source source;
+  if (sourceName == "board-mappings")
+    source = BoardMappings;
+  else if (sourceName == "repos")
+    source = RepoConfiguration;
+  else if (sourceName == "ssu")
+    source = Configuration;
+  else
+    return QByteArray();
+
+  // looked up as the recorded lookup did, but without recording
+  SsuSettingsView *settings = this->settings(source);
+  QByteArray data;
+  QDataStream stream(&data, QIODevice::WriteOnly);
+
+  if (kind == "value")
+    stream << settings->value(name);
+  else if (kind == "keys"){
+    QStringList keys = settings->allKeys(name);
+    keys.sort();
+    foreach (const QString &key, keys)
+      stream << key << settings->value(name + "/" + key);
+  } else if (kind == "variable")
+    stream << SsuVariables::variable(settings, name.section('/', 0, 0), name.section('/', 1));
+  else if (kind == "variables"){
+    QHash<QString, QString> variables;
+    SsuVariables::variableSection(settings, name, &variables);
+    QStringList keys = variables.keys();
+    keys.sort();
+    foreach (const QString &key, keys)
+      stream << key << variables.value(key);
+  } else
+    return QByteArray();
+
+  return QCryptographicHash::hash(data, QCryptographicHash::Sha1).toHex();
+}
+
+QVariant SsuDeviceQuery::boardValue(const QString &key, const QVariant &value) const {
+  record("value", BoardMappings, key);
+  return d->boardMappings.value(key, value);
+}
+
+void SsuDeviceQuery::record(const char *kind, Source source, const QString &name) const {
+  if (inputs == 0)
+    return;
+
+  static const char *sourceNames[] = { "board-mappings", "repos", "ssu" };
+  inputs->insert(QString("%1:%2:%3").arg(kind).arg(sourceNames[source]).arg(name));
+}
+
+SsuSettingsView *SsuDeviceQuery::settings(Source source) const {
+  switch (source){
+    case BoardMappings:
+      return d->boardMappingSettings.data();
+    case RepoConfiguration:
+      return d->repoSettings.data();
+    default:
+      return d->configuration.data();
+  }
+}
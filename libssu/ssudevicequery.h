@@ -0,0 +1,139 @@
+/**
+ * @file ssudevicequery.h
+ * @copyright 2013 Jolla Ltd.
+ * @author Bernd Wachter <bwachter@lart.info>
+ * @date 2013
+ */
+
+#ifndef _SSUDEVICEQUERY_H
+#define _SSUDEVICEQUERY_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QSet>
+#include <QSharedPointer>
+#include <QStringList>
+#include <QVariant>
+
+#include "ssurepomanager.h"
+
+class SsuSettingsView;
+
+struct SsuDeviceQueryData;
+
+/**
+ * Read only view of the device database and repository configuration
+ *
+ * Unlike SsuDeviceInfo all lookups take the model as argument, and don't
+ * change any state. The configuration is copied when the object is
+ * created; later changes to the configuration files or to SsuCoreConfig
+ * are not visible through it.
+ *
+ * Creating a query reads the shared configuration objects, and should be
+ * done from one thread. The created object (and its copies, which are
+ * cheap) can be used from any number of threads at the same time, e.g.
+ * for resolving the repositories of several models in parallel, or for
+ * setting up an SsuRepoResolver in each of them.
+ */
+class SsuDeviceQuery {
+  public:
+    /// Configuration files a query holds a copy of
+    enum Source {
+      BoardMappings,      ///< The board mappings, including board-mappings.d
+      RepoConfiguration,  ///< repos.ini
+      Configuration       ///< ssu.ini
+    };
+
+    SsuDeviceQuery();
+    /**
+     * Check if model is in the device database, either directly or as variant
+     */
+    bool contains(const QString &model) const;
+    /**
+     * Return all models in the device database, sorted
+     *
+     * These are the models detection can return, the variants, and the
+     * sections setting family or adaptation-repos, without the UNKNOWN
+     * fallback.
+     */
+    QStringList models() const;
+    /**
+     * Return the variant of model, or an empty string if it is no variant.
+     * If fallback is set model itself is returned in that case.
+     */
+    QString variantOf(const QString &model, bool fallback=false) const;
+    /**
+     * Return the family of model, or "UNKNOWN"
+     */
+    QString familyOf(const QString &model) const;
+    /**
+     * Return the list of adaptations used for model
+     */
+    QStringList adaptationReposOf(const QString &model) const;
+    /**
+     * Return the list of repositories explicitely disabled for model
+     */
+    QStringList disabledReposOf(const QString &model) const;
+    /**
+     * Return the repositories configured for model, as SsuDeviceInfo::repos()
+     */
+    QStringList reposOf(const QString &model, bool rnd=false,
+                        int filter=SsuRepoManager::NoFilter) const;
+    /**
+     * Return key from the section of the variant of model, or of model
+     * itself, in the board mappings, or value if it is not set
+     */
+    QVariant valueOf(const QString &model, const QString &key,
+                     const QVariant &value=QVariant()) const;
+    /**
+     * Add the variables for the repository adaptationName of model to
+     * storageHash, as SsuDeviceInfo::adaptationVariables()
+     * @return "adaptation" for adaptation repositories, adaptationName otherwise
+     */
+    QString adaptationVariablesOf(const QString &model, const QString &adaptationName,
+                                  QHash<QString, QString> *storageHash) const;
+    /**
+     * Add the generic repository variables to storageHash, as
+     * SsuRepoManager::repoVariables()
+     * @return the sections of repos.ini to look up repositories in
+     */
+    QStringList repoVariables(QHash<QString, QString> *storageHash, bool rnd=false) const;
+    /**
+     * Return key from source, or value if it is not set
+     */
+    QVariant value(Source source, const QString &key, const QVariant &value=QVariant()) const;
+    /**
+     * Return a variable from section of source, as SsuVariables::variable()
+     */
+    QVariant variable(Source source, const QString &section, const QString &key) const;
+    /**
+     * Add the variables of section of source to storageHash, as
+     * SsuVariables::variableSection()
+     */
+    void variableSection(Source source, const QString &section,
+                         QHash<QString, QString> *storageHash) const;
+    /**
+     * Record the configuration read through this query in inputs, until set
+     * to 0. Copies of the query made afterwards, like the one kept by an
+     * SsuRepoResolver, record into the same set; queries used from different
+     * threads need different sets.
+     */
+    void setInputs(QSet<QString> *inputs);
+    /**
+     * Return a hash of the current content of input, as recorded by a query
+     * with setInputs(), or an empty QByteArray for an unknown input
+     */
+    QByteArray inputHash(const QString &input) const;
+
+  private:
+    QSharedPointer<const SsuDeviceQueryData> d;
+    QSet<QString> *inputs;
+
+    SsuSettingsView *settings(Source source) const;
+    /// Return key from the board mappings, or value if it is not set
+    QVariant boardValue(const QString &key, const QVariant &value=QVariant()) const;
+    /// Add the lookup of name in source, of kind, to inputs if they are set
+    void record(const char *kind, Source source, const QString &name) const;
+};
+
+#endif
@@ -0,0 +1,85 @@
+/**
+ * @file ssupatternmatcher.cpp
+ * @copyright 2013 Jolla Ltd.
+ * @author Bernd Wachter <bwachter@lart.info>
+ * @date 2013
+ */
+
+#include <QQueue>
+
+#include "ssupatternmatcher_p.h"
+
+SsuPatternMatcher::SsuPatternMatcher(const QStringList &patterns){
+  m_nodes.append(Node());
+
+  // build the trie; node 0 is the root
+  for (int i = 0; i < patterns.size(); i++){
+    const QString &pattern = patterns.at(i);
+    int state = 0;
+
+    for (int j = 0; j < pattern.size(); j++){
+      const ushort c = pattern.at(j).unicode();
+      int next = m_nodes.at(state).next.value(c, -1);
+      if (next == -1){
+        next = m_nodes.size();
+        m_nodes.append(Node());
+        m_nodes[state].next.insert(c, next);
+      }
+      state = next;
+    }
+
+    if (m_nodes.at(state).match == -1)
+      m_nodes[state].match = i;
+  }
+
+  // add fail links breadth first, so the fail target of a node is complete
+  // before the node itself is looked at
+  QQueue<int> queue;
+  foreach (int child, m_nodes.at(0).next)
+    queue.enqueue(child);
+
+  while (!queue.isEmpty()){
+    const int state = queue.dequeue();
+    const QHash<ushort, int> next = m_nodes.at(state).next;
+
+    for (QHash<ushort, int>::const_iterator it = next.constBegin(); it != next.constEnd(); ++it){
+      const int child = it.value();
+      const int fail = step(m_nodes.at(state).fail, it.key());
+
+      m_nodes[child].fail = fail;
+      const int failMatch = m_nodes.at(fail).match;
+      if (failMatch != -1 && (m_nodes.at(child).match == -1 || failMatch < m_nodes.at(child).match))
+        m_nodes[child].match = failMatch;
+
+      queue.enqueue(child);
+    }
+  }
+}
+
+int SsuPatternMatcher::firstMatch(const QString &text) const {
+  // an empty pattern ends at the root
+  int best = m_nodes.at(0).match;
+  int state = 0;
+
+  for (int i = 0; i < text.size() && best != 0; i++){
+    state = step(state, text.at(i).unicode());
+
+    const int match = m_nodes.at(state).match;
+    if (match != -1 && (best == -1 || match < best))
+      best = match;
+  }
+
+  return best;
+}
+
+// follow fail links until a node has a transition for c, or the root is reached
+int SsuPatternMatcher::step(int state, ushort c) const {
+  while (true){
+    QHash<ushort, int>::const_iterator it = m_nodes.at(state).next.constFind(c);
+    if (it != m_nodes.at(state).next.constEnd())
+      return it.value();
+    if (state == 0)
+      return 0;
+    state = m_nodes.at(state).fail;
+  }
+}
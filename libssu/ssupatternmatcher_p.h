@@ -0,0 +1,47 @@
+/**
+ * @file ssupatternmatcher_p.h
+ * @copyright 2013 Jolla Ltd.
+ * @author Bernd Wachter <bwachter@lart.info>
+ * @date 2013
+ */
+
+#ifndef _SSUPATTERNMATCHER_P_H
+#define _SSUPATTERNMATCHER_P_H
+
+#include <QHash>
+#include <QStringList>
+#include <QVector>
+
+/**
+ * Find which of a list of strings occur in a text
+ *
+ * The patterns are compiled into an Aho-Corasick automaton, so a text is
+ * checked against all patterns in a single pass, independent of the number of
+ * patterns. Matching is case sensitive, like QString::contains(); an empty
+ * pattern matches any text.
+ */
+class SsuPatternMatcher {
+  public:
+    explicit SsuPatternMatcher(const QStringList &patterns);
+    /**
+     * Return the lowest index of a pattern contained in text, or -1 if text
+     * does not contain any pattern
+     */
+    int firstMatch(const QString &text) const;
+
+  private:
+    struct Node {
+      Node(): fail(0), match(-1) {}
+
+      QHash<ushort, int> next;
+      int fail;
+      /// lowest pattern index ending here, or at a node on the fail path
+      int match;
+    };
+
+    QVector<Node> m_nodes;
+
+    int step(int state, ushort c) const;
+};
+
+#endif
@@ -8,11 +8,20 @@
 #include <QStringList>
 #include <QRegExp>
 #include <QDirIterator>
+#include <QFileInfo>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "ssudeviceinfo.h"
+#include "ssudevicequery.h"
 #include "ssurepomanager.h"
+#include "ssureporesolver.h"
 #include "ssucoreconfig.h"
 #include "ssusettings.h"
+#include "ssusettingsview.h"
 #include "ssulog.h"
 #include "ssuvariables.h"
 #include "ssu.h"
@@ -25,6 +34,7 @@ SsuRepoManager::SsuRepoManager(): QObject() {
 
 void SsuRepoManager::add(QString repo, QString repoUrl){
   SsuCoreConfig *ssuSettings = SsuCoreConfig::instance();
+  ssuSettings->beginBatch();
 
   if (repoUrl == ""){
     // just enable a repository which has URL in repos.ini
@@ -38,17 +48,17 @@ void SsuRepoManager::add(QString repo, QString repoUrl){
   } else
     ssuSettings->setValue("repository-urls/" + repo, repoUrl);
 
-  ssuSettings->sync();
+  ssuSettings->endBatch();
 }
 
 QString SsuRepoManager::caCertificatePath(QString domain){
   SsuCoreConfig *settings = SsuCoreConfig::instance();
-  SsuSettings repoSettings(SSU_REPO_CONFIGURATION, QSettings::IniFormat);
+  QSharedPointer<SsuSettingsView> repoSettings = SsuSettingsView::shared(SSU_REPO_CONFIGURATION);
 
   if (domain.isEmpty())
     domain = settings->domain();
 
-  QString ca = SsuVariables::variable(&repoSettings, domain + "-domain",
+  QString ca = SsuVariables::variable(repoSettings.data(), domain + "-domain",
                                       "_ca-certificate").toString();
   if (!ca.isEmpty())
     return ca;
@@ -62,6 +72,7 @@ QString SsuRepoManager::caCertificatePath(QString domain){
 
 void SsuRepoManager::disable(QString repo){
   SsuCoreConfig *ssuSettings = SsuCoreConfig::instance();
+  ssuSettings->beginBatch();
   QStringList disabledRepos;
 
   if (ssuSettings->contains("disabled-repos"))
@@ -71,11 +82,12 @@ void SsuRepoManager::disable(QString repo){
   disabledRepos.removeDuplicates();
 
   ssuSettings->setValue("disabled-repos", disabledRepos);
-  ssuSettings->sync();
+  ssuSettings->endBatch();
 }
 
 void SsuRepoManager::enable(QString repo){
   SsuCoreConfig *ssuSettings = SsuCoreConfig::instance();
+  ssuSettings->beginBatch();
   QStringList disabledRepos;
 
   if (ssuSettings->contains("disabled-repos"))
@@ -85,11 +97,12 @@ void SsuRepoManager::enable(QString repo){
   disabledRepos.removeDuplicates();
 
   ssuSettings->setValue("disabled-repos", disabledRepos);
-  ssuSettings->sync();
+  ssuSettings->endBatch();
 }
 
 void SsuRepoManager::remove(QString repo){
   SsuCoreConfig *ssuSettings = SsuCoreConfig::instance();
+  ssuSettings->beginBatch();
   if (ssuSettings->contains("repository-urls/" + repo))
     ssuSettings->remove("repository-urls/" + repo);
 
@@ -102,16 +115,20 @@ void SsuRepoManager::remove(QString repo){
     }
   }
 
-  ssuSettings->sync();
+  ssuSettings->endBatch();
 }
 
 void SsuRepoManager::update(){
   // - delete all non-ssu managed repositories (missing ssu_ prefix)
   // - create list of ssu-repositories for current adaptation
-  // - go through ssu_* repositories, delete all which are not in the list; write others
+  // - render all repository files for that list in memory
+  // - go through ssu_* repositories, delete all which are not in the list
+  // - write only files where the rendered content differs from the file on disk
 
   SsuDeviceInfo deviceInfo;
   QStringList ssuFilters;
+  QHash<QString, QByteArray> repoFiles;
+  int added = 0, changed = 0, removed = 0;
 
   SsuCoreConfig *ssuSettings = SsuCoreConfig::instance();
   int deviceMode = ssuSettings->value("deviceMode").toInt();
@@ -131,38 +148,9 @@ void SsuRepoManager::update(){
 
   // get list of device-specific repositories...
   QStringList repos = deviceInfo.repos(rndMode);
+  SsuRepoResolver resolver(rndMode);
 
-  // strict mode enabled -> delete all repositories not prefixed by ssu
-  // assume configuration error if there are no device repos, and don't delete
-  // anything, even in strict mode
-  if ((deviceMode & Ssu::LenientMode) != Ssu::LenientMode && !repos.isEmpty()){
-    QDirIterator it(ZYPP_REPO_PATH, QDir::AllEntries|QDir::NoDot|QDir::NoDotDot);
-    while (it.hasNext()){
-      it.next();
-      if (it.fileName().left(4) != "ssu_"){
-        ssuLog->print(LOG_INFO, "Strict mode enabled, removing unmanaged repository " + it.fileName());
-        QFile(it.filePath()).remove();
-      }
-    }
-  }
-
-  // ... delete all ssu-managed repositories not valid for this device ...
-  ssuFilters.append("ssu_*");
-  QDirIterator it(ZYPP_REPO_PATH, ssuFilters);
-  while (it.hasNext()){
-    QString f = it.next();
-
-    QStringList parts = it.fileName().split("_");
-    // repo file structure is ssu_<reponame>_<rnd|release>.repo -> splits to 3 parts
-    if (parts.count() == 3){
-      if (!repos.contains(parts.at(1)) ||
-          parts.at(2) != (rndMode ? "rnd.repo" : "release.repo" ))
-        QFile(it.filePath()).remove();
-    } else
-      QFile(it.filePath()).remove();
-  }
-
-  // ... and create all repositories required for this device
+  // ... render repository files required for this device ...
   foreach (const QString &repo, repos){
     // repo should be used where a unique identifier for silly human brains, or
     // zypper is required. repoName contains the shortened form for ssu use
@@ -173,144 +161,161 @@ void SsuRepoManager::update(){
       repoName = repo.left(repo.size() - 10);
     }
 
-    QString repoFilePath = QString("%1/ssu_%2_%3.repo")
-      .arg(ZYPP_REPO_PATH)
+    QString repoFileName = QString("ssu_%1_%2.repo")
       .arg(repo)
       .arg(rndMode ? "rnd" : "release");
 
-    if (url(repoName, rndMode) == ""){
+    if (resolver.url(repoName) == ""){
       // TODO, repositories should only be disabled if they're not required
       //       for this machine. For required repositories error is better
       QTextStream qerr(stderr);
       qerr << "Repository " << repo << " does not contain valid URL, skipping and disabling." << endl;
       disable(repo);
-      QFile(repoFilePath).remove();
       continue;
     }
 
-    QFile repoFile(repoFilePath);
-
-    if (repoFile.open(QIODevice::WriteOnly | QIODevice::Text)){
-      QTextStream out(&repoFile);
-      // TODO, add -rnd or -release if we want to support having rnd and
-      //       release enabled at the same time
-      out << "[" << repo << "]" << endl
-          << "name=" << repo << endl
-          << "failovermethod=priority" << endl
-          << "type=rpm-md" << endl
-          << "gpgcheck=0" << endl
-          << "enabled=1" << endl;
-
-      if (rndMode)
-        out << "baseurl=plugin:ssu?rnd&repo=" << repoName << debugSplit << endl;
-      else
-        out << "baseurl=plugin:ssu?repo=" << repoName << debugSplit << endl;
+    QByteArray content;
+    QTextStream out(&content, QIODevice::WriteOnly);
+    // TODO, add -rnd or -release if we want to support having rnd and
+    //       release enabled at the same time
+    out << "[" << repo << "]" << endl
+        << "name=" << repo << endl
+        << "failovermethod=priority" << endl
+        << "type=rpm-md" << endl
+        << "gpgcheck=0" << endl
+        << "enabled=1" << endl;
+
+    if (rndMode)
+      out << "baseurl=plugin:ssu?rnd&repo=" << repoName << debugSplit << endl;
+    else
+      out << "baseurl=plugin:ssu?repo=" << repoName << debugSplit << endl;
+
+    out.flush();
+    repoFiles.insert(repoFileName, content);
+  }
 
-      out.flush();
+  // strict mode enabled -> delete all repositories not prefixed by ssu
+  // assume configuration error if there are no device repos, and don't delete
+  // anything, even in strict mode
+  if ((deviceMode & Ssu::LenientMode) != Ssu::LenientMode && !repos.isEmpty()){
+    QDirIterator it(ZYPP_REPO_PATH, QDir::AllEntries|QDir::NoDot|QDir::NoDotDot);
+    while (it.hasNext()){
+      it.next();
+      if (it.fileName().left(4) != "ssu_"){
+        ssuLog->print(LOG_INFO, "Strict mode enabled, removing unmanaged repository " + it.fileName());
+        if (QFile(it.filePath()).remove())
+          removed++;
+      }
     }
   }
-}
 
-QStringList SsuRepoManager::repoVariables(QHash<QString, QString> *storageHash, bool rnd){
-  SsuVariables var;
-  SsuCoreConfig *settings = SsuCoreConfig::instance();
-  QStringList configSections;
-  SsuSettings repoSettings(SSU_REPO_CONFIGURATION, QSettings::IniFormat);
-
-  // fill in all arbitrary variables from ssu.ini
-  var.variableSection(settings, "repository-url-variables", storageHash);
-
-  // add/overwrite some of the variables with sane ones
-  if (rnd){
-    storageHash->insert("flavour",
-                          repoSettings.value(
-                            settings->flavour()+"-flavour/flavour-pattern").toString());
-    storageHash->insert("flavourPattern",
-                          repoSettings.value(
-                            settings->flavour()+"-flavour/flavour-pattern").toString());
-    storageHash->insert("flavourName", settings->flavour());
-    configSections << settings->flavour()+"-flavour" << "rnd" << "all";
-
-    // Make it possible to give any values with the flavour as well.
-    // These values can be overridden later with domain if needed.
-    var.variableSection(&repoSettings, settings->flavour()+"-flavour", storageHash);
-  } else {
-    configSections << "release" << "all";
+  // ... delete temporary files left over by an interrupted update ...
+  QDirIterator tmpFiles(ZYPP_REPO_PATH, QStringList() << ".ssu_*.tmp",
+                        QDir::Files|QDir::Hidden);
+  while (tmpFiles.hasNext()){
+    tmpFiles.next();
+    QFile(tmpFiles.filePath()).remove();
   }
 
-  storageHash->insert("release", settings->release(rnd));
-
-  if (!storageHash->contains("debugSplit"))
-    storageHash->insert("debugSplit", "packages");
-
-  if (!storageHash->contains("arch"))
-    storageHash->insert("arch", settings->value("arch").toString());
-
-  return configSections;
-}
+  // ... delete all ssu-managed repositories not valid for this device ...
+  ssuFilters.append("ssu_*");
+  QDirIterator it(ZYPP_REPO_PATH, ssuFilters);
+  while (it.hasNext()){
+    it.next();
 
-// RND repos have flavour (devel, testing, release), and release (latest, next)
-// Release repos only have release (latest, next, version number)
-QString SsuRepoManager::url(QString repoName, bool rndRepo,
-                            QHash<QString, QString> repoParameters,
-                            QHash<QString, QString> parametersOverride){
-  QString r;
-  QStringList configSections;
-  SsuVariables var;
-  SsuCoreConfig *settings = SsuCoreConfig::instance();
-  SsuSettings repoSettings(SSU_REPO_CONFIGURATION, QSettings::IniFormat);
-  SsuDeviceInfo deviceInfo;
+    if (!repoFiles.contains(it.fileName())){
+      if (QFile(it.filePath()).remove())
+        removed++;
+    }
+  }
 
-  // set debugSplit for incorrectly configured debuginfo repositories (debugSplit
-  // should already be passed by the url resolver); might be overriden later on,
-  // if required
-  if (repoName.endsWith("-debuginfo") && !repoParameters.contains("debugSplit"))
-    repoParameters.insert("debugSplit", "debug");
+  // ... and write all repository files which changed
+  QHash<QString, QByteArray>::const_iterator i = repoFiles.constBegin();
+  while (i != repoFiles.constEnd()){
+    QString repoFilePath = QString("%1/%2").arg(ZYPP_REPO_PATH).arg(i.key());
+    QFile repoFile(repoFilePath);
+    bool exists = repoFile.exists();
+
+    if (exists && repoFile.open(QIODevice::ReadOnly)){
+      QByteArray current = repoFile.readAll();
+      repoFile.close();
+      if (current == i.value()){
+        i++;
+        continue;
+      }
+    }
 
-  configSections = repoVariables(&repoParameters, rndRepo);
+    if (writeFileAtomically(repoFilePath, i.value())){
+      if (exists)
+        changed++;
+      else
+        added++;
+    } else
+      ssuLog->print(LOG_WARNING, "Unable to write repository file " + repoFilePath);
 
+    i++;
+  }
 
-  // Override device model (and therefore all the family, ... stuff)
-  if (parametersOverride.contains("model"))
-    deviceInfo.setDeviceModel(parametersOverride.value("model"));
+  // make sure renames and removals hit the disk
+  if (added + changed + removed > 0)
+    syncDirectory(ZYPP_REPO_PATH);
 
-  repoParameters.insert("deviceFamily", deviceInfo.deviceFamily());
-  repoParameters.insert("deviceModel", deviceInfo.deviceModel());
+  ssuLog->print(LOG_INFO, QString("Repository files: %1 added, %2 changed, %3 removed")
+                .arg(added)
+                .arg(changed)
+                .arg(removed));
+}
 
-  repoName = deviceInfo.adaptationVariables(repoName, &repoParameters);
+// write to a temporary file in the same directory, and rename it over the
+// target once the content is on disk. The temporary file is hidden, and a
+// leftover is removed by the next update. An existing target keeps its mode
+bool SsuRepoManager::writeFileAtomically(const QString &filePath, const QByteArray &content){
+  QFileInfo info(filePath);
+  QString tmpPath = QString("%1/.%2.tmp").arg(info.absolutePath()).arg(info.fileName());
+
+  QFile tmpFile(tmpPath);
+  if (!tmpFile.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    return false;
+
+  struct stat buf;
+  if (::stat(QFile::encodeName(filePath).constData(), &buf) == 0)
+    ::fchmod(tmpFile.handle(), buf.st_mode & 07777);
+
+  if (tmpFile.write(content) != content.size() || !tmpFile.flush() ||
+      ::fsync(tmpFile.handle()) != 0){
+    tmpFile.close();
+    tmpFile.remove();
+    return false;
+  }
+  tmpFile.close();
 
+  if (::rename(QFile::encodeName(tmpPath).constData(),
+               QFile::encodeName(filePath).constData()) != 0){
+    tmpFile.remove();
+    return false;
+  }
 
-  QString domain;
-  if (parametersOverride.contains("domain")){
-    domain = parametersOverride.value("domain");
-    domain.replace("-", ":");
-  } else
-    domain = settings->domain();
+  return true;
+}
 
-  // variableSection does autodetection for the domain default section
-  var.variableSection(&repoSettings,
-                      domain + "-domain", &repoParameters);
+void SsuRepoManager::syncDirectory(const QString &path){
+  int fd = ::open(QFile::encodeName(path).constData(), O_RDONLY | O_DIRECTORY);
+  if (fd < 0)
+    return;
 
-  // override arbitrary variables, mostly useful for generating mic URLs
-  QHash<QString, QString>::const_iterator i = parametersOverride.constBegin();
-  while (i != parametersOverride.constEnd()){
-    repoParameters.insert(i.key(), i.value());
-    i++;
-  }
+  ::fsync(fd);
+  ::close(fd);
+}
 
-  if (settings->contains("repository-urls/" + repoName))
-    r = settings->value("repository-urls/" + repoName).toString();
-  else {
-    foreach (const QString &section, configSections){
-      repoSettings.beginGroup(section);
-      if (repoSettings.contains(repoName)){
-        r = repoSettings.value(repoName).toString();
-        repoSettings.endGroup();
-        break;
-      }
-      repoSettings.endGroup();
-    }
-  }
+QStringList SsuRepoManager::repoVariables(QHash<QString, QString> *storageHash, bool rnd){
+  return SsuDeviceQuery().repoVariables(storageHash, rnd);
+}
 
-  return var.resolveString(r, &repoParameters);
+// RND repos have flavour (devel, testing, release), and release (latest, next)
+// Release repos only have release (latest, next, version number)
+QString SsuRepoManager::url(QString repoName, bool rndRepo,
+                            QHash<QString, QString> repoParameters,
+                            QHash<QString, QString> parametersOverride){
+  SsuRepoResolver resolver(rndRepo, parametersOverride);
+  return resolver.url(repoName, repoParameters);
 }
@@ -60,16 +60,27 @@ class SsuRepoManager: public QObject {
     QStringList repoVariables(QHash<QString, QString> *storageHash, bool rnd=false);
     /**
      * Update the repository files on disk
+     *
+     * Repository files are rendered in memory first, and only files where
+     * the content differs from the file on disk get (atomically) rewritten.
+     * The number of added, changed and removed files gets logged.
      */
     void update();
     /**
      * Resolve a repository url
+     *
+     * When resolving URLs for several repositories use SsuRepoResolver instead,
+     * which sets up the repository independent variables only once.
+     *
      * @return the repository URL on success, an empty string on error
      */
     QString url(QString repoName, bool rndRepo=false,
                 QHash<QString, QString> repoParameters=QHash<QString, QString>(),
                 QHash<QString, QString> parametersOverride=QHash<QString, QString>());
 
+  private:
+    static bool writeFileAtomically(const QString &filePath, const QByteArray &content);
+    static void syncDirectory(const QString &path);
 };
 
 #endif
@@ -0,0 +1,111 @@
+/**
+ * @file ssureporesolver.cpp
+ * @copyright 2013 Jolla Ltd.
+ * @author Bernd Wachter <bwachter@lart.info>
+ * @date 2013
+ */
+
+#include "ssureporesolver.h"
+#include "ssudeviceinfo.h"
+#include "ssuvariables.h"
+
+#include "../constants.h"
+
+SsuRepoResolver::SsuRepoResolver(bool rnd, QHash<QString, QString> parametersOverride):
+  rnd(rnd){
+  // detection is only needed without a model override
+  if (parametersOverride.value("model").isEmpty())
+    model = SsuDeviceInfo().deviceModel();
+
+  init(parametersOverride);
+}
+
+SsuRepoResolver::SsuRepoResolver(const SsuDeviceQuery &query, const QString &model, bool rnd,
+                                 QHash<QString, QString> parametersOverride):
+  rnd(rnd), query(query), model(model){
+  init(parametersOverride);
+}
+
+void SsuRepoResolver::init(const QHash<QString, QString> &parametersOverride){
+  configSections = query.repoVariables(&configVariables, rnd);
+
+  // repoVariables() only fills in debugSplit and arch if they're not set yet,
+  // so those must not replace repository parameters -- unless they're
+  // explicitly configured in ssu.ini or in the flavour section
+  QStringList conditionalKeys;
+  conditionalKeys << "debugSplit" << "arch";
+  foreach (const QString &key, conditionalKeys){
+    if (query.variable(SsuDeviceQuery::Configuration, "repository-url-variables", key).isValid())
+      continue;
+    if (rnd && query.variable(SsuDeviceQuery::RepoConfiguration,
+                              configVariables.value("flavourName") + "-flavour", key).isValid())
+      continue;
+    if (configVariables.contains(key))
+      defaultVariables.insert(key, configVariables.take(key));
+  }
+
+  // Override device model (and therefore all the family, ... stuff)
+  if (!parametersOverride.value("model").isEmpty())
+    model = parametersOverride.value("model");
+
+  configVariables.insert("deviceFamily", query.familyOf(model));
+  configVariables.insert("deviceModel", model);
+
+  QString domain;
+  if (parametersOverride.contains("domain")){
+    domain = parametersOverride.value("domain");
+    domain.replace("-", ":");
+  } else
+    domain = query.value(SsuDeviceQuery::Configuration, "domain").toString();
+
+  // variableSection does autodetection for the domain default section
+  query.variableSection(SsuDeviceQuery::RepoConfiguration, domain + "-domain", &domainVariables);
+
+  // override arbitrary variables, mostly useful for generating mic URLs
+  overlay(&domainVariables, parametersOverride);
+}
+
+bool SsuRepoResolver::isRnd() const {
+  return rnd;
+}
+
+// RND repos have flavour (devel, testing, release), and release (latest, next)
+// Release repos only have release (latest, next, version number)
+QString SsuRepoResolver::url(QString repoName, QHash<QString, QString> repoParameters){
+  // set debugSplit for incorrectly configured debuginfo repositories (debugSplit
+  // should already be passed by the url resolver); might be overriden later on,
+  // if required
+  if (repoName.endsWith("-debuginfo") && !repoParameters.contains("debugSplit"))
+    repoParameters.insert("debugSplit", "debug");
+
+  overlay(&repoParameters, configVariables);
+
+  QHash<QString, QString>::const_iterator i = defaultVariables.constBegin();
+  while (i != defaultVariables.constEnd()){
+    if (!repoParameters.contains(i.key()))
+      repoParameters.insert(i.key(), i.value());
+    i++;
+  }
+
+  repoName = query.adaptationVariablesOf(model, repoName, &repoParameters);
+
+  overlay(&repoParameters, domainVariables);
+
+  QVariant url = query.value(SsuDeviceQuery::Configuration, "repository-urls/" + repoName);
+  foreach (const QString &section, configSections){
+    if (url.isValid())
+      break;
+    url = query.value(SsuDeviceQuery::RepoConfiguration, section + "/" + repoName);
+  }
+
+  return SsuVariables::resolveString(url.toString(), &repoParameters);
+}
+
+void SsuRepoResolver::overlay(QHash<QString, QString> *target,
+                              const QHash<QString, QString> &source){
+  QHash<QString, QString>::const_iterator i = source.constBegin();
+  while (i != source.constEnd()){
+    target->insert(i.key(), i.value());
+    i++;
+  }
+}
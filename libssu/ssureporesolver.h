@@ -0,0 +1,77 @@
+/**
+ * @file ssureporesolver.h
+ * @copyright 2013 Jolla Ltd.
+ * @author Bernd Wachter <bwachter@lart.info>
+ * @date 2013
+ */
+
+#ifndef _SSUREPORESOLVER_H
+#define _SSUREPORESOLVER_H
+
+#include <QHash>
+#include <QStringList>
+
+#include "ssudevicequery.h"
+
+/**
+ * Context for resolving many repository URLs with the same settings
+ *
+ * Everything which does not depend on the repository -- variables from ssu.ini
+ * and the flavour, device family and model, domain variables and overrides --
+ * is collected once on construction. Resolving a URL then only adds the
+ * adaptation and debugSplit variables for the repository before evaluating
+ * the URL pattern.
+ *
+ * SsuRepoManager::url() is a shortcut creating a context for a single URL;
+ * use a context directly when resolving URLs for a list of repositories.
+ *
+ * A context only reads the configuration through an SsuDeviceQuery. Contexts
+ * set up from the same query may be created and used in several threads at
+ * once, as long as each context is used from one thread only.
+ */
+class SsuRepoResolver {
+  public:
+    /**
+     * Set up a context for RnD (rnd=true) or release repositories.
+     * parametersOverride may contain 'model' and 'domain' to override the
+     * device model and domain, and arbitrary variables which take precedence
+     * over all other variables.
+     */
+    SsuRepoResolver(bool rnd=false,
+                    QHash<QString, QString> parametersOverride=QHash<QString, QString>());
+    /**
+     * Set up a context as above, reading the configuration from query, for
+     * model unless parametersOverride sets 'model'
+     */
+    SsuRepoResolver(const SsuDeviceQuery &query, const QString &model, bool rnd=false,
+                    QHash<QString, QString> parametersOverride=QHash<QString, QString>());
+    /**
+     * Return true if this context resolves RnD repositories
+     */
+    bool isRnd() const;
+    /**
+     * Resolve a repository url
+     * @return the repository URL on success, an empty string on error
+     */
+    QString url(QString repoName,
+                QHash<QString, QString> repoParameters=QHash<QString, QString>());
+
+  private:
+    SsuRepoResolver(const SsuRepoResolver &); // hide copy constructor
+
+    bool rnd;
+    SsuDeviceQuery query;
+    QString model;
+    QStringList configSections;
+    /// Variables replacing repository parameters
+    QHash<QString, QString> configVariables;
+    /// Variables only used if not set as repository parameter
+    QHash<QString, QString> defaultVariables;
+    /// Variables from the domain section, and overrides, applied last
+    QHash<QString, QString> domainVariables;
+
+    void init(const QHash<QString, QString> &parametersOverride);
+    static void overlay(QHash<QString, QString> *target, const QHash<QString, QString> &source);
+};
+
+#endif
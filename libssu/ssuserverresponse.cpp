@@ -0,0 +1,110 @@
+/**
+ * @file ssuserverresponse.cpp
+ * @copyright 2013 Jolla Ltd.
+ * @author Bernd Wachter <bwachter@lart.info>
+ * @date 2013
+ */
+
+#include <QSet>
+#include <QXmlStreamReader>
+
+#include "ssuserverresponse_p.h"
+
+SsuServerResponse::SsuServerResponse(){
+}
+
+bool SsuServerResponse::parse(const QByteArray &data){
+  QXmlStreamReader xml(data);
+  QSet<QString> seen;
+  int depth = 0;
+  // depth of the credentials element currently being read, or -1
+  int credentialsDepth = -1;
+  bool hasUsername = false, hasPassword = false;
+
+  *this = SsuServerResponse();
+
+  while (!xml.atEnd()){
+    xml.readNext();
+
+    if (xml.isEndElement()){
+      if (depth == credentialsDepth){
+        if (!hasUsername || !hasPassword)
+          return failed(tr("Username and/or password not set"));
+        credentialsDepth = -1;
+      }
+      depth--;
+      continue;
+    }
+
+    if (!xml.isStartElement())
+      continue;
+
+    depth++;
+    const QString name = xml.name().toString();
+
+    if (name == "credentials"){
+      if (credentialsDepth != -1)
+        return failed(tr("Nested credentials element"));
+
+      QXmlStreamAttributes attributes = xml.attributes();
+      if (!attributes.hasAttribute("scope"))
+        return failed(tr("Credentials element does not have scope"));
+
+      Credentials entry;
+      entry.scope = attributes.value("scope").toString();
+      credentials.append(entry);
+
+      credentialsDepth = depth;
+      hasUsername = hasPassword = false;
+      continue;
+    }
+
+    QString *field = 0;
+
+    if (credentialsDepth != -1 && depth == credentialsDepth + 1){
+      if (name == "username" && !hasUsername){
+        field = &credentials.last().username;
+        hasUsername = true;
+      } else if (name == "password" && !hasPassword){
+        field = &credentials.last().password;
+        hasPassword = true;
+      }
+    } else if (!seen.contains(name)){
+      if (name == "action")
+        field = &action;
+      else if (name == "deviceId")
+        field = &deviceId;
+      else if (name == "protocolVersion")
+        field = &protocolVersion;
+      else if (name == "certificate")
+        field = &certificate;
+      else if (name == "privateKey")
+        field = &privateKey;
+      else if (name == "user")
+        field = &user;
+
+      if (field)
+        seen.insert(name);
+    }
+
+    if (field){
+      // consumes the end element as well
+      *field = xml.readElementText(QXmlStreamReader::IncludeChildElements);
+      depth--;
+    }
+  }
+
+  if (xml.hasError())
+    return failed(tr("Unable to parse server response (%1)").arg(xml.errorString()));
+
+  return true;
+}
+
+QString SsuServerResponse::errorString() const {
+  return m_errorString;
+}
+
+bool SsuServerResponse::failed(const QString &message){
+  m_errorString = message;
+  return false;
+}
@@ -0,0 +1,62 @@
+/**
+ * @file ssuserverresponse_p.h
+ * @copyright 2013 Jolla Ltd.
+ * @author Bernd Wachter <bwachter@lart.info>
+ * @date 2013
+ */
+
+#ifndef _SSUSERVERRESPONSE_P_H
+#define _SSUSERVERRESPONSE_P_H
+
+#include <QByteArray>
+#include <QCoreApplication>
+#include <QList>
+#include <QString>
+
+/**
+ * Reply of the SSU server to a registration or credentials request
+ *
+ * The reply is parsed in a single pass over the XML. Elements are looked up
+ * anywhere in the document, the first occurrence of each one is used. Each
+ * credentials element needs a scope attribute, and username and password
+ * child elements; a reply violating that is rejected as a whole.
+ */
+class SsuServerResponse {
+    Q_DECLARE_TR_FUNCTIONS(SsuServerResponse)
+
+  public:
+    struct Credentials {
+      QString scope;
+      QString username;
+      QString password;
+    };
+
+    SsuServerResponse();
+    /**
+     * Parse data into this response
+     * @return true on success, false if data is no valid response; see errorString()
+     */
+    bool parse(const QByteArray &data);
+    /**
+     * Return a description of the last parse error
+     */
+    QString errorString() const;
+
+    QString action;
+    QString deviceId;
+    QString protocolVersion;
+    /// PEM encoded device certificate (register)
+    QString certificate;
+    /// PEM encoded private key for the certificate (register)
+    QString privateKey;
+    /// Previous owner of the device (register)
+    QString user;
+    /// Repository credentials, in document order (credentials)
+    QList<Credentials> credentials;
+
+  private:
+    QString m_errorString;
+    bool failed(const QString &message);
+};
+
+#endif
@@ -6,12 +6,21 @@
  */
 
 #include <QStringList>
+#include <QCryptographicHash>
 #include <QDirIterator>
 #include <QFileInfo>
 #include <QDateTime>
+#include <QHash>
+#include <QMap>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QPair>
+#include <QTextStream>
 
 #include "sandbox_p.h"
 #include "ssusettings.h"
+#include "ssusettingssnapshot_p.h"
+#include "ssusettingsview.h"
 #include "ssulog.h"
 
 SsuSettings::SsuSettings(): QSettings(){
@@ -35,68 +44,239 @@ SsuSettings::SsuSettings(const QString &fileName, const QString &settingsDirecto
   merge();
 }
 
+SsuSettings::~SsuSettings(){
+  invalidateView();
+}
+
+void SsuSettings::setValue(const QString &key, const QVariant &value){
+  QSettings::setValue(key, value);
+  invalidateView();
+}
+
+void SsuSettings::remove(const QString &key){
+  QSettings::remove(key);
+  invalidateView();
+}
+
+void SsuSettings::clear(){
+  QSettings::clear();
+  invalidateView();
+}
+
+void SsuSettings::sync(){
+  QSettings::sync();
+  invalidateView();
+}
+
+namespace {
+  struct CachedView {
+    QSharedPointer<SsuSettingsView> view;
+    SsuSettingsSnapshot::Stamp stamp;
+  };
+
+  // views by settings object; kept outside of SsuSettings to keep its size
+  QMutex viewMutex;
+  QHash<const SsuSettings *, CachedView> views;
+}
+
+QSharedPointer<SsuSettingsView> SsuSettings::view(){
+  // stamped before copying, so a change while copying gets the next call
+  // to copy the settings again
+  SsuSettingsSnapshot::Stamp stamp = SsuSettingsSnapshot::Stamp::read(fileName());
+
+  {
+    QMutexLocker locker(&viewMutex);
+    QHash<const SsuSettings *, CachedView>::const_iterator it = views.constFind(this);
+    if (it != views.constEnd() && it->stamp == stamp)
+      return it->view;
+  }
+
+  CachedView entry;
+  entry.view = QSharedPointer<SsuSettingsView>(new SsuSettingsView(*this));
+  entry.stamp = stamp;
+
+  QMutexLocker locker(&viewMutex);
+  views.insert(this, entry);
+  return entry.view;
+}
+
+void SsuSettings::invalidateView(){
+  QMutexLocker locker(&viewMutex);
+  views.remove(this);
+}
+
+namespace {
+  // state of a settings.d file at the time of the last merge
+  struct ManifestEntry {
+    SsuSettingsSnapshot::Stamp stamp;
+    QByteArray hash;
+  };
+
+  // manifest entries by file name, for all files in settings.d
+  typedef QMap<QString, ManifestEntry> Manifest;
+
+  QByteArray hashFile(const QString &path){
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+      return QByteArray();
+
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    while (!file.atEnd())
+      hash.addData(file.read(64 * 1024));
+
+    return hash.result().toHex();
+  }
+
+  // one line per file: <sha1> <size> <mtime>.<nsec> <inode> <name>
+  Manifest readManifest(const QString &path){
+    Manifest manifest;
+    QFile file(path);
+
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+      return manifest;
+
+    while (!file.atEnd()){
+      QString line = QString::fromUtf8(file.readLine()).remove('\n');
+      if (line.isEmpty() || line.startsWith('#'))
+        continue;
+
+      QString name = line.section(' ', 4);
+      if (name.isEmpty())
+        continue;
+
+      ManifestEntry entry;
+      entry.hash = line.section(' ', 0, 0).toLatin1();
+      entry.stamp.exists = true;
+      entry.stamp.size = line.section(' ', 1, 1).toULongLong();
+      QString mtime = line.section(' ', 2, 2);
+      entry.stamp.mtime = mtime.section('.', 0, 0).toULongLong();
+      entry.stamp.mtimeNsec = mtime.section('.', 1, 1).toUInt();
+      entry.stamp.inode = line.section(' ', 3, 3).toULongLong();
+      manifest.insert(name, entry);
+    }
+
+    return manifest;
+  }
+
+  void writeManifest(const QString &path, const Manifest &manifest){
+    QFile file(path);
+
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text | QIODevice::Truncate)){
+      SsuLog::instance()->print(LOG_DEBUG, QString("Unable to write merge manifest %1")
+                                .arg(path));
+      return;
+    }
+
+    QTextStream out(&file);
+    out << "# generated by ssu, do not edit\n";
+    for (Manifest::const_iterator it = manifest.constBegin(); it != manifest.constEnd(); ++it){
+      out << it->hash << " " << it->stamp.size << " "
+          << it->stamp.mtime << "." << it->stamp.mtimeNsec << " "
+          << it->stamp.inode << " " << it.key() << "\n";
+    }
+  }
+
+  bool sameContent(const Manifest &a, const Manifest &b){
+    if (a.size() != b.size())
+      return false;
+
+    for (Manifest::const_iterator it = a.constBegin(), other = b.constBegin();
+         it != a.constEnd(); ++it, ++other){
+      if (it.key() != other.key() || it->hash != other->hash || it->hash.isEmpty())
+        return false;
+    }
+
+    return true;
+  }
+}
+
 void SsuSettings::merge(bool keepOld){
   if (settingsd == "")
     return;
 
-  bool skipMerge = true;
-
   SsuLog *ssuLog = SsuLog::instance();
 
+  // settings.d files are only read again if their stamp changed since the
+  // last merge, and the configuration file is only rewritten if their content
+  // changed. Touching files, as done on package updates, costs just a stat()
+  QString manifestPath = fileName() + ".manifest";
+  Manifest oldManifest = readManifest(manifestPath);
+  Manifest manifest;
+  bool stampsChanged = false;
+
   QDirIterator it(settingsd, QDir::AllEntries|QDir::NoDot|QDir::NoDotDot, QDirIterator::FollowSymlinks);
   QStringList settingsFiles;
 
-  QFileInfo oldSettingsInfo(fileName());
-
   while (it.hasNext()){
-    QString f = it.next();
+    it.next();
+
+    ManifestEntry entry;
+    entry.stamp = SsuSettingsSnapshot::Stamp::read(it.filePath());
+
+    Manifest::const_iterator old = oldManifest.constFind(it.fileName());
+    if (old != oldManifest.constEnd() && old->stamp == entry.stamp)
+      entry.hash = old->hash;
+    else {
+      entry.hash = hashFile(it.filePath());
+      stampsChanged = true;
+    }
 
+    manifest.insert(it.fileName(), entry);
     settingsFiles.append(it.filePath());
+  }
+
+  // without any files the configuration file is used as it is
+  if (settingsFiles.isEmpty())
+    return;
 
-    QFileInfo info(it.filePath());
-    if (info.lastModified() >= oldSettingsInfo.lastModified())
-      skipMerge = false;
+  if (sameContent(oldManifest, manifest) && QFileInfo(fileName()).exists()){
+    ssuLog->print(LOG_DEBUG, QString("config.d files unchanged since last merge, skipping merge"));
+    if (stampsChanged)
+      writeManifest(manifestPath, manifest);
+    return;
   }
 
-  if (skipMerge){
-    ssuLog->print(LOG_DEBUG, QString("Configuration file is newer than all config.d files, skipping merge"));
+  if (!QFileInfo(QFileInfo(fileName()).absolutePath()).isWritable()){
+    ssuLog->print(LOG_DEBUG, QString("Unable to write %1, skipping merge")
+                  .arg(fileName()));
     return;
   }
 
   settingsFiles.sort();
 
-  // delete all keys in the cached settings
-  if (settingsFiles.count() > 0 && !keepOld)
+  QSettings::SettingsMap values;
+  if (keepOld){
+    foreach (const QString &key, allKeys())
+      values.insert(key, value(key));
+  }
+  SsuSettingsView::mergeValues(&values, settingsFiles, fileName());
+
+  // skip writing if merging produced what's already there
+  QSettings::SettingsMap currentValues;
+  foreach (const QString &key, allKeys())
+    currentValues.insert(key, value(key));
+
+  if (values == currentValues)
+    ssuLog->print(LOG_DEBUG, QString("Merge result for %1 is unchanged, skipping write")
+                  .arg(fileName()));
+  else {
     clear();
+    for (QSettings::SettingsMap::const_iterator item = values.constBegin();
+         item != values.constEnd(); ++item)
+      setValue(item.key(), item.value());
+    sync();
+  }
 
-  merge(this, settingsFiles);
-  sync();
+  writeManifest(manifestPath, manifest);
 }
 
 void SsuSettings::merge(QSettings *masterSettings, const QStringList &settingsFiles){
-  SsuLog *ssuLog = SsuLog::instance();
-
-  foreach (const QString &settingsFile, settingsFiles){
-    QSettings settings(settingsFile, QSettings::IniFormat);
-    QStringList groups = settings.childGroups();
-
-    ssuLog->print(LOG_DEBUG, QString("Merging %1 into %2")
-                  .arg(settingsFile)
-                  .arg(masterSettings->fileName()));
-
-    foreach (const QString &group, groups){
-      masterSettings->beginGroup(group);
-      settings.beginGroup(group);
-
-      QStringList keys = settings.allKeys();
-      foreach (const QString &key, keys){
-        masterSettings->setValue(key, settings.value(key));
-      }
+  QSettings::SettingsMap values;
+  SsuSettingsView::mergeValues(&values, settingsFiles, masterSettings->fileName());
 
-      settings.endGroup();
-      masterSettings->endGroup();
-    }
-  }
+  for (QMap<QString, QVariant>::const_iterator item = values.constBegin();
+       item != values.constEnd(); ++item)
+    masterSettings->setValue(item.key(), item.value());
 }
 
 /*
@@ -114,80 +294,110 @@ void SsuSettings::upgrade(){
   if (defaultSettingsFile == "")
     return;
 
-  QSettings defaultSettings(defaultSettingsFile, QSettings::IniFormat);
+  // the defaults are only read, so use the snapshot if it is current. Only
+  // their version is needed unless the configuration is outdated
+  QString defaultSource = SsuSettingsView::sourceName(defaultSettingsFile, QString());
+  int source;
+  QSharedPointer<SsuSettingsSnapshot> snapshot =
+    SsuSettingsView::currentSnapshot(defaultSource, &source);
+  QSettings::SettingsMap defaultSettings;
+  QVariant defaultVersion;
+
+  if (snapshot.isNull()){
+    SsuSettingsView::readFiles(defaultSettingsFile, QString(), &defaultSettings);
+    defaultVersion = defaultSettings.value("configVersion");
+  } else
+    snapshot->value(source, "configVersion", &defaultVersion);
 
   if (contains("configVersion"))
     configVersion = value("configVersion").toInt();
-  if (defaultSettings.contains("configVersion"))
-    defaultConfigVersion = defaultSettings.value("configVersion").toInt();
+  if (defaultVersion.isValid())
+    defaultConfigVersion = defaultVersion.toInt();
 
   if (configVersion < defaultConfigVersion){
+    if (!snapshot.isNull())
+      snapshot->read(defaultSource, &defaultSettings);
+
     ssuLog->print(LOG_DEBUG, QString("Configuration is outdated, updating from %1 to %2")
                  .arg(configVersion)
                  .arg(defaultConfigVersion));
 
-    for (int i=configVersion+1;i<=defaultConfigVersion;i++){
-      QStringList defaultKeys;
-      QString currentSection = QString("%1/").arg(i);
-
-      ssuLog->print(LOG_DEBUG, QString("Processing configuration version %1").arg(i));
-      defaultSettings.beginGroup(currentSection);
-      defaultKeys = defaultSettings.allKeys();
-      defaultSettings.endGroup();
-      foreach (const QString &key, defaultKeys){
-        // Default keys support both commands and new keys
-        if (key.compare("cmd-remove", Qt::CaseSensitive) == 0){
-          // Remove keys listed in value as string list
-          QStringList oldKeys = defaultSettings.value(currentSection + key).toStringList();
-          foreach (const QString &oldKey, oldKeys){
-            if (contains(oldKey)){
-              remove(oldKey);
-              ssuLog->print(LOG_DEBUG, QString("Removing old key: %1").arg(oldKey));
-            }
-          }
-        } else if (!contains(key)){
-          // Add new keys..
-          setValue(key, defaultSettings.value(currentSection + key));
-          ssuLog->print(LOG_DEBUG, QString("Adding key: %1").arg(key));
-        } else {
-          // ... or update the ones where default values has changed.
-          QVariant oldValue;
-
-          // check if an old value exists in an older configuration version
-          for (int j=i-1;j>0;j--){
-            if (defaultSettings.contains(QString("%1/").arg(j)+key)){
-              oldValue = defaultSettings.value(QString("%1/").arg(j)+key);
-              break;
-            }
-          }
+    // read the defaults once, into the list of keys and values of each
+    // version section
+    typedef QPair<QString, QVariant> DefaultValue;
+    QMap<int, QList<DefaultValue> > versions;
+    foreach (const QString &defaultKey, defaultSettings.keys()){
+      bool isVersion;
+      int version = defaultKey.section('/', 0, 0).toInt(&isVersion);
+      if (!isVersion || version < 1 || version > defaultConfigVersion)
+        continue;
+
+      versions[version].append(qMakePair(defaultKey.section('/', 1),
+                                         defaultSettings.value(defaultKey)));
+    }
+
+    // the value each key had in the most recent version section containing it,
+    // replacing a search through all older sections for every key
+    QHash<QString, QVariant> previousDefaults;
 
-          // skip updating if there is no old value, since we can't check if the
-          // default value has changed
-          if (oldValue.isNull())
-            continue;
+    for (int i=1;i<=defaultConfigVersion;i++){
+      const QList<DefaultValue> defaultValues = versions.value(i);
 
-          QVariant newValue = defaultSettings.value(currentSection + key);
-          if (oldValue == newValue){
-            // old and new value match, no need to do anything, apart from beating the
-            // person who added a useless key
-            continue;
+      if (i > configVersion){
+        ssuLog->print(LOG_DEBUG, QString("Processing configuration version %1").arg(i));
+
+        foreach (const DefaultValue &defaultValue, defaultValues){
+          const QString &key = defaultValue.first;
+
+          // Default keys support both commands and new keys
+          if (key.compare("cmd-remove", Qt::CaseSensitive) == 0){
+            // Remove keys listed in value as string list
+            QStringList oldKeys = defaultValue.second.toStringList();
+            foreach (const QString &oldKey, oldKeys){
+              if (contains(oldKey)){
+                remove(oldKey);
+                ssuLog->print(LOG_DEBUG, QString("Removing old key: %1").arg(oldKey));
+              }
+            }
+          } else if (!contains(key)){
+            // Add new keys..
+            setValue(key, defaultValue.second);
+            ssuLog->print(LOG_DEBUG, QString("Adding key: %1").arg(key));
           } else {
-            // default value has changed, so check if the configuration is still
-            // using the old default value...
-            QVariant currentValue = value(key);
-            // testcase: handles properly default update of thing with changed value in ssu.ini?
-            if (currentValue == oldValue){
-              // ...and update the key if it does
-              setValue(key, newValue);
-              ssuLog->print(LOG_DEBUG, QString("Updating %1 from %2 to %3")
-                           .arg(key)
-                           .arg(currentValue.toString())
-                           .arg(newValue.toString()));
+            // ... or update the ones where default values has changed.
+            QVariant oldValue = previousDefaults.value(key);
+
+            // skip updating if there is no old value, since we can't check if the
+            // default value has changed
+            if (oldValue.isNull())
+              continue;
+
+            QVariant newValue = defaultValue.second;
+            if (oldValue == newValue){
+              // old and new value match, no need to do anything, apart from beating the
+              // person who added a useless key
+              continue;
+            } else {
+              // default value has changed, so check if the configuration is still
+              // using the old default value...
+              QVariant currentValue = value(key);
+              // testcase: handles properly default update of thing with changed value in ssu.ini?
+              if (currentValue == oldValue){
+                // ...and update the key if it does
+                setValue(key, newValue);
+                ssuLog->print(LOG_DEBUG, QString("Updating %1 from %2 to %3")
+                             .arg(key)
+                             .arg(currentValue.toString())
+                             .arg(newValue.toString()));
+              }
             }
           }
         }
+        setValue("configVersion", i);
       }
-      setValue("configVersion", i);
+
+      foreach (const DefaultValue &defaultValue, defaultValues)
+        previousDefaults.insert(defaultValue.first, defaultValue.second);
     }
     sync();
   }
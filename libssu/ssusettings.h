@@ -9,11 +9,15 @@
 #define _SSUSETTINGS_H
 
 #include <QSettings>
+#include <QSharedPointer>
+
+class SsuSettingsView;
 
 class SsuSettings: public QSettings {
     Q_OBJECT
 
     friend class SettingsTest;
+    friend class SsuVariables;
 
   public:
     SsuSettings();
@@ -26,14 +30,36 @@ class SsuSettings: public QSettings {
     /**
      * Initialize the settings object from a settings.d structure, if needed. Only INI
      * style settings are supported in this mode.
+     *
+     * A manifest with stamp and checksum of each merged file is kept next to
+     * fileName. The merge is skipped if no file in settingsDirectory was added,
+     * removed or changed in content, and the configuration file is only
+     * written if the merge result differs.
      */
     SsuSettings(const QString &fileName, const QString &settingsDirectory, QObject *parent=0);
+    ~SsuSettings();
+    /**
+     * Same as the QSettings methods, and also drop the copy of the settings
+     * SsuVariables looks up variables in. Changes made through a QSettings
+     * pointer are only noticed after sync()
+     */
+    void setValue(const QString &key, const QVariant &value);
+    void remove(const QString &key);
+    void clear();
+    void sync();
 
   private:
     QString defaultSettingsFile, settingsd;
     void merge(bool keepOld=false);
     static void merge(QSettings *masterSettings, const QStringList &settingsFiles);
     void upgrade();
+    /**
+     * Return a read only copy of the settings for variable lookups, which is
+     * kept until the settings are changed through this object, or the file
+     * changes on disk
+     */
+    QSharedPointer<SsuSettingsView> view();
+    void invalidateView();
 
 };
 
@@ -0,0 +1,573 @@
+/**
+ * @file ssusettingssnapshot.cpp
+ * @copyright 2013 Jolla Ltd.
+ * @author Bernd Wachter <bwachter@lart.info>
+ * @date 2013
+ */
+
+#include <QDir>
+#include <QFileInfo>
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QVector>
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "sandbox_p.h"
+#include "ssulog.h"
+#include "ssusettingssnapshot_p.h"
+
+#include "../constants.h"
+
+/*
+ * Layout, all numbers are native endian 32 bit words, all offsets are in
+ * bytes from the start of the file:
+ *
+ * header:  magic, version, file size, string count, string index offset,
+ *          source count, source table offset, source bucket count,
+ *          source bucket offset
+ * source:  name, stamp count, stamp offset, entry count, entry offset,
+ *          bucket count, bucket offset
+ * stamp:   path, exists, size (lo, hi), mtime (lo, hi), mtime nsec,
+ *          inode (lo, hi)
+ * entry:   key, key hash, type, count, string or list offset
+ * list:    count string numbers
+ * buckets: hash table of source or entry numbers plus one, 0 marking an
+ *          empty bucket. The bucket count is a power of two, and a number
+ *          colliding with another one goes to the next free bucket
+ * strings: offset and length (in UTF-16 code units) for each string,
+ *          followed by the UTF-16 data of all strings
+ *
+ * The entries of a source are sorted by key. Strings are referenced by their
+ * number in the string index.
+ */
+
+namespace {
+  const quint32 snapshotMagic = 0x50414e53; // "SNAP" on little endian
+  const quint32 snapshotVersion = 3;
+
+  enum {
+    HeaderWords = 9,
+    SourceWords = 7,
+    StampWords = 9,
+    EntryWords = 5
+  };
+
+  enum ValueType {
+    StringValue = 0,
+    ListValue = 1
+  };
+
+  class StringTable {
+    public:
+      quint32 intern(const QString &string){
+        QHash<QString, quint32>::const_iterator it = index.constFind(string);
+        if (it != index.constEnd())
+          return it.value();
+
+        quint32 number = strings.size();
+        strings.append(string);
+        index.insert(string, number);
+        return number;
+      }
+
+      QStringList strings;
+
+    private:
+      QHash<QString, quint32> index;
+  };
+
+  quint32 lo(quint64 value){
+    return value & 0xffffffff;
+  }
+
+  quint32 hi(quint64 value){
+    return value >> 32;
+  }
+
+  quint64 combine(quint32 lo, quint32 hi){
+    return ((quint64)hi << 32) | lo;
+  }
+
+  // FNV-1a over the UTF-16 code units; qHash() may differ between Qt versions
+  quint32 keyHash(const QString &key){
+    quint32 hash = 2166136261u;
+    const ushort *data = key.utf16();
+
+    for (int i = 0; i < key.size(); i++){
+      hash ^= data[i];
+      hash *= 16777619u;
+    }
+
+    return hash;
+  }
+
+  bool isPowerOfTwo(quint32 value){
+    return value != 0 && (value & (value - 1)) == 0;
+  }
+
+  // hash table with a bucket for each of hashes, see the layout above
+  QVector<quint32> buckets(const QVector<quint32> &hashes){
+    quint32 count = 1;
+    while (count < (quint32)hashes.size() * 2)
+      count <<= 1;
+
+    QVector<quint32> result(count, 0);
+    const quint32 mask = count - 1;
+    for (int i = 0; i < hashes.size(); i++){
+      quint32 bucket = hashes.at(i) & mask;
+      while (result.at(bucket) != 0)
+        bucket = (bucket + 1) & mask;
+      result[bucket] = i + 1;
+    }
+
+    return result;
+  }
+}
+
+SsuSettingsSnapshot::Stamp::Stamp(): exists(false), size(0), mtime(0), inode(0), mtimeNsec(0){
+}
+
+SsuSettingsSnapshot::Stamp SsuSettingsSnapshot::Stamp::read(const QString &path){
+  Stamp stamp;
+  struct stat buf;
+
+  if (stat(QFile::encodeName(path).constData(), &buf) != 0)
+    return stamp;
+
+  stamp.exists = true;
+  stamp.size = buf.st_size;
+  stamp.mtime = buf.st_mtim.tv_sec;
+  stamp.mtimeNsec = buf.st_mtim.tv_nsec;
+  stamp.inode = buf.st_ino;
+  return stamp;
+}
+
+bool SsuSettingsSnapshot::Stamp::operator==(const Stamp &other) const {
+  if (exists != other.exists)
+    return false;
+
+  return !exists ||
+    (size == other.size && mtime == other.mtime &&
+     mtimeNsec == other.mtimeNsec && inode == other.inode);
+}
+
+SsuSettingsSnapshot::SsuSettingsSnapshot(): data(0), size(0){
+}
+
+SsuSettingsSnapshot::~SsuSettingsSnapshot(){
+  if (data != 0)
+    file.unmap(const_cast<uchar *>(data));
+}
+
+bool SsuSettingsSnapshot::map(const QString &path){
+  file.setFileName(path);
+  if (!file.open(QIODevice::ReadOnly))
+    return false;
+
+  if (file.size() < HeaderWords * 4 || file.size() > 0x7fffffff){
+    file.close();
+    return false;
+  }
+
+  size = file.size();
+  data = file.map(0, size);
+  if (data == 0){
+    file.close();
+    return false;
+  }
+
+  const quint32 *header = words(0, HeaderWords);
+  if (header[0] != snapshotMagic || header[1] != snapshotVersion || header[2] != size){
+    SsuLog::instance()->print(LOG_DEBUG, QString("Ignoring snapshot %1 of unknown format")
+                              .arg(path));
+    file.unmap(const_cast<uchar *>(data));
+    data = 0;
+    file.close();
+    return false;
+  }
+
+  return true;
+}
+
+bool SsuSettingsSnapshot::isValid() const {
+  return data != 0;
+}
+
+int SsuSettingsSnapshot::source(const QString &name) const {
+  const quint32 *header = words(0, HeaderWords);
+  if (header == 0 || !isPowerOfTwo(header[7]))
+    return -1;
+
+  const quint32 *buckets = words(header[8], header[7]);
+  const quint32 *records = words(header[6], header[5] * SourceWords);
+  if (buckets == 0 || records == 0)
+    return -1;
+
+  const quint32 mask = header[7] - 1;
+  quint32 bucket = keyHash(name) & mask;
+  for (quint32 i = 0; i < header[7]; i++, bucket = (bucket + 1) & mask){
+    const quint32 number = buckets[bucket];
+    if (number == 0 || number > header[5])
+      return -1;
+
+    if (compareString(records[(number - 1) * SourceWords], name) == 0)
+      return number - 1;
+  }
+
+  return -1;
+}
+
+bool SsuSettingsSnapshot::isCurrent(const QString &source) const {
+  return isCurrent(this->source(source));
+}
+
+bool SsuSettingsSnapshot::isCurrent(int source) const {
+  const quint32 *record = sourceRecord(source);
+  if (record == 0)
+    return false;
+
+  const quint32 *stamps = words(record[2], record[1] * StampWords);
+  if (stamps == 0)
+    return false;
+
+  for (quint32 i = 0; i < record[1]; i++){
+    const quint32 *stamp = stamps + i * StampWords;
+    Stamp recorded;
+    recorded.exists = stamp[1] != 0;
+    recorded.size = combine(stamp[2], stamp[3]);
+    recorded.mtime = combine(stamp[4], stamp[5]);
+    recorded.mtimeNsec = stamp[6];
+    recorded.inode = combine(stamp[7], stamp[8]);
+
+    if (Stamp::read(string(stamp[0])) != recorded)
+      return false;
+  }
+
+  return true;
+}
+
+bool SsuSettingsSnapshot::value(int source, const QString &key, QVariant *value) const {
+  const quint32 *record = sourceRecord(source);
+  if (record == 0 || !isPowerOfTwo(record[5]))
+    return false;
+
+  const quint32 *table = entries(record);
+  const quint32 *buckets = words(record[6], record[5]);
+  if (table == 0 || buckets == 0)
+    return false;
+
+  const quint32 hash = keyHash(key);
+  const quint32 mask = record[5] - 1;
+  quint32 bucket = hash & mask;
+  for (quint32 i = 0; i < record[5]; i++, bucket = (bucket + 1) & mask){
+    const quint32 number = buckets[bucket];
+    if (number == 0 || number > record[3])
+      return false;
+
+    const quint32 *entry = table + (number - 1) * EntryWords;
+    if (entry[1] == hash && compareString(entry[0], key) == 0){
+      *value = entryValue(entry);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+QStringList SsuSettingsSnapshot::keys(int source, const QString &prefix) const {
+  QStringList result;
+  const quint32 *record = sourceRecord(source);
+  if (record == 0)
+    return result;
+
+  const quint32 *table = entries(record);
+  if (table == 0)
+    return result;
+
+  // the first key not sorting before prefix; all keys starting with prefix
+  // follow it
+  quint32 first = 0, last = record[3];
+  while (first < last){
+    quint32 middle = first + (last - first) / 2;
+    if (compareString(table[middle * EntryWords], prefix) < 0)
+      first = middle + 1;
+    else
+      last = middle;
+  }
+
+  for (quint32 i = first; i < record[3] && startsWith(table[i * EntryWords], prefix); i++)
+    result.append(string(table[i * EntryWords]));
+
+  return result;
+}
+
+bool SsuSettingsSnapshot::read(const QString &source, QSettings::SettingsMap *values) const {
+  const quint32 *record = sourceRecord(this->source(source));
+  if (record == 0)
+    return false;
+
+  const quint32 *table = entries(record);
+  if (table == 0)
+    return false;
+
+  for (quint32 i = 0; i < record[3]; i++){
+    const quint32 *entry = table + i * EntryWords;
+    values->insert(string(entry[0]), entryValue(entry));
+  }
+
+  return true;
+}
+
+bool SsuSettingsSnapshot::write(const QString &path, const QList<Source> &sources){
+  SsuLog *ssuLog = SsuLog::instance();
+  QList<Source> supported;
+
+  foreach (const Source &source, sources){
+    if (source.stamps.size() != source.inputs.size()){
+      ssuLog->print(LOG_WARNING, QString("Not writing snapshot %1, inputs of %2 are not stamped")
+                    .arg(path).arg(source.name));
+      return false;
+    }
+
+    bool valid = true;
+    foreach (const QVariant &value, source.values){
+      if (value.type() != QVariant::String && value.type() != QVariant::StringList){
+        valid = false;
+        break;
+      }
+    }
+
+    if (valid)
+      supported.append(source);
+    else
+      ssuLog->print(LOG_WARNING, QString("Not adding %1 to snapshot, it contains unsupported values")
+                    .arg(source.name));
+  }
+
+  StringTable strings;
+  QVector<quint32> w(HeaderWords + supported.size() * SourceWords);
+
+  w[0] = snapshotMagic;
+  w[1] = snapshotVersion;
+  w[5] = supported.size();
+  w[6] = HeaderWords * 4;
+
+  QVector<quint32> sourceHashes;
+
+  for (int i = 0; i < supported.size(); i++){
+    const Source &source = supported.at(i);
+    const int record = HeaderWords + i * SourceWords;
+
+    w[record] = strings.intern(source.name);
+    sourceHashes << keyHash(source.name);
+
+    w[record + 1] = source.inputs.size();
+    w[record + 2] = w.size() * 4;
+    for (int j = 0; j < source.inputs.size(); j++){
+      const Stamp &stamp = source.stamps.at(j);
+      w << strings.intern(source.inputs.at(j)) << stamp.exists
+        << lo(stamp.size) << hi(stamp.size)
+        << lo(stamp.mtime) << hi(stamp.mtime)
+        << stamp.mtimeNsec
+        << lo(stamp.inode) << hi(stamp.inode);
+    }
+
+    const quint32 entryOffset = w.size() * 4;
+    const quint32 listOffset = entryOffset + source.values.size() * EntryWords * 4;
+    QVector<quint32> lists, keyHashes;
+
+    // the map is sorted by key, as the entries need to be
+    for (QSettings::SettingsMap::const_iterator it = source.values.constBegin();
+         it != source.values.constEnd(); ++it){
+      keyHashes << keyHash(it.key());
+      w << strings.intern(it.key()) << keyHashes.last();
+      if (it.value().type() == QVariant::StringList){
+        QStringList list = it.value().toStringList();
+        w << ListValue << list.size() << listOffset + lists.size() * 4;
+        foreach (const QString &item, list)
+          lists << strings.intern(item);
+      } else
+        w << StringValue << 1 << strings.intern(it.value().toString());
+    }
+
+    w[record + 3] = source.values.size();
+    w[record + 4] = entryOffset;
+    w << lists;
+
+    QVector<quint32> keyBuckets = buckets(keyHashes);
+    w[record + 5] = keyBuckets.size();
+    w[record + 6] = w.size() * 4;
+    w << keyBuckets;
+  }
+
+  QVector<quint32> sourceBuckets = buckets(sourceHashes);
+  w[7] = sourceBuckets.size();
+  w[8] = w.size() * 4;
+  w << sourceBuckets;
+
+  w[3] = strings.strings.size();
+  w[4] = w.size() * 4;
+
+  quint32 stringOffset = (w.size() + strings.strings.size() * 2) * 4;
+  foreach (const QString &string, strings.strings){
+    w << stringOffset << string.size();
+    stringOffset += string.size() * 2;
+  }
+  w[2] = stringOffset;
+
+  QByteArray content(reinterpret_cast<const char *>(w.constData()), w.size() * 4);
+  foreach (const QString &string, strings.strings)
+    content.append(reinterpret_cast<const char *>(string.utf16()), string.size() * 2);
+
+  // replace the snapshot atomically; processes having the old one mapped
+  // keep using it
+  QFileInfo info(path);
+  QDir().mkpath(info.absolutePath());
+  // processes finding the snapshot outdated may compile it at the same time
+  QString tmpPath = QString("%1/.%2.%3.tmp")
+    .arg(info.absolutePath()).arg(info.fileName()).arg(::getpid());
+
+  QFile tmpFile(tmpPath);
+  if (!tmpFile.open(QIODevice::WriteOnly | QIODevice::Truncate)){
+    ssuLog->print(LOG_WARNING, QString("Unable to write snapshot %1").arg(path));
+    return false;
+  }
+
+  if (tmpFile.write(content) != content.size() || !tmpFile.flush() ||
+      ::fsync(tmpFile.handle()) != 0){
+    tmpFile.close();
+    tmpFile.remove();
+    ssuLog->print(LOG_WARNING, QString("Unable to write snapshot %1").arg(path));
+    return false;
+  }
+  tmpFile.close();
+
+  // an input changed after its stamp was taken may have been read with the
+  // old or the new content; don't let the snapshot claim either is current
+  foreach (const Source &source, supported){
+    for (int j = 0; j < source.inputs.size(); j++){
+      if (Stamp::read(source.inputs.at(j)) != source.stamps.at(j)){
+        tmpFile.remove();
+        ssuLog->print(LOG_INFO, QString("%1 changed while compiling snapshot %2, not writing it")
+                      .arg(source.inputs.at(j)).arg(path));
+        return false;
+      }
+    }
+  }
+
+  if (::rename(QFile::encodeName(tmpPath).constData(),
+               QFile::encodeName(path).constData()) != 0){
+    tmpFile.remove();
+    ssuLog->print(LOG_WARNING, QString("Unable to replace snapshot %1").arg(path));
+    return false;
+  }
+
+  ssuLog->print(LOG_DEBUG, QString("Wrote snapshot %1 with %2 sources, %3 bytes")
+                .arg(path)
+                .arg(supported.size())
+                .arg(content.size()));
+  return true;
+}
+
+QSharedPointer<SsuSettingsSnapshot> SsuSettingsSnapshot::instance(){
+  static QMutex mutex;
+  static QSharedPointer<SsuSettingsSnapshot> current;
+  static Stamp currentStamp;
+
+  QString path = Sandbox::map(SSU_CONFIGURATION_SNAPSHOT);
+  Stamp stamp = Stamp::read(path);
+
+  QMutexLocker locker(&mutex);
+
+  if (!current.isNull() && stamp == currentStamp)
+    return current;
+
+  current = QSharedPointer<SsuSettingsSnapshot>(new SsuSettingsSnapshot());
+  if (stamp.exists)
+    current->map(path);
+  currentStamp = stamp;
+
+  return current;
+}
+
+const quint32 *SsuSettingsSnapshot::words(quint32 offset, quint32 count) const {
+  if (data == 0 || offset % 4 != 0 || (quint64)offset + (quint64)count * 4 > size)
+    return 0;
+
+  return reinterpret_cast<const quint32 *>(data + offset);
+}
+
+const QChar *SsuSettingsSnapshot::stringData(quint32 index, quint32 *length) const {
+  const quint32 *header = words(0, HeaderWords);
+  if (header == 0 || index >= header[3])
+    return 0;
+
+  const quint32 *entry = words(header[4] + index * 8, 2);
+  if (entry == 0 || entry[0] % 2 != 0 || (quint64)entry[0] + (quint64)entry[1] * 2 > size)
+    return 0;
+
+  *length = entry[1];
+  return reinterpret_cast<const QChar *>(data + entry[0]);
+}
+
+QString SsuSettingsSnapshot::string(quint32 index) const {
+  quint32 length = 0;
+  const QChar *chars = stringData(index, &length);
+
+  // copy, the string may outlive the mapping
+  return chars == 0 ? QString() : QString(chars, length);
+}
+
+int SsuSettingsSnapshot::compareString(quint32 index, const QString &other) const {
+  quint32 length = 0;
+  const QChar *chars = stringData(index, &length);
+  const QChar *otherChars = other.constData();
+  const quint32 otherLength = other.size();
+
+  for (quint32 i = 0; i < length && i < otherLength; i++){
+    if (chars[i] != otherChars[i])
+      return chars[i].unicode() - otherChars[i].unicode();
+  }
+
+  return (int)length - (int)otherLength;
+}
+
+bool SsuSettingsSnapshot::startsWith(quint32 index, const QString &prefix) const {
+  quint32 length = 0;
+  const QChar *chars = stringData(index, &length);
+  if (chars == 0 || length < (quint32)prefix.size())
+    return false;
+
+  return memcmp(chars, prefix.constData(), prefix.size() * sizeof(QChar)) == 0;
+}
+
+const quint32 *SsuSettingsSnapshot::sourceRecord(int source) const {
+  const quint32 *header = words(0, HeaderWords);
+  if (header == 0 || source < 0 || (quint32)source >= header[5])
+    return 0;
+
+  return words(header[6] + source * SourceWords * 4, SourceWords);
+}
+
+const quint32 *SsuSettingsSnapshot::entries(const quint32 *record) const {
+  return words(record[4], record[3] * EntryWords);
+}
+
+QVariant SsuSettingsSnapshot::entryValue(const quint32 *entry) const {
+  if (entry[2] == StringValue)
+    return string(entry[4]);
+
+  QStringList list;
+  const quint32 *items = words(entry[4], entry[3]);
+  if (items != 0){
+    for (quint32 i = 0; i < entry[3]; i++)
+      list.append(string(items[i]));
+  }
+
+  return list;
+}
@@ -0,0 +1,119 @@
+/**
+ * @file ssusettingssnapshot_p.h
+ * @copyright 2013 Jolla Ltd.
+ * @author Bernd Wachter <bwachter@lart.info>
+ * @date 2013
+ */
+
+#ifndef _SSUSETTINGSSNAPSHOT_P_H
+#define _SSUSETTINGSSNAPSHOT_P_H
+
+#include <QFile>
+#include <QSettings>
+#include <QSharedPointer>
+#include <QStringList>
+
+/**
+ * Compiled, read only copy of configuration files
+ *
+ * A snapshot contains any number of sources, each one the complete key/value
+ * map read from one or more configuration files; all strings are stored
+ * once in UTF-16. Sources and keys are found through hash tables in the
+ * mapped file, and the keys of a group through the sorted key table, so
+ * looking up a value only copies the value itself. read() copies a whole
+ * source, for callers needing all values anyway.
+ *
+ * For each source the size and modification time of the files and
+ * directories it was read from are recorded; isCurrent() checks if the
+ * source is still up to date. Only string and string list values are
+ * supported, sources with other values can't be stored.
+ */
+class SsuSettingsSnapshot {
+  public:
+    /// Identifies a version of a file or directory on disk
+    struct Stamp {
+      bool exists;
+      quint64 size, mtime, inode;
+      quint32 mtimeNsec;
+
+      Stamp();
+      static Stamp read(const QString &path);
+      bool operator==(const Stamp &other) const;
+      bool operator!=(const Stamp &other) const { return !(*this == other); }
+    };
+
+    struct Source {
+      /// Name the source is looked up by
+      QString name;
+      /// Files and directories the values were read from
+      QStringList inputs;
+      /**
+       * Stamp of each input, taken before reading the values, so a change
+       * while reading makes the source outdated instead of going unnoticed
+       */
+      QList<Stamp> stamps;
+      QSettings::SettingsMap values;
+    };
+
+    SsuSettingsSnapshot();
+    ~SsuSettingsSnapshot();
+    /**
+     * Map the snapshot at path
+     * @return false if the file does not exist or is no valid snapshot
+     */
+    bool map(const QString &path);
+    bool isValid() const;
+    /**
+     * Return the number of source in the snapshot, or -1
+     */
+    int source(const QString &name) const;
+    /**
+     * Check if the snapshot contains source, and none of its inputs changed
+     */
+    bool isCurrent(const QString &source) const;
+    bool isCurrent(int source) const;
+    /**
+     * Look up key in source, storing its value in value
+     * @return false if source doesn't contain key
+     */
+    bool value(int source, const QString &key, QVariant *value) const;
+    /**
+     * Return the keys in source starting with prefix, sorted
+     */
+    QStringList keys(int source, const QString &prefix) const;
+    /**
+     * Add all keys of source to values
+     */
+    bool read(const QString &source, QSettings::SettingsMap *values) const;
+    /**
+     * Compile sources into a new snapshot, replacing path atomically. Nothing
+     * is written if an input of a source no longer matches its stamp.
+     */
+    static bool write(const QString &path, const QList<Source> &sources);
+    /**
+     * Return the snapshot at SSU_CONFIGURATION_SNAPSHOT, mapping it again if
+     * the file was replaced. The returned object is never null, but may be
+     * invalid.
+     */
+    static QSharedPointer<SsuSettingsSnapshot> instance();
+
+  private:
+    SsuSettingsSnapshot(const SsuSettingsSnapshot &); // hide copy constructor
+
+    QFile file;
+    const uchar *data;
+    quint32 size;
+
+    const quint32 *words(quint32 offset, quint32 count) const;
+    /// Return the UTF-16 data of string index, setting length; 0 if invalid
+    const QChar *stringData(quint32 index, quint32 *length) const;
+    QString string(quint32 index) const;
+    /// Compare string index with other as QString::compare() does
+    int compareString(quint32 index, const QString &other) const;
+    bool startsWith(quint32 index, const QString &prefix) const;
+    const quint32 *sourceRecord(int source) const;
+    const quint32 *entries(const quint32 *record) const;
+    QVariant entryValue(const quint32 *entry) const;
+};
+
+#endif
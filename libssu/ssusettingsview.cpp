@@ -0,0 +1,366 @@
+/**
+ * @file ssusettingsview.cpp
+ * @copyright 2013 Jolla Ltd.
+ * @author Bernd Wachter <bwachter@lart.info>
+ * @date 2013
+ */
+
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QPair>
+
+#include "sandbox_p.h"
+#include "ssusettingssnapshot_p.h"
+#include "ssusettingsview.h"
+#include "ssulog.h"
+
+#include "../constants.h"
+
+SsuSettingsView::SsuSettingsView(const QString &fileName, const QString &settingsDirectory):
+  base(Sandbox::map(fileName)), source(-1), groupIndexValid(false){
+  if (!settingsDirectory.isEmpty())
+    directory = Sandbox::map(settingsDirectory);
+
+  // values are looked up in the mapped snapshot while it is current, and
+  // only copied from the INI files otherwise
+  snapshot = currentSnapshot(sourceName(base, directory), &source);
+  if (snapshot.isNull())
+    readFiles(base, directory, &values);
+}
+
+SsuSettingsView::SsuSettingsView(const QSettings::SettingsMap &values):
+  source(-1), values(values), groupIndexValid(false){
+}
+
+SsuSettingsView::SsuSettingsView(const QSettings &settings):
+  base(settings.fileName()), source(-1), groupIndexValid(false){
+  foreach (const QString &key, settings.allKeys())
+    values.insert(key, settings.value(key));
+}
+
+QVariant SsuSettingsView::value(const QString &key, const QVariant &defaultValue) const {
+  if (snapshot.isNull())
+    return values.value(normalizedKey(key), defaultValue);
+
+  QVariant result;
+  return snapshot->value(source, normalizedKey(key), &result) ? result : defaultValue;
+}
+
+bool SsuSettingsView::contains(const QString &key) const {
+  if (snapshot.isNull())
+    return values.contains(normalizedKey(key));
+
+  QVariant result;
+  return snapshot->value(source, normalizedKey(key), &result);
+}
+
+QStringList SsuSettingsView::allKeys(const QString &group) const {
+  return children(normalizedKey(group), AllKeys);
+}
+
+QStringList SsuSettingsView::childGroups(const QString &group) const {
+  return children(normalizedKey(group), ChildGroups);
+}
+
+QStringList SsuSettingsView::childKeys(const QString &group) const {
+  return children(normalizedKey(group), ChildKeys);
+}
+
+QString SsuSettingsView::fileName() const {
+  return base;
+}
+
+QStringList SsuSettingsView::sourceFiles() const {
+  if (base.isEmpty())
+    return QStringList();
+
+  return layerFiles(base, directory);
+}
+
+bool SsuSettingsView::hasGroup(const QString &group) const {
+  QMutexLocker locker(&cacheMutex);
+
+  // index the groups once, instead of listing them for each lookup
+  if (!groupIndexValid){
+    foreach (const QString &child, children(QString(), ChildGroups))
+      groupIndex.insert(child);
+    groupIndexValid = true;
+  }
+
+  return groupIndex.contains(group);
+}
+
+bool SsuSettingsView::cachedVariableSection(const QString &section,
+                                            QHash<QString, QString> *variables) const {
+  QMutexLocker locker(&cacheMutex);
+  QHash<QString, QHash<QString, QString> >::const_iterator it = variableSections.constFind(section);
+  if (it == variableSections.constEnd())
+    return false;
+
+  *variables = it.value();
+  return true;
+}
+
+void SsuSettingsView::cacheVariableSection(const QString &section,
+                                           const QHash<QString, QString> &variables) const {
+  QMutexLocker locker(&cacheMutex);
+  variableSections.insert(section, variables);
+}
+
+bool SsuSettingsView::cachedVariable(const QString &key, QVariant *value) const {
+  QMutexLocker locker(&cacheMutex);
+  QHash<QString, QVariant>::const_iterator it = variables.constFind(key);
+  if (it == variables.constEnd())
+    return false;
+
+  *value = it.value();
+  return true;
+}
+
+void SsuSettingsView::cacheVariable(const QString &key, const QVariant &value) const {
+  QMutexLocker locker(&cacheMutex);
+  variables.insert(key, value);
+}
+
+bool SsuSettingsView::cachedDefaultSection(const QString &section, QString *defaultSection) const {
+  QMutexLocker locker(&cacheMutex);
+  QHash<QString, QString>::const_iterator it = defaultSections.constFind(section);
+  if (it == defaultSections.constEnd())
+    return false;
+
+  *defaultSection = it.value();
+  return true;
+}
+
+void SsuSettingsView::cacheDefaultSection(const QString &section,
+                                          const QString &defaultSection) const {
+  QMutexLocker locker(&cacheMutex);
+  defaultSections.insert(section, defaultSection);
+}
+
+QString SsuSettingsView::normalizedKey(const QString &key){
+  return key.split('/', QString::SkipEmptyParts).join("/");
+}
+
+QStringList SsuSettingsView::children(const QString &group, ChildType type) const {
+  QStringList result;
+  QString prefix = group;
+  if (!prefix.isEmpty())
+    prefix.append('/');
+
+  // keys are sorted, so all keys in the group are next to each other
+  QStringList keys;
+  if (snapshot.isNull()){
+    QSettings::SettingsMap::const_iterator it = values.lowerBound(prefix);
+    for (; it != values.constEnd() && it.key().startsWith(prefix); ++it)
+      keys.append(it.key());
+  } else
+    keys = snapshot->keys(source, prefix);
+
+  foreach (const QString &fullKey, keys){
+    QString key = fullKey.mid(prefix.size());
+    int separator = key.indexOf('/');
+
+    if (type == AllKeys)
+      result.append(key);
+    else if (type == ChildKeys && separator == -1)
+      result.append(key);
+    else if (type == ChildGroups && separator != -1){
+      QString child = key.left(separator);
+      if (result.isEmpty() || result.last() != child)
+        result.append(child);
+    }
+  }
+
+  return result;
+}
+
+QStringList SsuSettingsView::layerFiles(const QString &base, const QString &directory){
+  QStringList result;
+
+  if (!directory.isEmpty()){
+    QDirIterator it(directory, QDir::Files|QDir::Readable, QDirIterator::FollowSymlinks);
+    while (it.hasNext())
+      result.append(it.next());
+
+    result.sort();
+  }
+
+  // a merge replaces the content of the base file with the directory, so the
+  // base file only counts without any files in the directory. This also
+  // keeps a base file merged by older versions from showing up below the
+  // layers
+  if (result.isEmpty() && QFileInfo(base).isFile())
+    result.append(base);
+
+  return result;
+}
+
+QString SsuSettingsView::sourceName(const QString &base, const QString &directory){
+  return QString("%1\n%2").arg(base).arg(directory);
+}
+
+QSharedPointer<SsuSettingsSnapshot> SsuSettingsView::currentSnapshot(const QString &name, int *source){
+  static QMutex mutex;
+  static bool rebuilt = false;
+
+  QSharedPointer<SsuSettingsSnapshot> snapshot = SsuSettingsSnapshot::instance();
+  *source = snapshot->source(name);
+  if (snapshot->isCurrent(*source))
+    return snapshot;
+
+  // the configuration files are changed by package updates, not by ssu, so
+  // the first process able to write the snapshot after a change compiles it
+  // again; others read the INI files until then
+  {
+    QMutexLocker locker(&mutex);
+    if (rebuilt)
+      return QSharedPointer<SsuSettingsSnapshot>();
+    rebuilt = true;
+  }
+
+  SsuLog *ssuLog = SsuLog::instance();
+  QString path = Sandbox::map(SSU_CONFIGURATION_SNAPSHOT);
+  if (!canUpdateSnapshot()){
+    ssuLog->print(LOG_INFO, QString("Configuration snapshot %1 is outdated, reading configuration files")
+                  .arg(path));
+    return QSharedPointer<SsuSettingsSnapshot>();
+  }
+
+  ssuLog->print(LOG_DEBUG, QString("Configuration snapshot %1 is outdated, updating it")
+                .arg(path));
+  if (!updateSnapshot())
+    return QSharedPointer<SsuSettingsSnapshot>();
+
+  snapshot = SsuSettingsSnapshot::instance();
+  *source = snapshot->source(name);
+  if (!snapshot->isCurrent(*source))
+    return QSharedPointer<SsuSettingsSnapshot>();
+
+  return snapshot;
+}
+
+void SsuSettingsView::readFiles(const QString &base, const QString &directory,
+                                QSettings::SettingsMap *map){
+  QStringList files = layerFiles(base, directory);
+
+  // all keys of the base file are used, settings.d files only provide groups
+  if (files.size() == 1 && files.first() == base){
+    QSettings settings(base, QSettings::IniFormat);
+    foreach (const QString &key, settings.allKeys())
+      map->insert(key, settings.value(key));
+    return;
+  }
+
+  mergeValues(map, files, base);
+}
+
+void SsuSettingsView::mergeValues(QSettings::SettingsMap *values, const QStringList &settingsFiles,
+                                  const QString &target){
+  SsuLog *ssuLog = SsuLog::instance();
+
+  foreach (const QString &settingsFile, settingsFiles){
+    QSettings settings(settingsFile, QSettings::IniFormat);
+    QStringList groups = settings.childGroups();
+
+    ssuLog->print(LOG_DEBUG, QString("Merging %1 into %2")
+                  .arg(settingsFile)
+                  .arg(target));
+
+    foreach (const QString &group, groups){
+      settings.beginGroup(group);
+
+      QStringList keys = settings.allKeys();
+      foreach (const QString &key, keys){
+        values->insert(group + "/" + key, settings.value(key));
+      }
+
+      settings.endGroup();
+    }
+  }
+}
+
+namespace {
+  struct SharedViewEntry {
+    QSharedPointer<SsuSettingsView> view;
+    SsuSettingsSnapshot::Stamp file, directory;
+  };
+}
+
+QSharedPointer<SsuSettingsView> SsuSettingsView::shared(const QString &fileName,
+                                                        const QString &settingsDirectory){
+  static QMutex mutex;
+  static QHash<QString, SharedViewEntry> cache;
+
+  // key on the mapped paths, so switching sandboxes doesn't return stale data
+  QString path = Sandbox::map(fileName);
+  QString directoryPath;
+  if (!settingsDirectory.isEmpty())
+    directoryPath = Sandbox::map(settingsDirectory);
+  QString key = sourceName(path, directoryPath);
+
+  SsuSettingsSnapshot::Stamp fileStamp = SsuSettingsSnapshot::Stamp::read(path);
+  SsuSettingsSnapshot::Stamp directoryStamp;
+  if (!directoryPath.isEmpty())
+    directoryStamp = SsuSettingsSnapshot::Stamp::read(directoryPath);
+
+  QMutexLocker locker(&mutex);
+
+  QHash<QString, SharedViewEntry>::const_iterator it = cache.constFind(key);
+  if (it != cache.constEnd() && it->file == fileStamp && it->directory == directoryStamp)
+    return it->view;
+
+  // stamped before reading, so a change while reading gets the view read
+  // again on the next call
+  SharedViewEntry entry;
+  entry.view = QSharedPointer<SsuSettingsView>(new SsuSettingsView(fileName, settingsDirectory));
+  entry.file = fileStamp;
+  entry.directory = directoryStamp;
+  cache.insert(key, entry);
+
+  return entry.view;
+}
+
+bool SsuSettingsView::updateSnapshot(){
+  QList<QPair<QString, QString> > configurations;
+  configurations << qMakePair(QString(SSU_REPO_CONFIGURATION), QString())
+                 << qMakePair(QString(SSU_BOARD_MAPPING_CONFIGURATION),
+                              QString(SSU_BOARD_MAPPING_CONFIGURATION_DIR))
+                 << qMakePair(QString(SSU_DEFAULT_CONFIGURATION), QString());
+
+  QList<SsuSettingsSnapshot::Source> sources;
+  QPair<QString, QString> configuration;
+  foreach (configuration, configurations){
+    SsuSettingsSnapshot::Source source;
+    QString base = Sandbox::map(configuration.first);
+    QString directory;
+    if (!configuration.second.isEmpty())
+      directory = Sandbox::map(configuration.second);
+
+    source.name = sourceName(base, directory);
+    // adding, removing or replacing a file changes the directory. All inputs
+    // are stamped before anything is read, so a change while reading shows up
+    // as an outdated source
+    source.inputs << base;
+    source.stamps << SsuSettingsSnapshot::Stamp::read(base);
+    if (!directory.isEmpty()){
+      source.inputs << directory;
+      source.stamps << SsuSettingsSnapshot::Stamp::read(directory);
+      foreach (const QString &file, layerFiles(QString(), directory)){
+        source.inputs << file;
+        source.stamps << SsuSettingsSnapshot::Stamp::read(file);
+      }
+    }
+
+    readFiles(base, directory, &source.values);
+    sources.append(source);
+  }
+
+  return SsuSettingsSnapshot::write(Sandbox::map(SSU_CONFIGURATION_SNAPSHOT), sources);
+}
+
+bool SsuSettingsView::canUpdateSnapshot(){
+  QString path = Sandbox::map(SSU_CONFIGURATION_SNAPSHOT);
+  return QFileInfo(QFileInfo(path).absolutePath()).isWritable();
+}
@@ -0,0 +1,159 @@
+/**
+ * @file ssusettingsview.h
+ * @copyright 2013 Jolla Ltd.
+ * @author Bernd Wachter <bwachter@lart.info>
+ * @date 2013
+ */
+
+#ifndef _SSUSETTINGSVIEW_H
+#define _SSUSETTINGSVIEW_H
+
+#include <QHash>
+#include <QMutex>
+#include <QSet>
+#include <QSettings>
+#include <QSharedPointer>
+#include <QStringList>
+
+class SsuSettingsSnapshot;
+
+/**
+ * Read only view of configuration values
+ *
+ * A view holds the keys of an INI file, optionally with the files of a
+ * settings.d directory layered on top, or a copy of other settings. It is
+ * never written to disk. Values are immutable; derived caches are filled
+ * lazily under an internal lock, so all methods may be used from several
+ * threads at once. There are no groups;
+ * keys are always given with their full path, and children of a group are
+ * listed by passing the group.
+ *
+ * While the configuration snapshot at SSU_CONFIGURATION_SNAPSHOT is current
+ * for the files of a view, values are looked up in the mapped snapshot
+ * instead of parsing the files.
+ */
+class SsuSettingsView {
+    friend class SsuSettings;
+    friend class SsuVariables;
+
+  public:
+    /**
+     * Read fileName. If settingsDirectory contains files the view shows what
+     * merging them into fileName would produce instead: the groups of each
+     * file in sorted order, the last file setting a key winning.
+     */
+    explicit SsuSettingsView(const QString &fileName, const QString &settingsDirectory=QString());
+    /**
+     * Hold a copy of values
+     */
+    explicit SsuSettingsView(const QSettings::SettingsMap &values);
+    /**
+     * Hold a copy of all keys of settings, relative to its current group
+     */
+    explicit SsuSettingsView(const QSettings &settings);
+    QVariant value(const QString &key, const QVariant &defaultValue=QVariant()) const;
+    bool contains(const QString &key) const;
+    /**
+     * Return all keys below group, relative to it, or all keys without group
+     */
+    QStringList allKeys(const QString &group=QString()) const;
+    /**
+     * Return the groups directly below group, or the top level groups
+     */
+    QStringList childGroups(const QString &group=QString()) const;
+    /**
+     * Return the keys directly in group, or the top level keys
+     */
+    QStringList childKeys(const QString &group=QString()) const;
+    /**
+     * Return the file the view was read from, or copied from for copies of
+     * QSettings
+     */
+    QString fileName() const;
+    /**
+     * Return the files the values were read from, in the order they were
+     * applied
+     */
+    QStringList sourceFiles() const;
+    /**
+     * Return a view of the INI file fileName shared by all callers in this
+     * process. The view is reused as long as inode, size and modification
+     * time of the file, and of settingsDirectory, stay the same, and read
+     * again otherwise. Modifying a file in settingsDirectory in place is
+     * picked up by new processes only.
+     */
+    static QSharedPointer<SsuSettingsView> shared(const QString &fileName,
+                                                  const QString &settingsDirectory=QString());
+    /**
+     * Compile repos.ini, the board mappings and the configuration defaults
+     * into the snapshot at SSU_CONFIGURATION_SNAPSHOT.
+     *
+     * A process finding the snapshot outdated compiles it again if it may
+     * write it; otherwise the INI files are used.
+     */
+    static bool updateSnapshot();
+    /// Return true if this process may write the snapshot
+    static bool canUpdateSnapshot();
+
+  private:
+    SsuSettingsView(const SsuSettingsView &); // hide copy constructor
+
+    enum ChildType {
+      AllKeys,
+      ChildGroups,
+      ChildKeys
+    };
+
+    QString base, directory;
+    /**
+     * While the snapshot is current values are looked up in source of
+     * snapshot, and values is empty
+     */
+    QSharedPointer<SsuSettingsSnapshot> snapshot;
+    int source;
+    QSettings::SettingsMap values;
+
+    /**
+     * Flattened variable sections, variable and default section lookups of
+     * SsuVariables, and the top level groups. Only used through the accessors
+     * below, which take cacheMutex
+     */
+    mutable QMutex cacheMutex;
+    mutable QHash<QString, QHash<QString, QString> > variableSections;
+    mutable QHash<QString, QVariant> variables;
+    mutable QHash<QString, QString> defaultSections;
+    mutable QSet<QString> groupIndex;
+    mutable bool groupIndexValid;
+
+    /// Return true if group is a top level group
+    bool hasGroup(const QString &group) const;
+    bool cachedVariableSection(const QString &section, QHash<QString, QString> *variables) const;
+    void cacheVariableSection(const QString &section, const QHash<QString, QString> &variables) const;
+    bool cachedVariable(const QString &key, QVariant *value) const;
+    void cacheVariable(const QString &key, const QVariant &value) const;
+    bool cachedDefaultSection(const QString &section, QString *defaultSection) const;
+    void cacheDefaultSection(const QString &section, const QString &defaultSection) const;
+
+    static QString normalizedKey(const QString &key);
+    QStringList children(const QString &group, ChildType type) const;
+    static QStringList layerFiles(const QString &base, const QString &directory);
+    /// Name of the snapshot source holding the view of base and directory
+    static QString sourceName(const QString &base, const QString &directory);
+    /**
+     * Return the configuration snapshot if source name in it is current,
+     * storing its number in source. An outdated snapshot is compiled again,
+     * once per process, if this process may write it.
+     */
+    static QSharedPointer<SsuSettingsSnapshot> currentSnapshot(const QString &name, int *source);
+    /// Read the view of base and directory from the INI files
+    static void readFiles(const QString &base, const QString &directory,
+                          QSettings::SettingsMap *map);
+    /**
+     * Collect the keys of all groups in settingsFiles into values, later files
+     * overriding earlier ones
+     */
+    static void mergeValues(QSettings::SettingsMap *values, const QStringList &settingsFiles,
+                            const QString &target);
+};
+
+#endif
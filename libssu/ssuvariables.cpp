@@ -5,11 +5,12 @@
  * @date 2013
  */
 
+#include <QMutexLocker>
 #include <QStringList>
-#include <QRegExp>
 #include <QStringRef>
 
 #include "ssuvariables.h"
+#include "ssuvariabletemplate_p.h"
 #include "ssulog.h"
 
 #include "../constants.h"
@@ -19,19 +20,32 @@ SsuVariables::SsuVariables(): QObject() {
 }
 
 QString SsuVariables::defaultSection(SsuSettings *settings, QString section){
- QStringList parts = section.split("-");
+  return defaultSection(settings->view().data(), section);
+}
+
+QString SsuVariables::defaultSection(SsuSettingsView *settings, QString section){
+  QString result;
+  if (settings->cachedDefaultSection(section, &result))
+    return result;
+
+  // the section itself does not need to exist
+  QString key = defaultSectionName(section);
+  if (settings->hasGroup(key))
+    result = key;
 
- if (section.startsWith("var-"))
-   parts.insert(1, "default");
- else
-   parts.replace(0, "default");
+  settings->cacheDefaultSection(section, result);
+  return result;
+}
+
+QString SsuVariables::defaultSectionName(const QString &section){
+  QStringList parts = section.split("-");
 
- QString key = parts.join("-");
+  if (section.startsWith("var-"))
+    parts.insert(1, "default");
+  else
+    parts.replace(0, "default");
 
- if (settings->childGroups().contains(key))
-   return key;
- else
-   return "";
+  return parts.join("-");
 }
 
 QString SsuVariables::resolveString(QString pattern, QHash<QString, QString> *variables, int recursionDepth){
@@ -39,37 +53,9 @@ QString SsuVariables::resolveString(QString pattern, QHash<QString, QString> *va
     return "maximum-recursion-level-reached";
   }
 
-  QRegExp regex("%\\\([^%]*\\\)", Qt::CaseSensitive, QRegExp::RegExp2);
-  regex.setMinimal(true);
-
-  int pos = 0;
-  while ((pos = regex.indexIn(pattern, pos)) != -1){
-    QString match = regex.cap(0);
-
-    if (match.contains(":")){
-      // variable is special, resolve before replacing
-      QString variable = resolveVariable(match, variables);
-      pattern.replace(match, variable);
-      pos += variable.length();
-    } else {
-      // look up variable name in hashmap, and replace it with stored value,
-      // if found, or ""
-      QString variableName = match;
-      variableName.remove(0,2);
-      variableName.chop(1);
-      if (variables->contains(variableName)){
-        pattern.replace(match, variables->value(variableName));
-        pos += variables->value(variableName).length();
-      } else
-        pattern.replace(match, "");
-    }
-  }
-
-  // check if string still contains variables, and recurse
-  if (regex.indexIn(pattern, 0) != -1)
-    pattern = resolveString(pattern, variables, recursionDepth + 1);
-
-  return pattern;
+  // the parsed template is cached, so URL patterns from repos.ini only get
+  // parsed once per process
+  return SsuVariableTemplate::compiled(pattern).evaluate(variables, recursionDepth);
 }
 
 QString SsuVariables::resolveVariable(QString variable, QHash<QString, QString> *variables){
@@ -145,18 +131,28 @@ QVariant SsuVariables::variable(QString section, const QString &key){
 }
 
 QVariant SsuVariables::variable(SsuSettings *settings, QString section, const QString &key){
+  return variable(settings->view().data(), section, key);
+}
+
+QVariant SsuVariables::variable(SsuSettingsView *settings, QString section, const QString &key){
   QVariant value;
+  const QString cacheKey = section + "\n" + key;
+
+  if (settings->cachedVariable(cacheKey, &value))
+    return value;
 
-  value = readVariable(settings, section, key, 0);
+  QStringList path;
+  value = readVariable(settings, section, key, &path);
 
   // first check if the value is defined in the main section, and fall back
   // to default sections
   if (value.type() == QMetaType::UnknownType){
     QString dSection = defaultSection(settings, section);
     if (!dSection.isEmpty())
-      value = readVariable(settings, dSection, key, 0, false);
+      value = readVariable(settings, dSection, key, &path, false);
   }
 
+  settings->cacheVariable(cacheKey, value);
   return value;
 }
 
@@ -166,24 +162,54 @@ void SsuVariables::variableSection(QString section, QHash<QString, QString> *sto
 }
 
 void SsuVariables::variableSection(SsuSettings *settings, QString section, QHash<QString, QString> *storageHash){
+  variableSection(settings->view().data(), section, storageHash);
+}
+
+void SsuVariables::variableSection(SsuSettingsView *settings, QString section, QHash<QString, QString> *storageHash){
+  const QHash<QString, QString> variables = flattenedSection(settings, section);
 
+  for (QHash<QString, QString>::const_iterator it = variables.constBegin();
+       it != variables.constEnd(); ++it)
+    storageHash->insert(it.key(), it.value());
+}
+
+// readSection() only ever adds to the hash, so reading a section into an empty
+// hash and adding the result later gives the same as reading it directly
+QHash<QString, QString> SsuVariables::flattenedSection(SsuSettingsView *settings, const QString &section){
+  QHash<QString, QString> variables;
+  if (settings->cachedVariableSection(section, &variables))
+    return variables;
+
+  QStringList path;
+  QHash<QString, QHash<QString, QString> > resolved;
   QString dSection = defaultSection(settings, section);
   if (dSection.isEmpty())
-    readSection(settings, section, storageHash, 0);
+    readSection(settings, section, &variables, &path, &resolved);
   else {
-    readSection(settings, dSection, storageHash, 0);
-    readSection(settings, section, storageHash, 0, false);
+    readSection(settings, dSection, &variables, &path, &resolved);
+    readSection(settings, section, &variables, &path, &resolved, false);
   }
+
+  settings->cacheVariableSection(section, variables);
+  return variables;
 }
 
 // resolve a configuration section, recursively following all 'variables' sections.
 // variables which exist in more than one section will get overwritten when discovered
 // again
 // the section itself gets evaluated at the end, again having a chance to overwrite variables
-void SsuVariables::readSection(SsuSettings *settings, QString section,
-                               QHash<QString, QString> *storageHash, int recursionDepth,
+//
+// path holds the sections currently being read, to detect include cycles; each
+// section's result is kept in resolved, so sections included more than once are
+// read only once
+void SsuVariables::readSection(SsuSettingsView *settings, QString section,
+                               QHash<QString, QString> *storageHash, QStringList *path,
+                               QHash<QString, QHash<QString, QString> > *resolved,
                                bool logOverride){
-  if (recursionDepth >= SSU_MAX_RECURSION){
+  if (isCyclic(settings, section, *path))
+    return;
+
+  if (path->size() >= SSU_MAX_RECURSION){
     SsuLog::instance()->print(LOG_WARNING,
                               QString("Maximum recursion depth for resolving section %1 from %2")
                                       .arg(section)
@@ -191,31 +217,61 @@ void SsuVariables::readSection(SsuSettings *settings, QString section,
     return;
   }
 
-  if (settings->contains(section + "/variables")){
-    // child should log unless the parent is a default section
-    bool childLogOverride = true;
-    if (section.startsWith("default-") || section.startsWith("var-default-"))
-      childLogOverride = false;
-
-    QStringList sections = settings->value(section + "/variables").toStringList();
-    foreach(const QString &section, sections){
-      if (section.startsWith("var-"))
-        readSection(settings, section, storageHash, recursionDepth + 1, childLogOverride);
-      else
-        readSection(settings, "var-" + section, storageHash,
-                    recursionDepth + 1, childLogOverride);
+  QHash<QString, QHash<QString, QString> >::const_iterator done = resolved->constFind(section);
+  if (done == resolved->constEnd()){
+    QHash<QString, QString> variables;
+
+    if (settings->contains(section + "/variables")){
+      // child should log unless the parent is a default section
+      bool childLogOverride = true;
+      if (section.startsWith("default-") || section.startsWith("var-default-"))
+        childLogOverride = false;
+
+      path->append(section);
+      QStringList sections = settings->value(section + "/variables").toStringList();
+      foreach(const QString &section, sections){
+        if (section.startsWith("var-"))
+          readSection(settings, section, &variables, path, resolved, childLogOverride);
+        else
+          readSection(settings, "var-" + section, &variables, path, resolved,
+                      childLogOverride);
+      }
+      path->removeLast();
     }
+
+    readKeys(settings, section, &variables, logOverride);
+    done = resolved->insert(section, variables);
   }
 
-  settings->beginGroup(section);
-  if (settings->group() != section)
-    return;
+  // overrides were logged by readKeys() when the section was read
+  for (QHash<QString, QString>::const_iterator it = done->constBegin();
+       it != done->constEnd(); ++it)
+    storageHash->insert(it.key(), it.value());
+}
 
+// report and return true if section is already being read further up in path
+bool SsuVariables::isCyclic(SsuSettingsView *settings, const QString &section,
+                            const QStringList &path){
+  if (!path.contains(section))
+    return false;
+
+  QStringList cycle = path.mid(path.indexOf(section));
+  cycle.append(section);
+  SsuLog::instance()->print(LOG_WARNING,
+                            QString("Ignoring cyclic variable section include in %1: %2")
+                                    .arg(settings->fileName())
+                                    .arg(cycle.join(" -> ")));
+  return true;
+}
+
+// add the variables defined directly in section
+void SsuVariables::readKeys(SsuSettingsView *settings, const QString &section,
+                            QHash<QString, QString> *storageHash, bool logOverride){
   QStringList locals;
-  if (settings->contains("local"))
-    locals = settings->value("local").toStringList();
+  if (settings->contains(section + "/local"))
+    locals = settings->value(section + "/local").toStringList();
 
-  QStringList keys = settings->allKeys();
+  QStringList keys = settings->allKeys(section);
   foreach (const QString &key, keys){
     // local variable
     if (key.startsWith("_"))
@@ -234,16 +290,18 @@ void SsuVariables::readSection(SsuSettings *settings, QString section,
                                 .arg(settings->fileName())
                                 .arg(section));
     }
-    storageHash->insert(key, settings->value(key).toString());
+    storageHash->insert(key, settings->value(section + "/" + key).toString());
   }
-  settings->endGroup();
 }
 
-QVariant SsuVariables::readVariable(SsuSettings *settings, QString section, const QString &key,
-                                    int recursionDepth, bool logOverride){
+QVariant SsuVariables::readVariable(SsuSettingsView *settings, QString section, const QString &key,
+                                    QStringList *path, bool logOverride){
   QVariant value;
 
-  if (recursionDepth >= SSU_MAX_RECURSION){
+  if (isCyclic(settings, section, *path))
+    return value;
+
+  if (path->size() >= SSU_MAX_RECURSION){
     SsuLog::instance()->print(LOG_WARNING,
                               QString("Maximum recursion depth for resolving %1 from %2::%3")
                                       .arg(key)
@@ -264,14 +322,15 @@ QVariant SsuVariables::readVariable(SsuSettings *settings, QString section, cons
     if (section.startsWith("default-") || section.startsWith("var-default-"))
       childLogOverride = false;
 
+    path->append(section);
     QStringList sections = settings->value(section + "/variables").toStringList();
     foreach(const QString &section, sections){
       if (section.startsWith("var-"))
-        value = readVariable(settings, section, key, recursionDepth + 1, childLogOverride);
+        value = readVariable(settings, section, key, path, childLogOverride);
       else
-        value = readVariable(settings, "var-" + section, key,
-                    recursionDepth + 1, childLogOverride);
+        value = readVariable(settings, "var-" + section, key, path, childLogOverride);
     }
+    path->removeLast();
   }
 
   return value;
@@ -10,8 +10,10 @@
 
 #include <QObject>
 #include <QHash>
+#include <QStringList>
 
 #include "ssusettings.h"
+#include "ssusettingsview.h"
 
 class SsuVariables: public QObject {
     Q_OBJECT
@@ -26,6 +28,7 @@ class SsuVariables: public QObject {
      * "default". You should therefore avoid "-" in section names.
      */
     static QString defaultSection(SsuSettings *settings, QString section);
+    static QString defaultSection(SsuSettingsView *settings, QString section);
     /**
      * Resolve a whole string, containing several variables. Variables inside variables are allowed
      */
@@ -50,6 +53,7 @@ class SsuVariables: public QObject {
      */
     QVariant variable(QString section, const QString &key);
     static QVariant variable(SsuSettings *settings, QString section, const QString &key);
+    static QVariant variable(SsuSettingsView *settings, QString section, const QString &key);
     /**
      * Return the requested variable section, recursively looking up all variable
      * sections referenced inside with the 'variable' keyword. 'var-' is automatically
@@ -64,15 +68,35 @@ class SsuVariables: public QObject {
      * the default section with the requested section.
      */
     void variableSection(QString section, QHash<QString, QString> *storageHash);
+    /**
+     * As above; results are cached in a copy of settings, which is dropped when
+     * settings is changed with setValue(), remove(), clear() or sync()
+     */
     static void variableSection(SsuSettings *settings, QString section,
                                 QHash<QString, QString> *storageHash);
+    /**
+     * As above; a view never changes, so the result is cached in it
+     */
+    static void variableSection(SsuSettingsView *settings, QString section,
+                                QHash<QString, QString> *storageHash);
 
   private:
-    static void readSection(SsuSettings *settings, QString section,
-                            QHash<QString, QString> *storageHash, int recursionDepth,
+    /**
+     * Return section merged with its default section and all included
+     * sections, as variableSection() adds it. The result is cached in settings.
+     */
+    static QHash<QString, QString> flattenedSection(SsuSettingsView *settings, const QString &section);
+    /// Return the name the default section of section would have
+    static QString defaultSectionName(const QString &section);
+    static void readSection(SsuSettingsView *settings, QString section,
+                            QHash<QString, QString> *storageHash, QStringList *path,
+                            QHash<QString, QHash<QString, QString> > *resolved,
                             bool logOverride=true);
-    static QVariant readVariable(SsuSettings *settings, QString section, const QString &key,
-                                int recursionDepth, bool logOverride=true);
+    static void readKeys(SsuSettingsView *settings, const QString &section,
+                         QHash<QString, QString> *storageHash, bool logOverride);
+    static QVariant readVariable(SsuSettingsView *settings, QString section, const QString &key,
+                                QStringList *path, bool logOverride=true);
+    static bool isCyclic(SsuSettingsView *settings, const QString &section, const QStringList &path);
     SsuSettings *m_settings;
 };
 
@@ -0,0 +1,231 @@
+/**
+ * @file ssuvariabletemplate.cpp
+ * @copyright 2013 Jolla Ltd.
+ * @author Bernd Wachter <bwachter@lart.info>
+ * @date 2013
+ */
+
+#include <QMutex>
+#include <QMutexLocker>
+
+#include "ssulog.h"
+#include "ssuvariabletemplate_p.h"
+
+#include "../constants.h"
+
+// upper limit for the number of parsed patterns kept around; the cache
+// gets flushed when reaching it
+static const int maxCachedTemplates = 1024;
+
+SsuVariableTemplate::SsuVariableTemplate(){
+}
+
+SsuVariableTemplate::SsuVariableTemplate(const QString &pattern): m_pattern(pattern){
+  int pos = 0;
+  parseSequence(&pos, &m_root, false, false);
+}
+
+SsuVariableTemplate SsuVariableTemplate::compiled(const QString &pattern){
+  static QMutex mutex;
+  static QHash<QString, SsuVariableTemplate> cache;
+
+  // templates are implicitly shared, so handing out copies of cached ones
+  // is safe once the lock is released
+  QMutexLocker locker(&mutex);
+  QHash<QString, SsuVariableTemplate>::const_iterator it = cache.constFind(pattern);
+  if (it != cache.constEnd())
+    return it.value();
+
+  if (cache.size() >= maxCachedTemplates)
+    cache.clear();
+
+  SsuVariableTemplate t(pattern);
+  cache.insert(pattern, t);
+  return t;
+}
+
+bool SsuVariableTemplate::hasExpressions(const QString &pattern){
+  return pattern.contains("%(");
+}
+
+QString SsuVariableTemplate::evaluate(const QHash<QString, QString> *variables,
+                                      int recursionDepth) const {
+  QStringList expanding;
+  return evaluateSequence(m_root, variables, recursionDepth, &expanding);
+}
+
+QString SsuVariableTemplate::pattern() const {
+  return m_pattern;
+}
+
+// Parse text and expressions starting at pos into sequence. Inside a variable
+// name parsing stops at ':' or ')', inside an expression argument at ')'. The
+// terminating character is not consumed. Returns false if the end of the
+// pattern was reached while still inside an expression.
+bool SsuVariableTemplate::parseSequence(int *pos, QVector<int> *sequence,
+                                        bool inName, bool inExpression){
+  QString text;
+  const int length = m_pattern.length();
+
+  while (*pos < length){
+    const QChar c = m_pattern.at(*pos);
+
+    if (c == '%' && *pos + 1 < length && m_pattern.at(*pos + 1) == '('){
+      appendText(sequence, text);
+      text.clear();
+
+      const int start = *pos;
+      const int nodeCount = m_nodes.size();
+      if (!parseExpression(pos, sequence)){
+        // unterminated expression: keep the opening bracket as literal text,
+        // and continue parsing right behind it
+        m_nodes.resize(nodeCount);
+        text = "%(";
+        *pos = start + 2;
+      }
+      continue;
+    }
+
+    if ((inExpression && c == ')') || (inName && c == ':')){
+      appendText(sequence, text);
+      return true;
+    }
+
+    text.append(c);
+    (*pos)++;
+  }
+
+  appendText(sequence, text);
+  return !inExpression;
+}
+
+bool SsuVariableTemplate::parseExpression(int *pos, QVector<int> *sequence){
+  Node node;
+  node.type = Node::Variable;
+  const int length = m_pattern.length();
+
+  // skip '%('
+  int p = *pos + 2;
+
+  if (!parseSequence(&p, &node.name, true, true))
+    return false;
+
+  if (m_pattern.at(p) == ':'){
+    node.hasOperator = true;
+    p++;
+
+    if (p < length && m_pattern.at(p) != ')' && m_pattern.at(p) != '%'){
+      node.op = m_pattern.at(p);
+      p++;
+    }
+
+    if (!parseSequence(&p, &node.argument, false, true))
+      return false;
+  }
+
+  // skip ')'
+  p++;
+
+  m_nodes.append(node);
+  sequence->append(m_nodes.size() - 1);
+  *pos = p;
+  return true;
+}
+
+void SsuVariableTemplate::appendText(QVector<int> *sequence, const QString &text){
+  if (text.isEmpty())
+    return;
+
+  Node node;
+  node.type = Node::Text;
+  node.text = text;
+  m_nodes.append(node);
+  sequence->append(m_nodes.size() - 1);
+}
+
+QString SsuVariableTemplate::evaluateSequence(const QVector<int> &sequence,
+                                              const QHash<QString, QString> *variables,
+                                              int recursionDepth,
+                                              QStringList *expanding) const {
+  // the common case of a sequence with only a single literal or variable
+  // doesn't need any concatenation
+  if (sequence.size() == 1)
+    return evaluateNode(m_nodes.at(sequence.at(0)), variables, recursionDepth, expanding);
+
+  QString result;
+  foreach (int index, sequence)
+    result.append(evaluateNode(m_nodes.at(index), variables, recursionDepth, expanding));
+
+  return result;
+}
+
+QString SsuVariableTemplate::evaluateNode(const Node &node,
+                                          const QHash<QString, QString> *variables,
+                                          int recursionDepth,
+                                          QStringList *expanding) const {
+  if (node.type == Node::Text)
+    return node.text;
+
+  QString variableName = evaluateSequence(node.name, variables, recursionDepth, expanding);
+  QString variableValue = expandVariable(variableName, variables, recursionDepth, expanding);
+
+  if (!node.hasOperator)
+    return variableValue;
+
+  switch (node.op.toLatin1()){
+    case '-':
+      // substitute default value if variable is empty
+      if (variableValue.isEmpty())
+        return evaluateSequence(node.argument, variables, recursionDepth, expanding);
+      break;
+    case '+':
+      // substitute default value if variable is not empty
+      if (!variableValue.isEmpty())
+        return evaluateSequence(node.argument, variables, recursionDepth, expanding);
+      break;
+    case '=': {
+      // %(%(foo):=bar?foobar|baz)
+      // if foo == bar then return foobar, else baz
+      QString sub = evaluateSequence(node.argument, variables, recursionDepth, expanding);
+      int question = sub.indexOf('?');
+      QString a = sub.left(question);
+      QString b = sub.mid(question + 1);
+      int bar = b.indexOf('|');
+      if (bar == -1)
+        return b;
+      if (variableName == a)
+        return b.left(bar);
+      else
+        return b.mid(bar + 1);
+    }
+  }
+
+  // no proper substitution found -> return default value
+  return variableValue;
+}
+
+QString SsuVariableTemplate::expandVariable(const QString &name,
+                                            const QHash<QString, QString> *variables,
+                                            int recursionDepth, QStringList *expanding){
+  const QString value = variables->value(name);
+  if (!hasExpressions(value))
+    return value;
+
+  if (expanding->contains(name)){
+    QStringList cycle = expanding->mid(expanding->indexOf(name));
+    cycle.append(name);
+    SsuLog::instance()->print(LOG_WARNING, QString("Cyclic variable reference: %1")
+                              .arg(cycle.join(" -> ")));
+    return "maximum-recursion-level-reached";
+  }
+
+  if (recursionDepth + 1 >= SSU_MAX_RECURSION)
+    return "maximum-recursion-level-reached";
+
+  expanding->append(name);
+  const SsuVariableTemplate t = compiled(value);
+  QString result = t.evaluateSequence(t.m_root, variables, recursionDepth + 1, expanding);
+  expanding->removeLast();
+
+  return result;
+}
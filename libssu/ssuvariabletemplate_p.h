@@ -0,0 +1,91 @@
+/**
+ * @file ssuvariabletemplate_p.h
+ * @copyright 2013 Jolla Ltd.
+ * @author Bernd Wachter <bwachter@lart.info>
+ * @date 2013
+ */
+
+#ifndef _SSUVARIABLETEMPLATE_P_H
+#define _SSUVARIABLETEMPLATE_P_H
+
+#include <QHash>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+/**
+ * A pattern containing %(variable) expressions, parsed into an expression tree
+ *
+ * Parsing happens once per pattern; evaluating the tree against a variable hash
+ * is a single pass over the nodes. Supported expressions are plain %(var),
+ * %(var:-default), %(var:+alternative) and %(%(var):=value?match|nomatch).
+ * Nesting is allowed both in the variable name and in the argument.
+ *
+ * Variable values may contain further expressions. Those get compiled (and
+ * cached) on demand when the value is substituted. A variable referring to
+ * itself, directly or through other variables, is reported as a cycle and
+ * not expanded again.
+ */
+class SsuVariableTemplate {
+  public:
+    SsuVariableTemplate();
+    /**
+     * Parse pattern into a new template
+     */
+    explicit SsuVariableTemplate(const QString &pattern);
+    /**
+     * Return the template for pattern, reusing an already parsed template if
+     * available. The cache is shared by all threads.
+     */
+    static SsuVariableTemplate compiled(const QString &pattern);
+    /**
+     * Check if pattern contains anything that looks like a variable expression
+     */
+    static bool hasExpressions(const QString &pattern);
+    /**
+     * Evaluate the template, looking up variables in variables
+     */
+    QString evaluate(const QHash<QString, QString> *variables, int recursionDepth=0) const;
+    /**
+     * Return the pattern this template was parsed from
+     */
+    QString pattern() const;
+
+  private:
+    struct Node {
+      enum Type {
+        Text,
+        Variable
+      };
+
+      Node(): type(Text), hasOperator(false) {}
+
+      Type type;
+      QString text;              ///< Literal text for Text nodes
+      QVector<int> name;         ///< Node sequence making up the variable name
+      bool hasOperator;          ///< Set if the expression contains a ':'
+      QChar op;                  ///< Operator following ':', if any
+      QVector<int> argument;     ///< Node sequence following the operator
+    };
+
+    QString m_pattern;
+    QVector<Node> m_nodes;
+    QVector<int> m_root;
+
+    bool parseSequence(int *pos, QVector<int> *sequence, bool inName, bool inExpression);
+    bool parseExpression(int *pos, QVector<int> *sequence);
+    void appendText(QVector<int> *sequence, const QString &text);
+    QString evaluateSequence(const QVector<int> &sequence,
+                             const QHash<QString, QString> *variables,
+                             int recursionDepth, QStringList *expanding) const;
+    QString evaluateNode(const Node &node, const QHash<QString, QString> *variables,
+                         int recursionDepth, QStringList *expanding) const;
+    /**
+     * Return the value of variable name, with expressions in it evaluated.
+     * expanding holds the variables currently being expanded
+     */
+    static QString expandVariable(const QString &name, const QHash<QString, QString> *variables,
+                                  int recursionDepth, QStringList *expanding);
+};
+
+#endif
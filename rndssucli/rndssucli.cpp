@@ -12,12 +12,17 @@
 
 #include "libssu/ssudeviceinfo.h"
 #include "libssu/ssurepomanager.h"
+#include "libssu/ssureporesolver.h"
 #include "libssu/ssucoreconfig.h"
+#include "libssu/ssusettings.h"
+#include "libssu/ssusettingsview.h"
 
 #include <QDebug>
 
 #include "rndssucli.h"
 
+#include "../constants.h"
+
 RndSsuCli::RndSsuCli(): QObject(){
   connect(this,SIGNAL(done()),
           QCoreApplication::instance(),SLOT(quit()), Qt::DirectConnection);
@@ -127,6 +132,9 @@ void RndSsuCli::optModel(QStringList opt){
   if (opt.count() == 3 && opt.at(2) == "-s"){
     qout << deviceInfo.deviceModel();
     state = Idle;
+  } else if (opt.count() == 3 && opt.at(2) == "-f"){
+    qout << "Device model is: " << deviceInfo.redetectDeviceModel() << endl;
+    state = Idle;
   } else if (opt.count() == 2){
     qout << "Device model is: " << deviceInfo.deviceModel() << endl;
     state = Idle;
@@ -207,8 +215,12 @@ void RndSsuCli::optRegister(QStringList opt){
 
   tcsetattr(STDIN_FILENO, TCSANOW, &termOld);
 
-  if (opt.count() == 3 && opt.at(2) == "-h")
+  // committing drops cached variable sections and writes the change
+  if (opt.count() == 3 && opt.at(2) == "-h"){
+    ssuSettings->beginBatch();
     ssuSettings->setValue("repository-url-variables/user", username);
+    ssuSettings->endBatch();
+  }
 
   ssu.sendRegistration(username, password);
   state = Busy;
@@ -319,6 +331,7 @@ void RndSsuCli::optRepos(QStringList opt){
 
   // TODO: rnd mode override needs to be implemented
   QStringList repos;
+  SsuRepoResolver resolver(rndRepo, repoOverride);
 
   // micMode? handle it and return, as it's a lot simpler than full mode
   if (micMode){
@@ -331,7 +344,7 @@ void RndSsuCli::optRepos(QStringList opt){
       } else if (repoParameters.value("debugSplit") == "debug")
         repoParameters.remove("debugSplit");
 
-      QString repoUrl = ssu.repoUrl(repoName, rndRepo, repoParameters, repoOverride);
+      QString repoUrl = resolver.url(repoName, repoParameters);
       qout << "repo --name=" << repo << "-"
            << (rndRepo ? repoOverride.value("rndRelease")
                        : repoOverride.value("release"))
@@ -368,7 +381,7 @@ void RndSsuCli::optRepos(QStringList opt){
       } else if (repoParameters.value("debugSplit") == "debug")
         repoParameters.remove("debugSplit");
 
-      QString repoUrl = ssu.repoUrl(repoName, rndRepo, repoParameters, repoOverride);
+      QString repoUrl = resolver.url(repoName, repoParameters);
       qout << " - " << qSetFieldWidth(longestField) << repo << qSetFieldWidth(0) << " ... " << repoUrl << endl;
     }
 
@@ -440,6 +453,13 @@ void RndSsuCli::optUpdateCredentials(QStringList opt){
 void RndSsuCli::optUpdateRepos(){
   SsuRepoManager repoManager;
   repoManager.update();
+
+  // libssu layers board-mappings.d in memory, but other readers still use
+  // the merged file. The merge is skipped if board-mappings.d is unchanged
+  SsuSettings boardMappings(SSU_BOARD_MAPPING_CONFIGURATION, SSU_BOARD_MAPPING_CONFIGURATION_DIR);
+  // unprivileged users fall back to the INI files, as libssu does
+  if (SsuSettingsView::canUpdateSnapshot())
+    SsuSettingsView::updateSnapshot();
   uidWarning();
 }
 
@@ -547,6 +567,7 @@ void RndSsuCli::usage(){
        << "\tupdate, up    \tupdate repository credentials" << endl
        << "\t      [-f]    \tforce update" << endl
        << "\tmodel, mo     \tprint name of device model (like N9)" << endl
+       << "\t      [-f]    \tforce detection of the device model" << endl
        << endl;
   qout.flush();
   QCoreApplication::exit(1);
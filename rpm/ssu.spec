@@ -6,14 +6,18 @@ Group: System/Base
 License: GPLv2
 Source0: %{name}-%{version}.tar.gz
 URL: https://github.com/nemomobile/ssu
+# the resolver daemon can only use socket activation with Qt 5.10 or later
+%define urlresolver_socket %(pkg-config --atleast-version=5.10 Qt5Core && echo 1 || echo 0)
 BuildRequires: pkgconfig(boardname)
 BuildRequires: pkgconfig(Qt5Core)
 BuildRequires: pkgconfig(Qt5DBus)
 BuildRequires: pkgconfig(Qt5Network)
+# only used by the tests
 BuildRequires: pkgconfig(Qt5Xml)
 BuildRequires: pkgconfig(Qt5Test)
 BuildRequires: pkgconfig(libzypp)
 BuildRequires: pkgconfig(libsystemd-journal)
+BuildRequires: pkgconfig(libsystemd-daemon)
 BuildRequires: oneshot
 BuildRequires: doxygen
 Requires(pre): shadow-utils
@@ -27,10 +31,17 @@ Requires: ssu-vendor-data
 %files
 %defattr(-,root,root,-)
 %{_libdir}/zypp/plugins/urlresolver/*
+%if %{urlresolver_socket}
+/lib/systemd/system/ssu-urlresolver.socket
+%endif
+/lib/systemd/system/ssu-urlresolver.service
 %{_bindir}/rndssu
 %{_bindir}/ssu
 %{_libdir}/*.so.*
 %dir %{_sysconfdir}/zypp/credentials.d
+# setgid, so the state file keeps the ssu group if it is created again
+%attr(2775, root, ssu) %dir %{_localstatedir}/lib/ssu
+%attr(0664, root, ssu) %ghost %{_localstatedir}/lib/ssu/ssu-state.ini
 # ssu itself does not use the package-update triggers, but provides
 # them for the vendor data packages to use
 %attr(0755, -, -) %{_oneshotdir}/*
@@ -83,6 +94,7 @@ Requires: %{name} = %{version}-%{release}
 Summary: Unit tests for %{name}
 Group: Development/Libraries
 Requires: testrunner-lite
+Requires: %{name}-ks
 
 %description tests
 %{summary}.
@@ -131,6 +143,8 @@ cd .. && doxygen doc/Doxyfile
 %install
 cd build && make INSTALL_ROOT=%{buildroot} install
 mkdir -p %{buildroot}/%{_sysconfdir}/zypp/credentials.d
+mkdir -p %{buildroot}/%{_localstatedir}/lib/ssu
+touch %{buildroot}/%{_localstatedir}/lib/ssu/ssu-state.ini
 ln -s %{_bindir}/ssu %{buildroot}/%{_bindir}/rndssu
 mkdir -p %{buildroot}/%{_docdir}/%{name}
 cd .. && cp -R doc/html/* %{buildroot}/%{_docdir}/%{name}/
@@ -139,10 +153,12 @@ cd .. && cp -R doc/html/* %{buildroot}/%{_docdir}/%{name}/
 %pre
 groupadd -rf ssu
 groupadd-user ssu
-if [ -f /etc/ssu/ssu.ini ]; then
-  chgrp ssu /etc/ssu/ssu.ini
-  chmod 664 /etc/ssu/ssu.ini
-fi
+for file in /etc/ssu/ssu.ini /var/lib/ssu/ssu-state.ini; do
+  if [ -f $file ]; then
+    chgrp ssu $file
+    chmod 664 $file
+  fi
+done
 
 %postun
 /sbin/ldconfig
@@ -14,11 +14,17 @@
 
 #include "../constants.h"
 
-int main(int argc, char **argv){
+static void fixPermissions(const char *path){
   struct stat sb;
 
-  if (!stat(SSU_CONFIGURATION, &sb)){
-    chown(SSU_CONFIGURATION, 0, SSU_GROUP_ID);
-    chmod(SSU_CONFIGURATION, S_IRUSR|S_IWUSR|S_IRGRP|S_IWGRP|S_IROTH);
+  if (!stat(path, &sb)){
+    chown(path, 0, SSU_GROUP_ID);
+    chmod(path, S_IRUSR|S_IWUSR|S_IRGRP|S_IWGRP|S_IROTH);
   }
 }
+
+int main(int argc, char **argv){
+  fixPermissions(SSU_CONFIGURATION);
+  // credentials are kept in the state file, which needs the same access
+  fixPermissions(SSU_STATE);
+}
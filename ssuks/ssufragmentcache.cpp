@@ -0,0 +1,125 @@
+/**
+ * @file ssufragmentcache.cpp
+ * @copyright 2013 Jolla Ltd.
+ * @author Bernd Wachter <bwachter@lart.info>
+ * @date 2013
+ */
+
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QTextStream>
+
+#include "ssufragmentcache.h"
+
+SsuFragmentCache::Stamp SsuFragmentCache::Stamp::read(const QString &path){
+  QFileInfo info(path);
+  Stamp stamp;
+
+  stamp.exists = info.exists();
+  stamp.size = stamp.exists ? info.size() : 0;
+  if (stamp.exists)
+    stamp.lastModified = info.lastModified();
+
+  return stamp;
+}
+
+SsuFragmentCache *SsuFragmentCache::instance(){
+  static SsuFragmentCache cache;
+  return &cache;
+}
+
+QString SsuFragmentCache::find(const QString &path, const QStringList &names){
+  Directory dir = directory(path);
+
+  foreach (const QString &name, names){
+    if (!name.isEmpty() && dir.names.contains(name))
+      return name;
+  }
+
+  return QString();
+}
+
+QStringList SsuFragmentCache::entries(const QString &path){
+  return directory(path).entries;
+}
+
+QStringList SsuFragmentCache::lines(const QString &fileName){
+  Stamp stamp = Stamp::read(fileName);
+
+  {
+    QMutexLocker locker(&mutex);
+    QHash<QString, File>::const_iterator it = files.constFind(fileName);
+    if (it != files.constEnd() && it->stamp == stamp)
+      return it->lines;
+  }
+
+  // read without holding the lock, so other threads can use the cache
+  File file;
+  file.stamp = stamp;
+
+  QFile input(fileName);
+  if (input.open(QIODevice::ReadOnly | QIODevice::Text)){
+    QTextStream in(&input);
+    while (!in.atEnd())
+      file.lines.append(in.readLine());
+  }
+
+  QMutexLocker locker(&mutex);
+  files.insert(fileName, file);
+  return file.lines;
+}
+
+QByteArray SsuFragmentCache::fingerprint(const QString &path, int depth){
+  QCryptographicHash hash(QCryptographicHash::Sha1);
+  addFingerprint(&hash, path, depth);
+  return hash.result().toHex();
+}
+
+void SsuFragmentCache::addFingerprint(QCryptographicHash *hash, const QString &path, int depth){
+  QStringList names;
+  foreach (const QString &name, directory(path).names)
+    names.append(name);
+  names.sort();
+
+  foreach (const QString &name, names){
+    QString entry = path + "/" + name;
+    Stamp stamp = Stamp::read(entry);
+
+    hash->addData(QFile::encodeName(name));
+    hash->addData(QByteArray::number(stamp.size) + " " +
+                  QByteArray::number(stamp.lastModified.toMSecsSinceEpoch()) + "\n");
+
+    if (depth > 0 && QFileInfo(entry).isDir())
+      addFingerprint(hash, entry, depth - 1);
+  }
+}
+
+SsuFragmentCache::Directory SsuFragmentCache::directory(const QString &path){
+  Stamp stamp = Stamp::read(path);
+
+  {
+    QMutexLocker locker(&mutex);
+    QHash<QString, Directory>::const_iterator it = directories.constFind(path);
+    if (it != directories.constEnd() && it->stamp == stamp)
+      return *it;
+  }
+
+  Directory directory;
+  directory.stamp = stamp;
+
+  QDir dir(path);
+  if (stamp.exists){
+    directory.entries = dir.entryList(QDir::AllEntries|QDir::NoDot|QDir::NoDotDot,
+                                      QDir::Name);
+    foreach (const QString &name, dir.entryList(QDir::AllEntries|QDir::Hidden|QDir::System|
+                                                QDir::NoDot|QDir::NoDotDot))
+      directory.names.insert(name);
+  }
+
+  QMutexLocker locker(&mutex);
+  directories.insert(path, directory);
+  return directory;
+}
@@ -0,0 +1,86 @@
+/**
+ * @file ssufragmentcache.h
+ * @copyright 2013 Jolla Ltd.
+ * @author Bernd Wachter <bwachter@lart.info>
+ * @date 2013
+ */
+
+#ifndef _SSUFRAGMENTCACHE_H
+#define _SSUFRAGMENTCACHE_H
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QHash>
+#include <QMutex>
+#include <QSet>
+#include <QStringList>
+
+class QCryptographicHash;
+
+/**
+ * Process wide cache for the kickstart sections below SSU_DATA_DIR/kickstart
+ *
+ * Directory listings and file contents are read once, and kept until the
+ * modification time or size of the directory or file changes. The returned
+ * lists share their data with the cache, so handing them out is cheap. All
+ * methods may be called from several threads at the same time.
+ */
+class SsuFragmentCache {
+  public:
+    static SsuFragmentCache *instance();
+    /**
+     * Return the first of names which exists in directory, or an empty string
+     */
+    QString find(const QString &directory, const QStringList &names);
+    /**
+     * Return the entries of directory, sorted by name, as
+     * QDir::entryList(QDir::AllEntries|QDir::NoDot|QDir::NoDotDot, QDir::Name)
+     */
+    QStringList entries(const QString &directory);
+    /**
+     * Return the lines of fileName, or an empty list if it can't be read
+     */
+    QStringList lines(const QString &fileName);
+    /**
+     * Return a hash of names, sizes and modification times of the entries
+     * in directory, and in its subdirectories up to depth levels below it
+     */
+    QByteArray fingerprint(const QString &directory, int depth=1);
+
+  private:
+    struct Stamp {
+      bool exists;
+      qint64 size;
+      QDateTime lastModified;
+
+      bool operator==(const Stamp &other) const {
+        return exists == other.exists && size == other.size &&
+          lastModified == other.lastModified;
+      }
+      static Stamp read(const QString &path);
+    };
+
+    struct Directory {
+      Stamp stamp;
+      QStringList entries;
+      /// All names in the directory, including hidden ones
+      QSet<QString> names;
+    };
+
+    struct File {
+      Stamp stamp;
+      QStringList lines;
+    };
+
+    SsuFragmentCache(){}
+    SsuFragmentCache(const SsuFragmentCache &); // hide copy constructor
+
+    QMutex mutex;
+    QHash<QString, Directory> directories;
+    QHash<QString, File> files;
+
+    Directory directory(const QString &path);
+    void addFingerprint(QCryptographicHash *hash, const QString &path, int depth);
+};
+
+#endif
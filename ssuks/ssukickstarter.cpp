@@ -8,10 +8,15 @@
 #include <QStringList>
 #include <QRegExp>
 #include <QDirIterator>
+#include <QCryptographicHash>
 
 #include "ssukickstarter.h"
+#include "ssufragmentcache.h"
 #include "libssu/sandbox_p.h"
+#include "libssu/ssucoreconfig.h"
+#include "libssu/ssudeviceinfo.h"
 #include "libssu/ssurepomanager.h"
+#include "libssu/ssureporesolver.h"
 #include "libssu/ssuvariables.h"
 
 #include "../constants.h"
@@ -22,23 +27,24 @@
  */
 
 
-SsuKickstarter::SsuKickstarter() {
+SsuKickstarter::SsuKickstarter(const SsuDeviceQuery &query): query(query) {
+  this->query.setInputs(&inputSet);
+
   SsuDeviceInfo deviceInfo;
   deviceModel = deviceInfo.deviceModel();
 
-  if ((ssu.deviceMode() & Ssu::RndMode) == Ssu::RndMode)
+  if ((SsuCoreConfig::instance()->deviceMode() & Ssu::RndMode) == Ssu::RndMode)
     rndMode = true;
   else
     rndMode = false;
 }
 
-QStringList SsuKickstarter::commands(){
-  SsuDeviceInfo deviceInfo(deviceModel);
+QStringList SsuKickstarter::commands() const {
   QStringList result;
 
   QHash<QString, QString> h;
 
-  deviceInfo.variableSection("kickstart-commands", &h);
+  query.variableSection(SsuDeviceQuery::BoardMappings, "var-kickstart-commands", &h);
 
   // read commands from variable, ...
 
@@ -53,21 +59,18 @@ QStringList SsuKickstarter::commands(){
 
 QStringList SsuKickstarter::commandSection(const QString &section, const QString &description){
   QStringList result;
-  SsuDeviceInfo deviceInfo(deviceModel);
-  QString commandFile;
-  QFile part;
+  SsuFragmentCache *fragments = SsuFragmentCache::instance();
 
   QDir dir(Sandbox::map(QString("/%1/kickstart/%2/")
                         .arg(SSU_DATA_DIR)
                         .arg(section)));
 
-  if (dir.exists(replaceSpaces(deviceModel.toLower())))
-    commandFile = replaceSpaces(deviceModel.toLower());
-  else if (dir.exists(replaceSpaces(deviceInfo.deviceVariant(true).toLower())))
-    commandFile = replaceSpaces(deviceInfo.deviceVariant(true).toLower());
-  else if (dir.exists("default"))
-    commandFile = "default";
-  else {
+  QString commandFile = fragments->find(dir.path(), QStringList()
+                                        << replaceSpaces(deviceModel.toLower())
+                                        << replaceSpaces(deviceVariant.toLower())
+                                        << "default");
+  inputSet.insert("directory:" + dir.path());
+  if (commandFile.isEmpty()){
     if (description.isEmpty())
       result.append("## No suitable configuration found in " + dir.path());
     else
@@ -75,18 +78,13 @@ QStringList SsuKickstarter::commandSection(const QString &section, const QString
     return result;
   }
 
-  QFile file(dir.path() + "/" + commandFile);
-
   if (description.isEmpty())
     result.append("### Commands from " + dir.path() + "/" + commandFile);
   else
     result.append("### " + description + " from " + commandFile);
 
-  if (file.open(QIODevice::ReadOnly | QIODevice::Text)){
-    QTextStream in(&file);
-    while (!in.atEnd())
-      result.append(in.readLine());
-  }
+  inputSet.insert("file:" + dir.path() + "/" + commandFile);
+  result.append(fragments->lines(dir.path() + "/" + commandFile));
 
   return result;
 }
@@ -96,14 +94,14 @@ QString SsuKickstarter::replaceSpaces(const QString &value){
   return retval.replace(" ", "_");
 }
 
-QStringList SsuKickstarter::repos(){
+QStringList SsuKickstarter::repos() const {
   QStringList result;
-  SsuDeviceInfo deviceInfo(deviceModel);
 
-  QStringList repos = deviceInfo.repos(rndMode, SsuRepoManager::BoardFilter);
+  QStringList repos = query.reposOf(deviceModel, rndMode, SsuRepoManager::BoardFilter);
+  SsuRepoResolver resolver(query, deviceModel, rndMode, repoOverride);
 
   foreach (const QString &repo, repos){
-    QString repoUrl = ssu.repoUrl(repo, rndMode, QHash<QString, QString>(), repoOverride);
+    QString repoUrl = resolver.url(repo);
     // Adaptation repos need to have separate naming so that when images are done
     // the repository caches will not be mixed with each other.
     if (repo.startsWith("adaptation")) {
@@ -127,7 +125,7 @@ QStringList SsuKickstarter::repos(){
   return result;
 }
 
-QStringList SsuKickstarter::packages(){
+QStringList SsuKickstarter::packages() const {
   QStringList result;
 
   // insert @vendor configuration device
@@ -148,6 +146,7 @@ QStringList SsuKickstarter::scriptletSection(QString name, const QString &sectio
   QStringList result;
   QString path;
   QDir dir;
+  SsuFragmentCache *fragments = SsuFragmentCache::instance();
 
   if (chroot)
     path = Sandbox::map(QString("/%1/kickstart/%2/")
@@ -159,17 +158,12 @@ QStringList SsuKickstarter::scriptletSection(QString name, const QString &sectio
       .arg(name));
 
   dir.setPath(path);
-  QStringList scriptlets = dir.entryList(QDir::AllEntries|QDir::NoDot|QDir::NoDotDot,
-                                         QDir::Name);
 
-  foreach (const QString &scriptlet, scriptlets){
-    QFile file(dir.filePath(scriptlet));
+  inputSet.insert("directory:" + dir.path());
+  foreach (const QString &scriptlet, fragments->entries(dir.path())){
+    inputSet.insert("file:" + dir.filePath(scriptlet));
     result.append("### begin " + scriptlet);
-    if (file.open(QIODevice::ReadOnly | QIODevice::Text)){
-      QTextStream in(&file);
-      while (!in.atEnd())
-        result.append(in.readLine());
-    }
+    result.append(fragments->lines(dir.filePath(scriptlet)));
     result.append("### end " + scriptlet);
   }
 
@@ -190,23 +184,18 @@ QStringList SsuKickstarter::scriptletSection(QString name, const QString &sectio
 void SsuKickstarter::setRepoParameters(QHash<QString, QString> parameters){
   repoOverride = parameters;
 
-  if (repoOverride.contains("model"))
+  // an empty model keeps the detected one, as it did for SsuDeviceInfo
+  if (!repoOverride.value("model").isEmpty())
     deviceModel = repoOverride.value("model");
 }
 
-bool SsuKickstarter::write(QString kickstart){
-  QFile ks;
-  QTextStream kout;
-  QTextStream qerr(stderr);
-  SsuDeviceInfo deviceInfo(deviceModel);
-  SsuRepoManager repoManager;
-  SsuVariables var;
-  QStringList commandSections;
-
+bool SsuKickstarter::prepare(QTextStream &log, QString kickstart){
   // initialize with default 'part' for compatibility, as partitions
   // used to work without configuration. It'll get replaced with
   // configuration values, if found
+  commandSections.clear();
   commandSections.append("part");
+  inputSet.clear();
 
   // rnd mode should not come from the defaults
   if (repoOverride.contains("rnd")){
@@ -219,15 +208,14 @@ bool SsuKickstarter::write(QString kickstart){
   QHash<QString, QString> defaults;
   // get generic repo variables; domain and adaptation specific bits are not interesting
   // in the kickstart
-  repoManager.repoVariables(&defaults, rndMode);
+  query.repoVariables(&defaults, rndMode);
 
   // overwrite with kickstart defaults
-  deviceInfo.variableSection("kickstart-defaults", &defaults);
-  if (deviceInfo.variable("kickstart-defaults", "commandSections")
-      .canConvert(QMetaType::QStringList)){
-    commandSections =
-      deviceInfo.variable("kickstart-defaults", "commandSections").toStringList();
-  }
+  query.variableSection(SsuDeviceQuery::BoardMappings, "var-kickstart-defaults", &defaults);
+  QVariant configuredSections = query.variable(SsuDeviceQuery::BoardMappings,
+                                               "var-kickstart-defaults", "commandSections");
+  if (configuredSections.canConvert(QMetaType::QStringList))
+    commandSections = configuredSections.toStringList();
 
   QHash<QString, QString>::const_iterator it = defaults.constBegin();
   while (it != defaults.constEnd()){
@@ -247,88 +235,185 @@ bool SsuKickstarter::write(QString kickstart){
 
   //TODO: check for mandatory keys, brand, ..
   if (!repoOverride.contains("deviceModel"))
-    repoOverride.insert("deviceModel", deviceInfo.deviceModel());
+    repoOverride.insert("deviceModel", deviceModel);
 
   // do sanity checking on the model
-  if (deviceInfo.contains() == false) {
-    qerr << "Device model '" << deviceInfo.deviceModel() << "' does not exist" << endl;
+  bool knownModel = query.contains(deviceModel);
+  if (!knownModel) {
+    log << "Device model '" << deviceModel << "' does not exist" << endl;
 
     if (repoOverride.value("force") != "true")
       return false;
   }
 
   QRegExp regex(" {2,}", Qt::CaseSensitive, QRegExp::RegExp2);
-  if (regex.indexIn(deviceInfo.deviceModel(), 0) != -1){
-    qerr << "Device model '" << deviceInfo.deviceModel()
-         << "' contains multiple consecutive spaces." << endl;
-    if (deviceInfo.contains())
-      qerr << "Since the model exists it looks like your configuration is broken." << endl;
+  if (regex.indexIn(deviceModel, 0) != -1){
+    log << "Device model '" << deviceModel
+        << "' contains multiple consecutive spaces." << endl;
+    if (knownModel)
+      log << "Since the model exists it looks like your configuration is broken." << endl;
     return false;
   }
 
   if (!repoOverride.contains("brand")){
-    qerr << "No brand set. Check your configuration." << endl;
+    log << "No brand set. Check your configuration." << endl;
     return false;
   }
 
-  bool opened = false;
   QString outputDir = repoOverride.value("outputdir");
   if (!outputDir.isEmpty()) outputDir.append("/");
 
   if (kickstart.isEmpty()){
     if (repoOverride.contains("filename")){
-      QString fileName = QString("%1%2")
+      fileName = QString("%1%2")
         .arg(outputDir)
-        .arg(replaceSpaces(var.resolveString(repoOverride.value("filename"),
-                                             &repoOverride)));
-
-      ks.setFileName(fileName);
-      opened = ks.open(QIODevice::WriteOnly);
+        .arg(replaceSpaces(SsuVariables::resolveString(repoOverride.value("filename"),
+                                                       &repoOverride)));
     } else {
-      qerr << "No filename specified, and no default filename configured" << endl;
+      log << "No filename specified, and no default filename configured" << endl;
       return false;
     }
   } else if (kickstart == "-")
+    fileName.clear();
+  else
+    fileName = outputDir + kickstart;
+
+  displayName = QString("# DisplayName: %1 %2/%3 (%4) %5")
+                        .arg(repoOverride.value("brand"))
+                        .arg(deviceModel)
+                        .arg(repoOverride.value("arch"))
+                        .arg((rndMode ? "rnd"
+                                      : "release"))
+                        .arg(repoOverride.value("version"));
+
+  deviceVariant = query.variantOf(deviceModel, true);
+  commandLines = commands();
+  repoLines = repos();
+  packageLines = packages();
+
+  return true;
+}
+
+bool SsuKickstarter::render(QTextStream &log){
+  QFile ks;
+  QTextStream kout;
+  bool opened = false;
+
+  if (fileName.isEmpty())
     opened = ks.open(stdout, QIODevice::WriteOnly);
   else {
-    ks.setFileName(outputDir + kickstart);
+    ks.setFileName(fileName);
     opened = ks.open(QIODevice::WriteOnly);
   }
 
   if (!opened) {
-    qerr << "Unable to write output file " << ks.fileName() << ": " << ks.errorString() << endl;
+    log << "Unable to write output file " << ks.fileName() << ": " << ks.errorString() << endl;
     return false;
   } else if (!ks.fileName().isEmpty())
-    qerr << "Writing kickstart to " << ks.fileName() << endl;
-
-  QString displayName = QString("# DisplayName: %1 %2/%3 (%4) %5")
-                                .arg(repoOverride.value("brand"))
-                                .arg(deviceInfo.deviceModel())
-                                .arg(repoOverride.value("arch"))
-                                .arg((rndMode ? "rnd"
-                                              : "release"))
-                                .arg(repoOverride.value("version"));
+    log << "Writing kickstart to " << ks.fileName() << endl;
 
   kout.setDevice(&ks);
-  kout << displayName << endl << endl;
-  kout << commands().join("\n") << endl << endl;
+  foreach (const QString &block, blocks())
+    kout << block << endl << endl;
+
+  // add flags as bitmask?
+  // POST, die-on-error
+
+  return true;
+}
+
+QStringList SsuKickstarter::blocks(){
+  QStringList result;
+
+  result.append(displayName);
+  result.append(commandLines.join("\n"));
   foreach (const QString &section, commandSections){
-    kout << commandSection(section).join("\n") << endl << endl;
+    result.append(commandSection(section).join("\n"));
   }
 
-  kout << repos().join("\n") << endl << endl;
-  kout << packages().join("\n") << endl << endl;
+  result.append(repoLines.join("\n"));
+  result.append(packageLines.join("\n"));
 
   QString sectionPrefix = QString("export SSU_RELEASE_TYPE=%1").arg(rndMode ? "rnd" : "release");
-  kout << scriptletSection("pre", sectionPrefix, true).join("\n") << endl << endl;
-  kout << scriptletSection("post", sectionPrefix, true).join("\n") << endl << endl;
-  kout << scriptletSection("post", sectionPrefix, false).join("\n") << endl << endl;
+  result.append(scriptletSection("pre", sectionPrefix, true).join("\n"));
+  result.append(scriptletSection("post", sectionPrefix, true).join("\n"));
+  result.append(scriptletSection("post", sectionPrefix, false).join("\n"));
   sectionPrefix.clear();
-  kout << scriptletSection("pack", sectionPrefix, true).join("\n") << endl << endl;
-  kout << scriptletSection("attachment", sectionPrefix, true).join("\n") << endl << endl;
+  result.append(scriptletSection("pack", sectionPrefix, true).join("\n"));
+  result.append(scriptletSection("attachment", sectionPrefix, true).join("\n"));
 
-  // add flags as bitmask?
-  // POST, die-on-error
+  return result;
+}
 
-  return true;
+QByteArray SsuKickstarter::parameterHash(const QString &kickstart) const {
+  QCryptographicHash hash(QCryptographicHash::Sha1);
+
+  QStringList parameters;
+  QHash<QString, QString>::const_iterator it = repoOverride.constBegin();
+  while (it != repoOverride.constEnd()){
+    parameters.append(it.key() + "=" + it.value());
+    it++;
+  }
+  parameters.sort();
+
+  hash.addData(QString("%1\n%2\n%3\n")
+               .arg(kickstart)
+               .arg(deviceModel)
+               .arg(rndMode ? "rnd" : "release").toUtf8());
+  hash.addData(parameters.join("\n").toUtf8());
+
+  return hash.result().toHex();
+}
+
+QStringList SsuKickstarter::inputs() const {
+  QStringList result;
+  foreach (const QString &input, inputSet)
+    result.append(input);
+  result.sort();
+  return result;
+}
+
+QByteArray SsuKickstarter::inputHash(const SsuDeviceQuery &query, const QStringList &inputs,
+                                     QHash<QString, QByteArray> *cache){
+  SsuFragmentCache *fragments = SsuFragmentCache::instance();
+  QCryptographicHash hash(QCryptographicHash::Sha1);
+
+  foreach (const QString &input, inputs){
+    QByteArray inputHash;
+    if (cache != 0 && cache->contains(input))
+      inputHash = cache->value(input);
+    else {
+      if (input.startsWith("file:")){
+        QString text = fragments->lines(input.mid(5)).join("\n");
+        inputHash = QCryptographicHash::hash(text.toUtf8(), QCryptographicHash::Sha1).toHex();
+      } else if (input.startsWith("directory:"))
+        inputHash = fragments->fingerprint(input.mid(10), 0);
+      else
+        inputHash = query.inputHash(input);
+
+      if (cache != 0)
+        cache->insert(input, inputHash);
+    }
+
+    // an input which can't be looked up any more always counts as changed
+    if (inputHash.isEmpty())
+      return QByteArray();
+
+    hash.addData(input.toUtf8() + "\n" + inputHash + "\n");
+  }
+
+  return hash.result().toHex();
+}
+
+QString SsuKickstarter::outputFile() const {
+  return fileName;
+}
+
+bool SsuKickstarter::write(QString kickstart){
+  QTextStream qerr(stderr);
+
+  if (!prepare(qerr, kickstart))
+    return false;
+
+  return render(qerr);
 }
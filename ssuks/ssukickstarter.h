@@ -11,27 +11,91 @@
 #include <QObject>
 #include <QSettings>
 #include <QHash>
+#include <QSet>
+#include <QTextStream>
 
-#include "libssu/ssudeviceinfo.h"
-#include "libssu/ssu.h"
+#include "libssu/ssudevicequery.h"
 
+/**
+ * Writing a kickstart is done in two steps: prepare() looks up everything
+ * needed from the configuration, render() writes the kickstart using only
+ * the prepared values and the kickstart sections on disk.
+ *
+ * Both read the configuration only from the SsuDeviceQuery the kickstarter
+ * was created with, and the kickstart sections through SsuFragmentCache.
+ * Kickstarters created from the same query may therefore be prepared and
+ * rendered in several threads at once, as long as each kickstarter is used
+ * from one thread at a time.
+ */
 class SsuKickstarter {
   public:
-    SsuKickstarter();
+    /**
+     * Create a kickstarter for the configuration in query. This detects the
+     * device model, and reads the device mode from SsuCoreConfig.
+     */
+    SsuKickstarter(const SsuDeviceQuery &query=SsuDeviceQuery());
     void setRepoParameters(QHash<QString, QString> parameters);
+    /**
+     * Resolve configuration and output file name for a kickstart, reporting
+     * errors to log
+     * @return false if no kickstart can be written for the parameters
+     */
+    bool prepare(QTextStream &log, QString kickstart="");
+    /**
+     * Write the prepared kickstart, reporting progress and errors to log
+     */
+    bool render(QTextStream &log);
+    /**
+     * Prepare and render a kickstart
+     */
     bool write(QString kickstart="");
+    /**
+     * Return a hash of the parameters of kickstart: the repository
+     * parameters, device model and mode. Needs to be called before
+     * prepare(), which adds the configured defaults to the parameters.
+     */
+    QByteArray parameterHash(const QString &kickstart="") const;
+    /**
+     * Return what prepare() and render() read, sorted: the lookups done
+     * through the query, as recorded by SsuDeviceQuery::setInputs(), and
+     * "file:" and "directory:" entries for the kickstart sections read
+     * through SsuFragmentCache
+     */
+    QStringList inputs() const;
+    /**
+     * Return a hash of the current content of inputs, as returned by
+     * inputs(), looking up configuration in query. Hashes of single inputs
+     * are kept in cache, if given, so inputs shared by several kickstarts
+     * are only hashed once.
+     */
+    static QByteArray inputHash(const SsuDeviceQuery &query, const QStringList &inputs,
+                                QHash<QString, QByteArray> *cache=0);
+    /**
+     * Return the file the kickstart is written to, or an empty string for stdout
+     */
+    QString outputFile() const;
 
   private:
+    SsuKickstarter(const SsuKickstarter &); // hide copy constructor
+    SsuKickstarter &operator=(const SsuKickstarter &);
+
+    /// query records into inputSet, so copies would record into the wrong set
+    SsuDeviceQuery query;
+    QSet<QString> inputSet;
     QHash<QString, QString> repoOverride;
-    Ssu ssu;
     bool rndMode;
-    QString deviceModel;
-    QStringList commands();
+    QString deviceModel, deviceVariant;
+    /// Results of prepare(); an empty fileName writes to stdout
+    QString fileName, displayName;
+    QStringList commandSections, commandLines, repoLines, packageLines;
+    /// Text blocks making up the kickstart, separated by empty lines
+    QStringList blocks();
+    QStringList commands() const;
     /// read a command section from file system
     QStringList commandSection(const QString &section, const QString &description="");
-    QStringList packages();
-    QString replaceSpaces(const QString &value);
-    QStringList repos();
+    QStringList packages() const;
+    static QString replaceSpaces(const QString &value);
+    QStringList repos() const;
     QStringList scriptletSection(QString name, const QString &sectionPrefix, bool chroot=true);
 };
 
@@ -12,13 +12,25 @@
 #include <QTimer>
 #include <QStringList>
 #include <QDirIterator>
+#include <QFileInfo>
+#include <QElapsedTimer>
+#include <QRunnable>
+#include <QThreadPool>
 
 #include "ssukickstarter.h"
+#include "ssuksmanifest.h"
 #include "constants.h"
 #include "libssu/sandbox_p.h"
+#include "libssu/ssudevicequery.h"
 
 #include "ssuks.h"
 
+// directory holding the manifest for kickstarts written with parameters
+static QString outputDirectory(const QHash<QString, QString> &parameters){
+  QString directory = parameters.value("outputdir");
+  return QFileInfo(directory.isEmpty() ? QString(".") : directory).absoluteFilePath();
+}
+
 void SsuKs::run(){
   QStringList arguments = QCoreApplication::arguments();
   // get rid of the binary name
@@ -39,14 +51,9 @@ void SsuKs::run(){
     arguments.removeFirst();
   }
 
-  for (int i=0; i<arguments.count(); i++){
-    if (arguments.at(i).count("=") != 1){
-      qout << "Invalid flag: " << arguments.at(i) << endl;
-      QCoreApplication::exit(1);
-      return;
-    }
-    QStringList split = arguments.at(i).split("=");
-    repoParameters.insert(split.at(0), split.at(1));
+  if (!addFlags(arguments, &repoParameters)){
+    QCoreApplication::exit(1);
+    return;
   }
 
   QString sandbox;
@@ -69,18 +76,334 @@ void SsuKs::run(){
       return;
     }
 
-    // force re-merge of settings
+    // the merged board mappings copied from the host would shadow the
+    // sandbox board-mappings.d; without it only the layers get read
     QFile::remove(Sandbox::map(SSU_BOARD_MAPPING_CONFIGURATION));
-    SsuSettings(SSU_BOARD_MAPPING_CONFIGURATION, SSU_BOARD_MAPPING_CONFIGURATION_DIR);
   }
 
+  QString matrix = repoParameters.take("matrix");
+  int jobs = repoParameters.take("jobs").toInt();
+  bool incremental = repoParameters.take("incremental") == "true";
+  QList<QHash<QString, QString> > targets;
+
+  if (!matrix.isEmpty()){
+    if (!readMatrix(matrix, repoParameters, &targets)){
+      QCoreApplication::exit(1);
+      return;
+    }
+  } else
+    targets.append(repoParameters);
+
+  if (matrix.isEmpty() && repoParameters.value("model") != "all"){
+    SsuKsManifest manifest;
+    SsuDeviceQuery query;
+    SsuKickstarter kickstarter(query);
+    kickstarter.setRepoParameters(repoParameters);
+
+    // parameters are hashed before prepare(), so an unchanged kickstart
+    // only needs the lookups it recorded on the last run
+    QString directory = outputDirectory(repoParameters);
+    QByteArray parameterHash;
+    if (incremental && fileName != "-"){
+      parameterHash = kickstarter.parameterHash(fileName);
+      SsuKsManifest::Entry entry;
+      QString existing = manifest.find(directory, parameterHash, &entry);
+      if (!existing.isEmpty() &&
+          SsuKickstarter::inputHash(query, entry.inputs) == entry.inputHash){
+        qerr << "Kickstart " << existing << " is up to date" << endl;
+        QCoreApplication::exit(0);
+        return;
+      }
+    }
+
+    if (!kickstarter.prepare(qerr, fileName) || !kickstarter.render(qerr)){
+      QCoreApplication::exit(1);
+      return;
+    }
+
+    if (!parameterHash.isEmpty() && !kickstarter.outputFile().isEmpty()){
+      QStringList inputs = kickstarter.inputs();
+      manifest.record(directory, kickstarter.outputFile(), parameterHash, inputs,
+                      SsuKickstarter::inputHash(query, inputs));
+      manifest.save();
+    }
+    QCoreApplication::exit(0);
+    return;
+  }
+
+  if (!fileName.isEmpty()){
+    qerr << "A file name can't be used for multiple kickstarts, use the filename flag" << endl;
+    QCoreApplication::exit(1);
+    return;
+  }
+
+  QCoreApplication::exit(!writeAll(targets, repoParameters, jobs, incremental));
+}
+
+bool SsuKs::addFlags(const QStringList &flags, QHash<QString, QString> *parameters){
+  QTextStream qout(stdout);
+
+  foreach (const QString &flag, flags){
+    if (flag.count("=") != 1){
+      qout << "Invalid flag: " << flag << endl;
+      return false;
+    }
+    QStringList split = flag.split("=");
+    parameters->insert(split.at(0), split.at(1));
+  }
+
+  return true;
+}
+
+bool SsuKs::readMatrix(const QString &fileName, const QHash<QString, QString> &parameters,
+                       QList<QHash<QString, QString> > *targets){
+  QTextStream qerr(stderr);
+  QFile file(fileName);
+
+  if (!file.open(QIODevice::ReadOnly | QIODevice::Text)){
+    qerr << "Unable to read matrix file " << fileName << ": " << file.errorString() << endl;
+    return false;
+  }
+
+  // these apply to the whole run, and are only taken from the command line
+  static const QStringList runFlags = QStringList()
+    << "sandbox" << "matrix" << "jobs" << "incremental";
+
+  QTextStream in(&file);
+  int lineNumber = 0;
+  while (!in.atEnd()){
+    QString line = in.readLine().trimmed();
+    lineNumber++;
+    if (line.isEmpty() || line.startsWith("#"))
+      continue;
+
+    QStringList flags = line.split(QRegExp("\\s+"), QString::SkipEmptyParts);
+    foreach (const QString &flag, flags){
+      if (flag.count("=") != 1){
+        qerr << QString("%1:%2: Invalid flag: %3").arg(fileName).arg(lineNumber).arg(flag) << endl;
+        return false;
+      }
+
+      if (runFlags.contains(flag.section('=', 0, 0))){
+        qerr << QString("%1:%2: %3 can only be set on the command line")
+          .arg(fileName)
+          .arg(lineNumber)
+          .arg(flag.section('=', 0, 0)) << endl;
+        return false;
+      }
+    }
+
+    QHash<QString, QString> target = parameters;
+    addFlags(flags, &target);
+    targets->append(target);
+  }
+
+  return true;
+}
+
+struct KickstartTarget {
+  KickstartTarget(const SsuDeviceQuery &query):
+    kickstarter(query), prepared(false), written(false), skipped(false), elapsed(0){}
+
+  QHash<QString, QString> parameters;
+  /// Flags describing this kickstart in the output
+  QString flags;
+  /// Messages from preparing and rendering, printed once all kickstarts are done
+  QString log;
   SsuKickstarter kickstarter;
-  kickstarter.setRepoParameters(repoParameters);
-  QCoreApplication::exit(!kickstarter.write(fileName));
-  return;
+  /// Hash of the parameters, only set with incremental
+  QByteArray parameterHash;
+  /**
+   * File the kickstart is written to, empty for stdout. With incremental it
+   * is the file from the manifest while the kickstart is up to date
+   */
+  QString outputFile;
+  bool prepared, written, skipped;
+  qint64 elapsed;
+};
+
+class KickstartJob: public QRunnable {
+  public:
+    enum Step {
+      Prepare,
+      Render
+    };
+
+    KickstartJob(KickstartTarget *target, Step step): target(target), step(step){}
+
+    void run(){
+      QElapsedTimer timer;
+      timer.start();
+      QTextStream log(&target->log);
+      if (step == Prepare)
+        target->prepared = target->kickstarter.prepare(log);
+      else
+        target->written = target->kickstarter.render(log);
+      target->elapsed += timer.elapsed();
+    }
+
+  private:
+    KickstartTarget *target;
+    Step step;
+};
+
+bool SsuKs::writeAll(const QList<QHash<QString, QString> > &targets,
+                     const QHash<QString, QString> &parameters, int jobs,
+                     bool incremental){
+  SsuKsManifest manifest;
+  QTextStream qerr(stderr);
+  QList<KickstartTarget*> kickstarts;
 
+  // the configuration is copied once, and all kickstarts are prepared and
+  // rendered from that copy
+  SsuDeviceQuery query;
+
+  foreach (QHash<QString, QString> target, targets){
+    QStringList models;
+    if (target.value("model") == "all")
+      models = query.models();
+    else
+      models.append(target.value("model"));
+
+    foreach (const QString &model, models){
+      KickstartTarget *kickstart = new KickstartTarget(query);
+      kickstart->parameters = target;
+      if (target.contains("model"))
+        kickstart->parameters.insert("model", model);
+      kickstarts.append(kickstart);
+    }
+  }
+
+  QElapsedTimer total;
+  total.start();
+
+  QThreadPool pool;
+  if (jobs > 0)
+    pool.setMaxThreadCount(jobs);
+
+  // output files already taken by a kickstart, with the flags describing it
+  QHash<QString, QString> outputs;
+  // hashes of the inputs, most of them are shared by all kickstarts
+  QHash<QString, QByteArray> inputCache;
+
+  foreach (KickstartTarget *kickstart, kickstarts){
+    // describe each kickstart by the flags set for it only
+    QStringList flags;
+    QHash<QString, QString>::const_iterator it = kickstart->parameters.constBegin();
+    while (it != kickstart->parameters.constEnd()){
+      if (!parameters.contains(it.key()) || parameters.value(it.key()) != it.value())
+        flags.append(it.key() + "=" + it.value());
+      it++;
+    }
+    flags.sort();
+    kickstart->flags = flags.join(" ");
+    kickstart->kickstarter.setRepoParameters(kickstart->parameters);
+
+    // the manifest and the input hashes are only used from this thread
+    if (incremental){
+      QElapsedTimer timer;
+      timer.start();
+      kickstart->parameterHash = kickstart->kickstarter.parameterHash();
+      SsuKsManifest::Entry entry;
+      QString existing = manifest.find(outputDirectory(kickstart->parameters),
+                                       kickstart->parameterHash, &entry);
+      bool upToDate = !existing.isEmpty() &&
+        SsuKickstarter::inputHash(query, entry.inputs, &inputCache) == entry.inputHash;
+      kickstart->elapsed = timer.elapsed();
+      if (upToDate){
+        kickstart->outputFile = existing;
+        kickstart->skipped = true;
+        continue;
+      }
+    }
 
-  QCoreApplication::exit(0);
+    pool.start(new KickstartJob(kickstart, KickstartJob::Prepare));
+  }
+
+  pool.waitForDone();
+
+  // output files are only known once the kickstarts are prepared. All of
+  // them, including the ones up to date, are claimed in one pass in the
+  // order of the targets, so the same kickstart gets a file on every run,
+  // independent of the order preparing finished in; only the kickstarts for
+  // stdout are rendered one after the other at the end
+  QList<KickstartTarget*> toStdout;
+
+  foreach (KickstartTarget *kickstart, kickstarts){
+    QString outputFile;
+    if (kickstart->skipped)
+      outputFile = kickstart->outputFile;
+    else if (kickstart->prepared)
+      outputFile = kickstart->kickstarter.outputFile();
+    else
+      continue;
+
+    QTextStream log(&kickstart->log);
+    if (!outputFile.isEmpty() && outputs.contains(outputFile)){
+      log << QString("%1 is already written for %2, set a different filename")
+        .arg(outputFile)
+        .arg(outputs.value(outputFile)) << endl;
+      kickstart->skipped = false;
+      continue;
+    }
+
+    kickstart->outputFile = outputFile;
+    if (kickstart->skipped){
+      log << "Kickstart " << outputFile << " is up to date" << endl;
+      outputs.insert(outputFile, kickstart->flags);
+      kickstart->written = true;
+    } else if (outputFile.isEmpty())
+      toStdout.append(kickstart);
+    else {
+      outputs.insert(outputFile, kickstart->flags);
+      pool.start(new KickstartJob(kickstart, KickstartJob::Render));
+    }
+  }
+
+  pool.waitForDone();
+
+  foreach (KickstartTarget *kickstart, toStdout){
+    KickstartJob job(kickstart, KickstartJob::Render);
+    job.run();
+  }
+
+  // report in the order of the targets, independent of the order rendering
+  // finished in
+  int failed = 0, skipped = 0;
+  foreach (KickstartTarget *kickstart, kickstarts){
+    QString status = "Generated";
+    if (!kickstart->written){
+      status = "Failed";
+      failed++;
+    } else if (kickstart->skipped){
+      status = "Skipped";
+      skipped++;
+    } else if (incremental && !kickstart->outputFile.isEmpty()){
+      QStringList inputs = kickstart->kickstarter.inputs();
+      manifest.record(outputDirectory(kickstart->parameters),
+                      kickstart->outputFile, kickstart->parameterHash,
+                      inputs, SsuKickstarter::inputHash(query, inputs, &inputCache));
+    }
+
+    qerr << kickstart->log;
+    qerr << QString("%1 %2 in %3 ms")
+      .arg(status)
+      .arg(kickstart->flags)
+      .arg(kickstart->elapsed) << endl;
+  }
+
+  if (incremental)
+    manifest.save();
+
+  qerr << QString("Generated %1 of %2 kickstarts (%3 unchanged) in %4 ms using %5 threads")
+    .arg(kickstarts.count() - failed - skipped)
+    .arg(kickstarts.count())
+    .arg(skipped)
+    .arg(total.elapsed())
+    .arg(pool.maxThreadCount()) << endl;
+
+  qDeleteAll(kickstarts);
+  return failed == 0;
 }
 
 void SsuKs::usage(){
@@ -90,6 +413,21 @@ void SsuKs::usage(){
        << "Flags are in the form key=value. 'model', 'force', 'rnd' and 'sandbox' keys have special meanings." << endl
        << "To do a kickstart for N9 do 'ssuks model=N9'" << endl
        << "To force generating a kickstart for a non-existant device add force=true" << endl
+       << endl
+       << "Several kickstarts can be written in one run, using the filename configured" << endl
+       << "in the kickstart defaults, or set with the filename flag:" << endl
+       << "  model=all    -- write a kickstart for each model in the board mappings" << endl
+       << "  matrix=file  -- write a kickstart for each line of file; a line contains" << endl
+       << "                  flags separated by whitespace, overriding the ones given" << endl
+       << "                  on the command line. model=all may be used in the file," << endl
+       << "                  sandbox, matrix, jobs and incremental may not." << endl
+       << "  jobs=n       -- number of kickstarts to write in parallel; defaults to" << endl
+       << "                  the number of CPUs" << endl
+       << "  incremental=true" << endl
+       << "               -- record the configuration and kickstart sections read for" << endl
+       << "                  each kickstart, and the written file, in .ssuks-manifest" << endl
+       << "                  in the output directory, and skip kickstarts whose" << endl
+       << "                  parameters, inputs and file are unchanged since the last run" << endl
        << endl;
   qout.flush();
   QCoreApplication::exit(1);
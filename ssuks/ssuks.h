@@ -10,6 +10,8 @@
 
 #include <QObject>
 #include <QDebug>
+#include <QHash>
+#include <QStringList>
 
 class SsuKs: public QObject {
     Q_OBJECT
@@ -21,6 +23,22 @@ class SsuKs: public QObject {
     void run();
 
   private:
+    /// Add key=value flags to parameters; returns false on invalid flags
+    bool addFlags(const QStringList &flags, QHash<QString, QString> *parameters);
+    /// Read one set of parameters per line of a matrix file
+    bool readMatrix(const QString &fileName, const QHash<QString, QString> &parameters,
+                    QList<QHash<QString, QString> > *targets);
+    /**
+     * Write a kickstart for each of targets, expanding model=all, using up
+     * to jobs threads (or one per CPU, if jobs is 0). With incremental set
+     * kickstarts are recorded in the manifest of their output directory with
+     * the inputs they read, and skipped before preparing them if parameters,
+     * the content of those inputs and the written file are unchanged since
+     * the last run.
+     */
+    bool writeAll(const QList<QHash<QString, QString> > &targets,
+                  const QHash<QString, QString> &parameters, int jobs=0,
+                  bool incremental=false);
     void usage();
 };
 
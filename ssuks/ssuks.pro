@@ -3,6 +3,10 @@ include(../ssuapplication.pri)
 include(ssuks_dependencies.pri)
 
 HEADERS = ssuks.h \
-        ssukickstarter.h
+        ssufragmentcache.h \
+        ssukickstarter.h \
+        ssuksmanifest.h
 SOURCES = ssuks.cpp \
-          ssukickstarter.cpp
+          ssufragmentcache.cpp \
+          ssukickstarter.cpp \
+          ssuksmanifest.cpp
@@ -0,0 +1,172 @@
+/**
+ * @file ssuksmanifest.cpp
+ * @copyright 2013 Jolla Ltd.
+ * @author Bernd Wachter <bwachter@lart.info>
+ * @date 2013
+ */
+
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QStringList>
+#include <QTextStream>
+
+#include <stdio.h>
+
+#include "ssuksmanifest.h"
+
+#define SSUKS_MANIFEST ".ssuks-manifest"
+
+QString SsuKsManifest::find(const QString &directory, const QByteArray &parameterHash,
+                           Entry *entry){
+  if (parameterHash.isEmpty())
+    return QString();
+
+  QString path = QFileInfo(directory).absoluteFilePath();
+  QHash<QString, Entry> &entries = manifest(path);
+  QHash<QString, Entry>::iterator it = entries.begin();
+  while (it != entries.end()){
+    if (it->parameterHash == parameterHash){
+      // the entry no longer describes the file; if the kickstart is
+      // written again it gets recorded anew
+      if (hashFile(it.key()) != it->outputHash){
+        entries.erase(it);
+        changed.insert(path);
+        return QString();
+      }
+
+      *entry = *it;
+      return it.key();
+    }
+    it++;
+  }
+
+  return QString();
+}
+
+void SsuKsManifest::record(const QString &directory, const QString &fileName,
+                           const QByteArray &parameterHash, const QStringList &inputs,
+                           const QByteArray &inputHash){
+  QString path = QFileInfo(directory).absoluteFilePath();
+  QHash<QString, Entry> &entries = manifest(path);
+
+  Entry entry;
+  entry.parameterHash = parameterHash;
+  entry.inputHash = inputHash;
+  entry.outputHash = hashFile(fileName);
+  entry.inputs = inputs;
+
+  // a kickstart which can't be read back is never up to date
+  if (parameterHash.isEmpty() || inputHash.isEmpty() || entry.outputHash.isEmpty())
+    return;
+
+  entries.insert(QFileInfo(fileName).absoluteFilePath(), entry);
+  changed.insert(path);
+}
+
+bool SsuKsManifest::save(){
+  QTextStream qerr(stderr);
+  bool result = true;
+
+  foreach (const QString &directory, changed){
+    QString manifestFile = QDir(directory).filePath(SSUKS_MANIFEST);
+    QFile file(manifestFile + ".tmp");
+
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)){
+      qerr << "Unable to write " << file.fileName() << ": " << file.errorString() << endl;
+      result = false;
+      continue;
+    }
+
+    const QHash<QString, Entry> &entries = manifests[directory];
+    QStringList fileNames = entries.keys();
+    fileNames.sort();
+
+    bool written = true;
+    foreach (const QString &fileName, fileNames){
+      const Entry &entry = entries[fileName];
+      QByteArray line = entry.parameterHash + " " + entry.inputHash + " " +
+        entry.outputHash + "  " + QFile::encodeName(fileName) + "\n";
+      foreach (const QString &input, entry.inputs)
+        line += "\t" + input.toUtf8() + "\n";
+      written = written && file.write(line) == line.size();
+    }
+
+    written = written && file.flush();
+    file.close();
+
+    // rename() replaces the old manifest atomically, QFile::rename()
+    // refuses to overwrite it
+    if (!written || ::rename(QFile::encodeName(file.fileName()).constData(),
+                             QFile::encodeName(manifestFile).constData()) != 0){
+      qerr << "Unable to write " << manifestFile << endl;
+      file.remove();
+      result = false;
+    }
+  }
+
+  changed.clear();
+  return result;
+}
+
+QByteArray SsuKsManifest::hashFile(const QString &fileName){
+  QFile file(fileName);
+  if (!file.open(QIODevice::ReadOnly))
+    return QByteArray();
+
+  QCryptographicHash hash(QCryptographicHash::Sha1);
+  while (!file.atEnd())
+    hash.addData(file.read(64 * 1024));
+
+  return hash.result().toHex();
+}
+
+QHash<QString, SsuKsManifest::Entry> &SsuKsManifest::manifest(const QString &directory){
+  if (manifests.contains(directory))
+    return manifests[directory];
+
+  QHash<QString, Entry> &entries = manifests[directory];
+  QFile file(QDir(directory).filePath(SSUKS_MANIFEST));
+
+  if (file.open(QIODevice::ReadOnly)){
+    // inputs follow the line of their kickstart
+    Entry *entry = 0;
+
+    while (!file.atEnd()){
+      QByteArray line = file.readLine();
+      line.chop(line.endsWith('\n') ? 1 : 0);
+
+      if (line.startsWith('\t')){
+        if (entry != 0)
+          entry->inputs.append(QString::fromUtf8(line.mid(1)));
+        continue;
+      }
+
+      // parameter hash, input hash, output hash and file name; malformed
+      // lines are dropped
+      entry = 0;
+      int separator = line.indexOf("  ");
+      QList<QByteArray> hashes = line.left(separator).split(' ');
+      if (separator <= 0 || hashes.count() != 3 ||
+          hashes.at(0).isEmpty() || hashes.at(1).isEmpty() || hashes.at(2).isEmpty())
+        continue;
+
+      // kickstarts deleted since are dropped, which also drops the entries
+      // of targets no longer written to this directory with them
+      QString fileName = QFile::decodeName(line.mid(separator + 2));
+      if (!QFileInfo(fileName).exists()){
+        changed.insert(directory);
+        continue;
+      }
+
+      entry = &entries[fileName];
+      entry->parameterHash = hashes.at(0);
+      entry->inputHash = hashes.at(1);
+      entry->outputHash = hashes.at(2);
+      entry->inputs.clear();
+    }
+  }
+
+  return entries;
+}
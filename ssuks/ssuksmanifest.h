@@ -0,0 +1,74 @@
+/**
+ * @file ssuksmanifest.h
+ * @copyright 2013 Jolla Ltd.
+ * @author Bernd Wachter <bwachter@lart.info>
+ * @date 2013
+ */
+
+#ifndef _SSUKSMANIFEST_H
+#define _SSUKSMANIFEST_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+
+/**
+ * Kickstarts written by incremental runs of ssuks
+ *
+ * Each output directory has a file named .ssuks-manifest with one line per
+ * kickstart: the hash of its parameters, the hash of the inputs it read,
+ * the hash of the written file, and the file name, followed by one line per
+ * input, indented with a tab. A kickstart is only up to date while its
+ * inputs hash the same, and the file still has the recorded content, so
+ * edited or truncated kickstarts are written again.
+ *
+ * Manifests are read when a directory is first looked up, and written by
+ * save(). Entries are kept by file name, so there is at most one per
+ * kickstart in the directory. Entries of deleted kickstarts are dropped
+ * when the manifest is read, and entries of modified ones when they are
+ * found, so the next save() removes them from the file.
+ */
+class SsuKsManifest {
+  public:
+    struct Entry {
+      QByteArray parameterHash, inputHash, outputHash;
+      /// The inputs, as returned by SsuKickstarter::inputs()
+      QStringList inputs;
+    };
+
+    /**
+     * Return the kickstart recorded in directory for parameterHash, if it
+     * still has the content it was written with, or an empty string. The
+     * recorded entry is returned in entry, for checking the inputs. An entry
+     * whose kickstart changed is dropped.
+     */
+    QString find(const QString &directory, const QByteArray &parameterHash, Entry *entry);
+    /**
+     * Record fileName in directory as written for parameterHash from inputs
+     * with inputHash, hashing its current content
+     */
+    void record(const QString &directory, const QString &fileName,
+                const QByteArray &parameterHash, const QStringList &inputs,
+                const QByteArray &inputHash);
+    /**
+     * Write all manifests changed by record(). Each manifest is written to a
+     * temporary file next to it first, and renamed over the old one.
+     */
+    bool save();
+    /**
+     * Return the hash of the content of fileName, or an empty QByteArray if
+     * it can't be read
+     */
+    static QByteArray hashFile(const QString &fileName);
+
+  private:
+    /// Entries by directory and absolute file name
+    QHash<QString, QHash<QString, Entry> > manifests;
+    QSet<QString> changed;
+
+    QHash<QString, Entry> &manifest(const QString &directory);
+};
+
+#endif
@@ -27,7 +27,10 @@ int main(int argc, char** argv){
   QNetworkProxyFactory::setUseSystemConfiguration(true);
 
   SsuUrlResolver mw;
-  QTimer::singleShot(0, &mw, SLOT(run()));
+  if (app.arguments().contains("--daemon"))
+    QTimer::singleShot(0, &mw, SLOT(runDaemon()));
+  else
+    QTimer::singleShot(0, &mw, SLOT(run()));
 
   return app.exec();
 }
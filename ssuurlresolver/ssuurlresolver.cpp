@@ -8,31 +8,59 @@
 #include "ssuurlresolver.h"
 
 #include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
 #include <QFileInfo>
+#include <QLocalServer>
+#include <QLocalSocket>
 #include <QStringList>
+#include <systemd/sd-daemon.h>
 #include <systemd/sd-journal.h>
 
+#include <sstream>
+
+#include "libssu/ssucoreconfig.h"
 #include "libssu/ssulog.h"
+#include "libssu/sandbox_p.h"
+
+#include "../constants.h"
 
-SsuUrlResolver::SsuUrlResolver(): QObject(){
+// frames are a few hundred bytes; anything much larger is garbage
+static const int maxFrameSize = 64 * 1024;
+
+SsuUrlResolver::SsuUrlResolver(): QObject(), ssu(0), server(0), busy(false){
   QObject::connect(this,SIGNAL(done()),
                    QCoreApplication::instance(),SLOT(quit()),
                    Qt::QueuedConnection);
+
+  idleTimer.setSingleShot(true);
+  idleTimer.setInterval(SSU_URLRESOLVER_IDLE_TIMEOUT);
+  connect(&idleTimer, SIGNAL(timeout()), this, SIGNAL(done()));
 }
 
-void SsuUrlResolver::error(QString message){
+SsuUrlResolver::~SsuUrlResolver(){
+  delete ssu;
+}
+
+Ssu *SsuUrlResolver::ssuInstance(){
+  if (ssu == 0)
+    ssu = new Ssu();
+
+  return ssu;
+}
+
+PluginFrame SsuUrlResolver::error(QString message){
   SsuLog *ssuLog = SsuLog::instance();
   ssuLog->print(LOG_WARNING, message);
 
   PluginFrame out("ERROR");
   out.setBody(message.toStdString());
-  out.writeTo(std::cout);
-  QCoreApplication::exit(1);
+  return out;
 }
 
 bool SsuUrlResolver::writeCredentials(QString filePath, QString credentialsScope){
   QFile credentialsFile(filePath);
-  QPair<QString, QString> credentials = ssu.credentials(credentialsScope);
+  QPair<QString, QString> credentials = ssuInstance()->credentials(credentialsScope);
   SsuLog *ssuLog = SsuLog::instance();
 
   if (credentials.first == "" || credentials.second == ""){
@@ -46,7 +74,7 @@ bool SsuUrlResolver::writeCredentials(QString filePath, QString credentialsScope
   }
 
   QTextStream out(&credentialsFile);
-  out << "[" << ssu.credentialsUrl(credentialsScope) << "]\n";
+  out << "[" << ssuInstance()->credentialsUrl(credentialsScope) << "]\n";
   out << "username=" << credentials.first << "\n";
   out << "password=" << credentials.second << "\n";
   out.flush();
@@ -54,17 +82,15 @@ bool SsuUrlResolver::writeCredentials(QString filePath, QString credentialsScope
   return true;
 }
 
-void SsuUrlResolver::run(){
+PluginFrame SsuUrlResolver::resolve(const PluginFrame &in){
   QHash<QString, QString> repoParameters;
   QString resolvedUrl, repo;
   bool isRnd = false;
   SsuLog *ssuLog = SsuLog::instance();
+  Ssu *ssu = ssuInstance();
 
-  PluginFrame in(std::cin);
-
-  if (in.headerEmpty()){
-    error("Received empty header list. Most likely your ssu setup is broken");
-  }
+  if (in.headerEmpty())
+    return error("Received empty header list. Most likely your ssu setup is broken");
 
   PluginFrame::HeaderListIterator it;
   QStringList headerList;
@@ -97,39 +123,38 @@ void SsuUrlResolver::run(){
     }
   }
 
-  if (!ssu.useSslVerify())
+  if (!ssu->useSslVerify())
     headerList.append("ssl_verify=no");
 
-  if (ssu.isRegistered()){
+  if (ssu->isRegistered()){
     SignalWait w;
-    connect(&ssu, SIGNAL(done()), &w, SLOT(finished()));
-    ssu.updateCredentials();
+    connect(ssu, SIGNAL(done()), &w, SLOT(finished()));
+    ssu->updateCredentials();
     w.sleep();
 
     // error can be found in ssu.log, so just exit
     // TODO: figure out if there's better eror handling for
     //       zypper plugins than 'blow up'
-    if (ssu.error()){
-      error(ssu.lastError());
-    }
+    if (ssu->error())
+      return error(ssu->lastError());
   } else
     ssuLog->print(LOG_DEBUG, "Device not registered -- skipping credential update");
 
   // resolve base url
-  resolvedUrl = ssu.repoUrl(repo, isRnd, repoParameters);
+  resolvedUrl = ssu->repoUrl(repo, isRnd, repoParameters);
 
   // only do credentials magic on secure connections
-  if (resolvedUrl.startsWith("https://") && ssu.isRegistered()){
+  if (resolvedUrl.startsWith("https://") && ssu->isRegistered()){
     // TODO: check for credentials scope required for repository; check if the file exists;
     //       compare with configuration, and dump credentials to file if necessary
     ssuLog->print(LOG_DEBUG, QString("Requesting credentials for '%1' with RND status %2...").arg(repo).arg(isRnd));
-    QString credentialsScope = ssu.credentialsScope(repo, isRnd);
+    QString credentialsScope = ssu->credentialsScope(repo, isRnd);
     if (!credentialsScope.isEmpty()){
       headerList.append(QString("credentials=%1").arg(credentialsScope));
 
       QFileInfo credentialsFileInfo("/etc/zypp/credentials.d/" + credentialsScope);
       if (!credentialsFileInfo.exists() ||
-          credentialsFileInfo.lastModified() <= ssu.lastCredentialsUpdate()){
+          credentialsFileInfo.lastModified() <= ssu->lastCredentialsUpdate()){
         writeCredentials(credentialsFileInfo.filePath(), credentialsScope);
       }
     } else
@@ -147,15 +172,275 @@ void SsuUrlResolver::run(){
   //       is protected, but device is not registered and/or we don't have credentials
   ssuLog->print(LOG_INFO, QString("%1 resolved to %2").arg(repo).arg(resolvedUrl));
 
-  if (resolvedUrl.isEmpty()){
-    error("URL for repository is not set.");
-  } else if (resolvedUrl.indexOf(QRegExp("[a-z]*://", Qt::CaseInsensitive)) != 0) {
-    error ("URL for repository is invalid.");
+  if (resolvedUrl.isEmpty())
+    return error("URL for repository is not set.");
+  else if (resolvedUrl.indexOf(QRegExp("[a-z]*://", Qt::CaseInsensitive)) != 0)
+    return error("URL for repository is invalid.");
+
+  PluginFrame out("RESOLVEDURL");
+  out.setBody(resolvedUrl.toStdString());
+  return out;
+}
+
+QByteArray SsuUrlResolver::serializeFrame(const PluginFrame &frame){
+  std::ostringstream stream;
+  frame.writeTo(stream);
+  const std::string data = stream.str();
+  return QByteArray(data.data(), data.size());
+}
+
+bool SsuUrlResolver::parseFrame(const QByteArray &data, PluginFrame *frame){
+  std::istringstream stream(std::string(data.constData(), data.size()));
+
+  try {
+    *frame = PluginFrame(stream);
+  } catch (const zypp::Exception &e){
+    SsuLog::instance()->print(LOG_WARNING,
+                              QString("Unable to parse frame: %1")
+                              .arg(QString::fromStdString(e.asString())));
+    return false;
+  }
+
+  return true;
+}
+
+QByteArray SsuUrlResolver::readFrame(QLocalSocket *socket, int timeout){
+  QByteArray data;
+  QElapsedTimer timer;
+  timer.start();
+
+  forever {
+    int end = data.indexOf('\0');
+    if (end != -1)
+      return data.left(end + 1);
+
+    if (data.size() > maxFrameSize)
+      return QByteArray();
+
+    int remaining = timeout - timer.elapsed();
+    if (remaining <= 0)
+      return QByteArray();
+
+    if (socket->bytesAvailable() == 0 && !socket->waitForReadyRead(remaining))
+      return QByteArray();
+
+    data.append(socket->readAll());
+  }
+}
+
+bool SsuUrlResolver::forward(const PluginFrame &in, PluginFrame *out){
+  QLocalSocket socket;
+
+  socket.connectToServer(Sandbox::map(SSU_URLRESOLVER_SOCKET));
+  if (!socket.waitForConnected(SSU_URLRESOLVER_FORWARD_TIMEOUT))
+    return false;
+
+  socket.write(serializeFrame(in));
+  while (socket.bytesToWrite() > 0)
+    if (!socket.waitForBytesWritten(SSU_URLRESOLVER_FORWARD_TIMEOUT))
+      return false;
+
+  QByteArray reply = readFrame(&socket, SSU_URLRESOLVER_TIMEOUT);
+  if (reply.isEmpty()){
+    SsuLog::instance()->print(LOG_WARNING,
+                              "No answer from resolver daemon, resolving in process");
+    return false;
+  }
+
+  return parseFrame(reply, out);
+}
+
+void SsuUrlResolver::run(){
+  PluginFrame in(std::cin);
+  PluginFrame out;
+
+  // only start up the full machinery if the daemon is not around
+  if (!forward(in, &out))
+    out = resolve(in);
+
+  out.writeTo(std::cout);
+
+  if (out.command() == "ERROR")
+    QCoreApplication::exit(1);
+  else
+    emit done();
+}
+
+void SsuUrlResolver::runDaemon(){
+  SsuLog *ssuLog = SsuLog::instance();
+  bool activated = sd_listen_fds(0) == 1;
+
+  server = new QLocalServer(this);
+  connect(server, SIGNAL(newConnection()),
+          this, SLOT(handleConnections()));
+
+  if (activated){
+#if QT_VERSION >= QT_VERSION_CHECK(5, 10, 0)
+    // use the socket passed in by systemd
+    if (!server->listen(SD_LISTEN_FDS_START)){
+      ssuLog->print(LOG_WARNING, QString("Unable to use activation socket: %1")
+                    .arg(server->errorString()));
+      QCoreApplication::exit(1);
+      return;
+    }
+#else
+    // QLocalServer can't take over an existing socket before Qt 5.10. The
+    // socket at SSU_URLRESOLVER_SOCKET belongs to systemd, and must not be
+    // replaced, or activation would be gone after the first idle exit
+    ssuLog->print(LOG_WARNING, "Socket activation is not supported with this Qt version");
+    QCoreApplication::exit(1);
+    return;
+#endif
   } else {
-    PluginFrame out("RESOLVEDURL");
-    out.setBody(resolvedUrl.toStdString());
-    out.writeTo(std::cout);
+    QString socketPath = Sandbox::map(SSU_URLRESOLVER_SOCKET);
+
+    QDir().mkpath(QFileInfo(socketPath).path());
+    QLocalServer::removeServer(socketPath);
+    server->setSocketOptions(QLocalServer::UserAccessOption);
+
+    if (!server->listen(socketPath)){
+      ssuLog->print(LOG_WARNING, QString("Unable to listen on %1: %2")
+                    .arg(socketPath)
+                    .arg(server->errorString()));
+      QCoreApplication::exit(1);
+      return;
+    }
+  }
+
+  ssuLog->print(LOG_INFO, "Resolver daemon ready");
+
+  // pay for configuration parsing and device detection once, up front
+  ssuInstance()->deviceModel();
+
+  idleTimer.start();
+}
+
+// requests are collected without blocking, so a slow client only delays
+// itself; complete requests are answered one after the other
+void SsuUrlResolver::handleConnections(){
+  while (server->hasPendingConnections()){
+    QLocalSocket *socket = server->nextPendingConnection();
+    requests.insert(socket, QByteArray());
+
+    connect(socket, SIGNAL(readyRead()), this, SLOT(readRequest()));
+    connect(socket, SIGNAL(disconnected()), socket, SLOT(deleteLater()));
+    connect(socket, SIGNAL(destroyed(QObject*)), this, SLOT(forgetRequest(QObject*)));
+
+    QTimer *timer = new QTimer(socket);
+    timer->setSingleShot(true);
+    connect(timer, SIGNAL(timeout()), this, SLOT(requestTimedOut()));
+    timer->start(SSU_URLRESOLVER_REQUEST_TIMEOUT);
+
+    if (socket->bytesAvailable() > 0)
+      readRequest(socket);
   }
 
-  emit done();
+  idleTimer.stop();
+}
+
+void SsuUrlResolver::readRequest(){
+  QLocalSocket *socket = qobject_cast<QLocalSocket*>(sender());
+  if (socket)
+    readRequest(socket);
+}
+
+void SsuUrlResolver::readRequest(QLocalSocket *socket){
+  if (!requests.contains(socket))
+    return;
+
+  QByteArray &data = requests[socket];
+  data.append(socket->readAll());
+
+  int end = data.indexOf('\0');
+  if (end == -1){
+    if (data.size() > maxFrameSize)
+      answer(socket, error("Received oversized request"));
+    return;
+  }
+
+  data.truncate(end + 1);
+  disconnect(socket, SIGNAL(readyRead()), this, SLOT(readRequest()));
+  stopTimeout(socket);
+
+  queue.append(QPointer<QLocalSocket>(socket));
+  processQueue();
+}
+
+void SsuUrlResolver::requestTimedOut(){
+  QLocalSocket *socket = qobject_cast<QLocalSocket*>(sender()->parent());
+  if (socket)
+    answer(socket, error("Received incomplete request"));
+}
+
+void SsuUrlResolver::forgetRequest(QObject *socket){
+  requests.remove(socket);
+
+  if (requests.isEmpty() && !busy)
+    idleTimer.start();
+}
+
+void SsuUrlResolver::processQueue(){
+  // credential updates spin an event loop; requests completed meanwhile
+  // get picked up by the loop below
+  if (busy)
+    return;
+
+  busy = true;
+
+  while (!queue.isEmpty()){
+    QPointer<QLocalSocket> socket = queue.takeFirst();
+    if (socket.isNull())
+      continue;
+
+    PluginFrame in, out;
+    if (!parseFrame(requests.value(socket), &in))
+      out = error("Received malformed request");
+    else {
+      syncConfiguration();
+      out = resolve(in);
+    }
+
+    // the client may have given up while resolving
+    if (!socket.isNull())
+      answer(socket, out);
+  }
+
+  busy = false;
+
+  if (requests.isEmpty())
+    idleTimer.start();
+}
+
+void SsuUrlResolver::syncConfiguration(){
+  // stamped before reading, so a change while reading gets picked up with
+  // the next request. Changes made by the daemon itself get read back once
+  SsuSettingsSnapshot::Stamp configuration =
+    SsuSettingsSnapshot::Stamp::read(Sandbox::map(SSU_CONFIGURATION));
+  SsuSettingsSnapshot::Stamp state = SsuSettingsSnapshot::Stamp::read(Sandbox::map(SSU_STATE));
+
+  if (configuration == configurationStamp && state == stateStamp)
+    return;
+
+  SsuCoreConfig::instance()->syncAll();
+  configurationStamp = configuration;
+  stateStamp = state;
+}
+
+// the timer may be the one currently timing out, so it can't be deleted
+// right away
+void SsuUrlResolver::stopTimeout(QLocalSocket *socket){
+  foreach (QTimer *timer, socket->findChildren<QTimer*>()){
+    timer->stop();
+    timer->deleteLater();
+  }
+}
+
+void SsuUrlResolver::answer(QLocalSocket *socket, const PluginFrame &frame){
+  requests.remove(socket);
+  stopTimeout(socket);
+  disconnect(socket, SIGNAL(readyRead()), this, SLOT(readRequest()));
+
+  // the connection is closed once the answer is written
+  socket->write(serializeFrame(frame));
+  socket->disconnectFromServer();
 }
@@ -13,11 +13,16 @@
 #include <QDebug>
 #include <QEventLoop>
 #include <QFile>
+#include <QHash>
+#include <QList>
+#include <QPointer>
+#include <QTimer>
 
 #include <iostream>
 #include <zypp/PluginFrame.h>
 
 #include "libssu/ssu.h"
+#include "libssu/ssusettingssnapshot_p.h"
 
 // quick hack for waiting for a signal
 class SignalWait: public QObject {
@@ -45,20 +50,79 @@ class SignalWait: public QObject {
 
 using namespace zypp;
 
+class QLocalServer;
+class QLocalSocket;
+
+/**
+ * Resolves plugin:ssu URLs for zypper
+ *
+ * By default each zypper request is forwarded to the resolver daemon on
+ * SSU_URLRESOLVER_SOCKET, which keeps configuration and device detection
+ * around between requests. If no daemon is listening the request gets
+ * resolved in process right away; a daemon accepting the request has
+ * SSU_URLRESOLVER_TIMEOUT to answer it, enough for updating credentials,
+ * before the request gets resolved in process as well.
+ *
+ * The daemon is the same binary started with --daemon. With Qt 5.10 or
+ * later it is usually started through socket activation; older Qt versions
+ * can't use the socket passed in by systemd, so the daemon creates the
+ * socket itself and the socket unit is not installed. It exits after
+ * SSU_URLRESOLVER_IDLE_TIMEOUT without requests. Requests are read without
+ * blocking; a client not sending a complete request within
+ * SSU_URLRESOLVER_REQUEST_TIMEOUT gets an error.
+ */
 class SsuUrlResolver: public QObject {
     Q_OBJECT
 
   public:
     SsuUrlResolver();
+    ~SsuUrlResolver();
 
   private:
-    Ssu ssu;
-    void error(QString message);
+    Ssu *ssu;
+    QLocalServer *server;
+    QTimer idleTimer;
+    bool busy;
+    /// Data received so far from each connected client
+    QHash<QObject*, QByteArray> requests;
+    /// Clients with a complete request, waiting for an answer
+    QList<QPointer<QLocalSocket> > queue;
+    /// ssu.ini and the state file as last read by the daemon
+    SsuSettingsSnapshot::Stamp configurationStamp, stateStamp;
+    /// Return the Ssu instance, creating it on first use
+    Ssu *ssuInstance();
+    PluginFrame error(QString message);
     void printJournal(int priority, QString message);
     bool writeCredentials(QString filePath, QString credentialsScope);
+    /**
+     * Send a request to the resolver daemon
+     * @return true if the daemon answered, with the answer in out
+     */
+    bool forward(const PluginFrame &in, PluginFrame *out);
+    /// Resolve a request in this process
+    PluginFrame resolve(const PluginFrame &in);
+    static QByteArray serializeFrame(const PluginFrame &frame);
+    static bool parseFrame(const QByteArray &data, PluginFrame *frame);
+    /// Read a NUL terminated frame from socket, or return an empty array on timeout
+    static QByteArray readFrame(QLocalSocket *socket, int timeout);
+    void readRequest(QLocalSocket *socket);
+    /// Answer all complete requests, unless already doing so
+    void processQueue();
+    /// Read ssu.ini and the state file again if another process changed them
+    void syncConfiguration();
+    void stopTimeout(QLocalSocket *socket);
+    /// Send frame to socket, and close the connection
+    void answer(QLocalSocket *socket, const PluginFrame &frame);
 
   public slots:
     void run();
+    void runDaemon();
+
+  private slots:
+    void handleConnections();
+    void readRequest();
+    void requestTimedOut();
+    void forgetRequest(QObject *socket);
 
   signals:
     void done();
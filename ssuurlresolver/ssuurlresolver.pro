@@ -13,4 +13,14 @@ SOURCES = main.cpp \
         ssuurlresolver.cpp
 
 CONFIG += link_pkgconfig
-PKGCONFIG += libzypp libsystemd-journal
+PKGCONFIG += libzypp libsystemd-journal libsystemd-daemon
+
+# optional resolver daemon, not enabled by default. QLocalServer can only
+# take over the socket passed in by systemd with Qt 5.10 or later, so the
+# socket unit is not installed for older versions
+systemd.files = ssu-urlresolver.service
+equals(QT_MAJOR_VERSION, 5):greaterThan(QT_MINOR_VERSION, 9): systemd.files += ssu-urlresolver.socket
+greaterThan(QT_MAJOR_VERSION, 5): systemd.files += ssu-urlresolver.socket
+systemd.path = /lib/systemd/system
+
+INSTALLS += systemd
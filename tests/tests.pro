@@ -5,10 +5,13 @@ SUBDIRS         = \
         testutils/sandboxhook.pro \
         ut_coreconfig \
         ut_deviceinfo \
+        ut_fragmentcache \
+        ut_ksmanifest \
         ut_repomanager \
         ut_rndssucli \
         ut_sandbox \
         ut_settings \
+        ut_ssuks \
         ut_ssuurlresolver \
         ut_urlresolver \
         ut_variables \
@@ -84,3 +84,64 @@ void CoreconfigTest::testSslVerify(){
   SsuCoreConfig::instance()->setValue("ssl-verify", false);
   QCOMPARE(SsuCoreConfig::instance()->useSslVerify(), false);
 }
+
+void CoreconfigTest::testBatch(){
+  SsuCoreConfig *settings = SsuCoreConfig::instance();
+  QFile file(settings->fileName());
+
+  settings->sync();
+  QVERIFY(file.open(QIODevice::ReadOnly));
+  const QByteArray before = file.readAll();
+  file.close();
+
+  settings->beginBatch();
+  settings->setFlavour("batch-flavour");
+  settings->setRelease("batch-release", true);
+  settings->setDomain("batch-domain");
+
+  // nothing is written before the outermost batch ends
+  QVERIFY(file.open(QIODevice::ReadOnly));
+  QCOMPARE(file.readAll(), before);
+  file.close();
+  QCOMPARE(settings->flavour(), QString("batch-flavour"));
+
+  settings->endBatch();
+
+  QVERIFY(file.open(QIODevice::ReadOnly));
+  const QByteArray after = file.readAll();
+  file.close();
+  QVERIFY(after.contains("flavour=batch-flavour"));
+  QVERIFY(after.contains("rndRelease=batch-release"));
+  QVERIFY(after.contains("domain=batch:domain"));
+}
+
+void CoreconfigTest::testState(){
+  SsuCoreConfig *settings = SsuCoreConfig::instance();
+  settings->syncAll();
+
+  // credentials from the initial ssu.ini were moved to the state file
+  QVERIFY(!settings->childGroups().contains("credentials-example"));
+  QCOMPARE(settings->credentials("example").first, QString("example_username"));
+
+  QFile file(settings->fileName());
+  QVERIFY(file.open(QIODevice::ReadOnly));
+  const QByteArray before = file.readAll();
+  file.close();
+
+  settings->beginBatch();
+  settings->setCredentials("scope2", "user2", "password2");
+  settings->setCredentials("scope1", "user1", "password1");
+  settings->setCredentialScopes(QStringList() << "scope2" << "scope1");
+  settings->endBatch();
+
+  QCOMPARE(settings->credentials("scope1"), qMakePair(QString("user1"), QString("password1")));
+  QCOMPARE(settings->credentials("scope2"), qMakePair(QString("user2"), QString("password2")));
+  // the scopes keep the order the server sent them in
+  QCOMPARE(settings->credentialScopes(), QStringList() << "scope2" << "scope1");
+  QVERIFY(settings->lastCredentialsUpdate() > QDateTime::currentDateTime().addSecs(-5));
+
+  // updating credentials leaves ssu.ini alone
+  QVERIFY(file.open(QIODevice::ReadOnly));
+  QCOMPARE(file.readAll(), before);
+  file.close();
+}
@@ -24,6 +24,8 @@ class CoreconfigTest: public QObject {
     void testLastCredentialsUpdate();
     void testRelease();
     void testSslVerify();
+    void testBatch();
+    void testState();
 };
 
 #endif
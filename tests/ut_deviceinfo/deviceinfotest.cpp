@@ -10,6 +10,9 @@
 #include <QtTest/QtTest>
 
 #include "libssu/ssudeviceinfo.h"
+#include "libssu/ssudevicequery.h"
+#include "libssu/ssupatternmatcher_p.h"
+#include "libssu/ssureporesolver.h"
 
 void DeviceInfoTest::testAdaptationVariables(){
   SsuDeviceInfo deviceInfo("N950");
@@ -25,10 +28,128 @@ void DeviceInfoTest::testAdaptationVariables(){
   QCOMPARE(repoName, QString("adaptation"));
 }
 
+void DeviceInfoTest::testDeviceModelCache(){
+  QString model = SsuDeviceInfo().deviceModel();
+
+  // second instance should pick the model up from the identity cache
+  SsuDeviceInfo deviceInfo;
+  QCOMPARE(deviceInfo.deviceModel(), model);
+  QCOMPARE(deviceInfo.redetectDeviceModel(), model);
+}
+
 void DeviceInfoTest::testDeviceUid(){
   QVERIFY2(!SsuDeviceInfo().deviceUid().isEmpty(), "No method to get device UID on this platform");
 }
 
+void DeviceInfoTest::testPatternMatcher(){
+  QStringList patterns;
+  patterns << "OMAP4430" << "N950" << "950" << "apq8064" << "8064";
+
+  SsuPatternMatcher matcher(patterns);
+  QCOMPARE(matcher.firstMatch("Hardware : Nokia RM-680 board"), -1);
+  QCOMPARE(matcher.firstMatch(""), -1);
+  // the pattern listed first wins, not the one found first in the text
+  QCOMPARE(matcher.firstMatch("Hardware : N950 OMAP4430"), 0);
+  QCOMPARE(matcher.firstMatch("Hardware : N950"), 1);
+  QCOMPARE(matcher.firstMatch("Hardware : RM950"), 2);
+  QCOMPARE(matcher.firstMatch("Qualcomm apq8064"), 3);
+  QCOMPARE(matcher.firstMatch("msm8064"), 4);
+  // overlapping patterns found through fail links
+  QCOMPARE(SsuPatternMatcher(QStringList() << "abcd" << "bc").firstMatch("abce"), 1);
+  QCOMPARE(SsuPatternMatcher(QStringList() << "aab").firstMatch("aaab"), 0);
+
+  // an empty pattern is contained in everything
+  QCOMPARE(SsuPatternMatcher(QStringList() << "foo" << "").firstMatch("bar"), 1);
+  QCOMPARE(SsuPatternMatcher(QStringList()).firstMatch("bar"), -1);
+}
+
+namespace {
+class QueryThread: public QThread {
+  public:
+    QueryThread(const SsuDeviceQuery &query, const QStringList &models):
+      query(query), models(models){}
+
+    SsuDeviceQuery query;
+    QStringList models;
+    QStringList results;
+
+  protected:
+    void run(){
+      for (int i = 0; i < 100; i++){
+        foreach (const QString &model, models){
+          results.append(query.familyOf(model) + ":" +
+                         query.reposOf(model, i % 2).join(","));
+
+          // variable sections are flattened from the copies in the query
+          QHash<QString, QString> variables;
+          query.variableSection(SsuDeviceQuery::BoardMappings, "var-baz", &variables);
+          query.adaptationVariablesOf(model, "adaptation1", &variables);
+          QStringList keys = variables.keys();
+          keys.sort();
+          foreach (const QString &key, keys)
+            results.append(key + "=" + variables.value(key));
+
+          SsuRepoResolver resolver(query, model, i % 2);
+          results.append(resolver.url("adaptation0"));
+        }
+      }
+    }
+};
+}
+
+void DeviceInfoTest::testQuery(){
+  QStringList models;
+  models << "N9" << "N950" << "N900" << "generic-x86" << "SDK" << "NONEXISTENT";
+
+  SsuDeviceQuery query;
+  QCOMPARE(query.models(), QStringList() << "N9" << "N900" << "N950" << "SDK" << "generic-x86");
+
+  foreach (const QString &model, models){
+    SsuDeviceInfo deviceInfo(model);
+    QCOMPARE(query.contains(model), deviceInfo.contains());
+    QCOMPARE(query.variantOf(model), deviceInfo.deviceVariant());
+    QCOMPARE(query.variantOf(model, true), deviceInfo.deviceVariant(true));
+    QCOMPARE(query.familyOf(model), deviceInfo.deviceFamily());
+    QCOMPARE(query.adaptationReposOf(model), deviceInfo.adaptationRepos());
+    QCOMPARE(query.disabledReposOf(model), deviceInfo.disabledRepos());
+    QCOMPARE(query.valueOf(model, "foo"), deviceInfo.value("foo"));
+
+    QHash<QString, QString> variables, expectedVariables;
+    query.variableSection(SsuDeviceQuery::BoardMappings, "var-baz", &variables);
+    deviceInfo.variableSection("baz", &expectedVariables);
+    QCOMPARE(variables, expectedVariables);
+
+    // resolving through the query gives the same URLs as the global configuration
+    SsuRepoResolver resolver(query, model, true);
+    QHash<QString, QString> overrides;
+    overrides.insert("model", model);
+    SsuRepoResolver globalResolver(true, overrides);
+    QCOMPARE(resolver.url("adaptation0"), globalResolver.url("adaptation0"));
+    for (int filter = SsuRepoManager::NoFilter; filter <= SsuRepoManager::BoardFilterUserBlacklist; filter++){
+      QCOMPARE(query.reposOf(model, false, filter), deviceInfo.repos(false, filter));
+      QCOMPARE(query.reposOf(model, true, filter), deviceInfo.repos(true, filter));
+    }
+  }
+
+  // asking for another model must not change the model of deviceInfo
+  SsuDeviceInfo deviceInfo("N900");
+  QVERIFY(deviceInfo.contains("N950"));
+  QVERIFY(!deviceInfo.contains("NONEXISTENT"));
+  QCOMPARE(deviceInfo.deviceModel(), QString("N900"));
+
+  QList<QueryThread*> threads;
+  for (int i = 0; i < 4; i++){
+    threads.append(new QueryThread(query, models));
+    threads.last()->start();
+  }
+
+  foreach (QueryThread *thread, threads){
+    QVERIFY(thread->wait());
+    QCOMPARE(thread->results, threads.first()->results);
+  }
+  qDeleteAll(threads);
+}
+
 void DeviceInfoTest::testVariableSection(){
   SsuDeviceInfo deviceInfo;
 
@@ -15,7 +15,10 @@ class DeviceInfoTest: public QObject {
 
   private slots:
     void testAdaptationVariables();
+    void testDeviceModelCache();
     void testDeviceUid();
+    void testPatternMatcher();
+    void testQuery();
     void testVariableSection();
     void testValue();
 };
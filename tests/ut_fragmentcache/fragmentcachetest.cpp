@@ -0,0 +1,146 @@
+/**
+ * @file fragmentcachetest.cpp
+ * @copyright 2013 Jolla Ltd.
+ * @author Bernd Wachter <bwachter@lart.info>
+ * @date 2013
+ */
+
+#include "fragmentcachetest.h"
+
+#include <utime.h>
+
+#include <QtTest/QtTest>
+
+#include "ssuks/ssufragmentcache.h"
+
+static bool writeFile(const QString &path, const QByteArray &data){
+  QFile file(path);
+  if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    return false;
+  return file.write(data) == data.size();
+}
+
+// set the modification time of path to age seconds in the past, so changes
+// are visible independent of the timestamp resolution of the file system
+static bool setAge(const QString &path, int age){
+  struct utimbuf times;
+  times.actime = times.modtime = QDateTime::currentDateTime().toTime_t() - age;
+  return utime(QFile::encodeName(path).constData(), &times) == 0;
+}
+
+void FragmentCacheTest::initTestCase(){
+  directory = QString("%1/ut_fragmentcache-%2")
+    .arg(QDir::tempPath())
+    .arg(QCoreApplication::applicationPid());
+  QVERIFY(QDir().mkpath(directory));
+}
+
+void FragmentCacheTest::cleanupTestCase(){
+  QDir(directory).removeRecursively();
+}
+
+void FragmentCacheTest::testFind(){
+  const QString path = directory + "/find";
+  QVERIFY(QDir().mkpath(path));
+  QVERIFY(writeFile(path + "/default", "default\n"));
+  QVERIFY(writeFile(path + "/n9", "variant\n"));
+  QVERIFY(writeFile(path + "/n950", "model\n"));
+  QVERIFY(writeFile(path + "/.hidden", "hidden\n"));
+  QVERIFY(setAge(path, 300));
+
+  SsuFragmentCache *fragments = SsuFragmentCache::instance();
+  const QStringList names = QStringList() << "n950" << "n9" << "default";
+
+  // the first existing name wins: model, then variant, then default
+  QCOMPARE(fragments->find(path, names), QString("n950"));
+
+  QVERIFY(QFile::remove(path + "/n950"));
+  QVERIFY(setAge(path, 200));
+  QCOMPARE(fragments->find(path, names), QString("n9"));
+
+  QVERIFY(QFile::remove(path + "/n9"));
+  QVERIFY(setAge(path, 100));
+  QCOMPARE(fragments->find(path, names), QString("default"));
+
+  // empty names, as for a model without variant, are skipped
+  QCOMPARE(fragments->find(path, QStringList() << "" << "default"), QString("default"));
+
+  // hidden files are found by name, but are no entries
+  QCOMPARE(fragments->find(path, QStringList() << ".hidden" << "default"), QString(".hidden"));
+  QVERIFY(!fragments->entries(path).contains(".hidden"));
+
+  QCOMPARE(fragments->find(path, QStringList() << "n900"), QString());
+  QCOMPARE(fragments->find(path + "/missing", names), QString());
+}
+
+void FragmentCacheTest::testEntries(){
+  const QString path = directory + "/entries";
+  QVERIFY(QDir().mkpath(path + "/c"));
+  QVERIFY(writeFile(path + "/b", "b\n"));
+  QVERIFY(writeFile(path + "/a", "a\n"));
+  QVERIFY(writeFile(path + "/Z", "Z\n"));
+  QVERIFY(writeFile(path + "/2-late", "2\n"));
+  QVERIFY(writeFile(path + "/10-early", "10\n"));
+  QVERIFY(writeFile(path + "/.hidden", "hidden\n"));
+
+  // sorted by name, as QDir::entryList(), including directories
+  const QStringList expected = QStringList()
+    << "10-early" << "2-late" << "Z" << "a" << "b" << "c";
+  QCOMPARE(SsuFragmentCache::instance()->entries(path), expected);
+  QCOMPARE(SsuFragmentCache::instance()->entries(path),
+           QDir(path).entryList(QDir::AllEntries|QDir::NoDot|QDir::NoDotDot, QDir::Name));
+
+  QCOMPARE(SsuFragmentCache::instance()->entries(path + "/missing"), QStringList());
+}
+
+void FragmentCacheTest::testReloadFile(){
+  const QString fileName = directory + "/reload-file";
+  SsuFragmentCache *fragments = SsuFragmentCache::instance();
+
+  QVERIFY(writeFile(fileName, "first\n"));
+  QVERIFY(setAge(fileName, 300));
+  QCOMPARE(fragments->lines(fileName), QStringList() << "first");
+
+  // a different size is picked up
+  QVERIFY(writeFile(fileName, "second\nline\n"));
+  QVERIFY(setAge(fileName, 300));
+  QCOMPARE(fragments->lines(fileName), QStringList() << "second" << "line");
+
+  // as is a different modification time with the same size
+  QVERIFY(writeFile(fileName, "second\nLINE\n"));
+  QVERIFY(setAge(fileName, 200));
+  QCOMPARE(fragments->lines(fileName), QStringList() << "second" << "LINE");
+
+  // unchanged size and modification time keep the cached lines
+  QVERIFY(writeFile(fileName, "SECOND\nLINE\n"));
+  QVERIFY(setAge(fileName, 200));
+  QCOMPARE(fragments->lines(fileName), QStringList() << "second" << "LINE");
+
+  QVERIFY(QFile::remove(fileName));
+  QCOMPARE(fragments->lines(fileName), QStringList());
+}
+
+void FragmentCacheTest::testReloadDirectory(){
+  const QString path = directory + "/reload-directory";
+  SsuFragmentCache *fragments = SsuFragmentCache::instance();
+
+  QVERIFY(QDir().mkpath(path));
+  QVERIFY(writeFile(path + "/default", "default\n"));
+  QVERIFY(setAge(path, 300));
+  QCOMPARE(fragments->entries(path), QStringList() << "default");
+  QCOMPARE(fragments->find(path, QStringList() << "n9" << "default"), QString("default"));
+  QByteArray fingerprint = fragments->fingerprint(path);
+
+  // adding a file changes the modification time of the directory
+  QVERIFY(writeFile(path + "/n9", "n9\n"));
+  QVERIFY(setAge(path, 200));
+  QCOMPARE(fragments->entries(path), QStringList() << "default" << "n9");
+  QCOMPARE(fragments->find(path, QStringList() << "n9" << "default"), QString("n9"));
+  QVERIFY(fragments->fingerprint(path) != fingerprint);
+  fingerprint = fragments->fingerprint(path);
+
+  // changing a file only changes the fingerprint
+  QVERIFY(writeFile(path + "/n9", "n9 changed\n"));
+  QCOMPARE(fragments->entries(path), QStringList() << "default" << "n9");
+  QVERIFY(fragments->fingerprint(path) != fingerprint);
+}
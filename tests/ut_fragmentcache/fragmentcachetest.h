@@ -0,0 +1,29 @@
+/**
+ * @file fragmentcachetest.h
+ * @copyright 2013 Jolla Ltd.
+ * @author Bernd Wachter <bwachter@lart.info>
+ * @date 2013
+ */
+
+#ifndef _FRAGMENTCACHETEST_H
+#define _FRAGMENTCACHETEST_H
+
+#include <QObject>
+#include <QString>
+
+class FragmentCacheTest: public QObject {
+    Q_OBJECT
+
+  private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void testFind();
+    void testEntries();
+    void testReloadFile();
+    void testReloadDirectory();
+
+  private:
+    QString directory;
+};
+
+#endif
@@ -0,0 +1,9 @@
+TARGET = ut_fragmentcache
+include(../testapplication.pri)
+include(ut_fragmentcache_dependencies.pri)
+
+HEADERS = fragmentcachetest.h \
+        ../../ssuks/ssufragmentcache.h
+SOURCES = main.cpp \
+        fragmentcachetest.cpp \
+        ../../ssuks/ssufragmentcache.cpp
@@ -0,0 +1,191 @@
+/**
+ * @file ksmanifesttest.cpp
+ * @copyright 2013 Jolla Ltd.
+ * @author Bernd Wachter <bwachter@lart.info>
+ * @date 2013
+ */
+
+#include "ksmanifesttest.h"
+
+#include <QtTest/QtTest>
+
+#include "ssuks/ssuksmanifest.h"
+
+static bool writeFile(const QString &path, const QByteArray &data){
+  QFile file(path);
+  if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    return false;
+  return file.write(data) == data.size();
+}
+
+void KsManifestTest::initTestCase(){
+  directory = QString("%1/ut_ksmanifest-%2")
+    .arg(QDir::tempPath())
+    .arg(QCoreApplication::applicationPid());
+  QVERIFY(QDir().mkpath(directory));
+}
+
+void KsManifestTest::cleanupTestCase(){
+  QDir dir(directory);
+  foreach (const QString &subdirectory, dir.entryList(QDir::Dirs|QDir::NoDotAndDotDot)){
+    QDir sub(dir.filePath(subdirectory));
+    foreach (const QString &entry, sub.entryList(QDir::Files|QDir::Hidden))
+      sub.remove(entry);
+    dir.rmdir(subdirectory);
+  }
+  foreach (const QString &entry, dir.entryList(QDir::Files|QDir::Hidden))
+    dir.remove(entry);
+  QDir().rmdir(directory);
+}
+
+// look up parameterHash in a manifest freshly read from directory
+static QString find(const QString &directory, const QByteArray &parameterHash){
+  SsuKsManifest::Entry entry;
+  return SsuKsManifest().find(directory, parameterHash, &entry);
+}
+
+void KsManifestTest::testRecord(){
+  const QString kickstart = directory + "/record.ks";
+  QVERIFY(writeFile(kickstart, "# kickstart\n"));
+
+  QStringList inputs;
+  inputs << "file:/usr/share/ssu/kickstart/part/default"
+         << "value:board-mappings:variants/N9"
+         << "variables:repos:release-flavour";
+
+  {
+    SsuKsManifest manifest;
+    SsuKsManifest::Entry entry;
+    QVERIFY(manifest.find(directory, "parameters1", &entry).isEmpty());
+    manifest.record(directory, kickstart, "parameters1", inputs, "input1");
+    QVERIFY(manifest.save());
+  }
+
+  // the manifest is renamed into place, without leftovers
+  QVERIFY(QFile::exists(directory + "/.ssuks-manifest"));
+  QVERIFY(!QFile::exists(directory + "/.ssuks-manifest.tmp"));
+
+  SsuKsManifest manifest;
+  SsuKsManifest::Entry entry;
+  QCOMPARE(manifest.find(directory, "parameters1", &entry),
+           QFileInfo(kickstart).absoluteFilePath());
+  QCOMPARE(entry.parameterHash, QByteArray("parameters1"));
+  QCOMPARE(entry.inputHash, QByteArray("input1"));
+  QCOMPARE(entry.inputs, inputs);
+  QVERIFY(manifest.find(directory, "parameters2", &entry).isEmpty());
+  QVERIFY(manifest.find(directory, QByteArray(), &entry).isEmpty());
+  QCOMPARE(SsuKsManifest::hashFile(kickstart).size(), 40);
+  QVERIFY(SsuKsManifest::hashFile(directory + "/missing.ks").isEmpty());
+
+  // without inputs hash nothing is recorded
+  manifest.record(directory, kickstart, "parameters3", inputs, QByteArray());
+  QVERIFY(manifest.find(directory, "parameters3", &entry).isEmpty());
+}
+
+void KsManifestTest::testModifiedOutput(){
+  const QString kickstart = directory + "/modified.ks";
+  QVERIFY(writeFile(kickstart, "# kickstart\n%packages\n%end\n"));
+
+  {
+    SsuKsManifest manifest;
+    manifest.record(directory, kickstart, "modified", QStringList(), "input");
+    QVERIFY(manifest.save());
+  }
+  QCOMPARE(find(directory, "modified"), QFileInfo(kickstart).absoluteFilePath());
+
+  // edited by hand
+  QVERIFY(writeFile(kickstart, "# kickstart\n%packages\nvim\n%end\n"));
+  QVERIFY(find(directory, "modified").isEmpty());
+
+  // the recorded content is up to date again
+  QVERIFY(writeFile(kickstart, "# kickstart\n%packages\n%end\n"));
+  QVERIFY(!find(directory, "modified").isEmpty());
+
+  // truncated
+  QVERIFY(writeFile(kickstart, "# kickstart\n"));
+  QVERIFY(find(directory, "modified").isEmpty());
+
+  // removed
+  QVERIFY(QFile::remove(kickstart));
+  QVERIFY(find(directory, "modified").isEmpty());
+}
+
+void KsManifestTest::testPrune(){
+  const QString prune = directory + "/prune";
+  QVERIFY(QDir().mkpath(prune));
+
+  const QString kept = prune + "/kept.ks", deleted = prune + "/deleted.ks",
+    edited = prune + "/edited.ks";
+  QVERIFY(writeFile(kept, "kept\n"));
+  QVERIFY(writeFile(deleted, "deleted\n"));
+  QVERIFY(writeFile(edited, "edited\n"));
+  {
+    SsuKsManifest manifest;
+    manifest.record(prune, kept, "kept", QStringList(), "input");
+    manifest.record(prune, deleted, "deleted", QStringList(), "input");
+    manifest.record(prune, edited, "edited", QStringList(), "input");
+    QVERIFY(manifest.save());
+  }
+
+  // entries of deleted kickstarts are dropped on reading, entries of
+  // modified ones when they're looked up
+  QVERIFY(QFile::remove(deleted));
+  QVERIFY(writeFile(edited, "edited by hand\n"));
+  {
+    SsuKsManifest manifest;
+    SsuKsManifest::Entry entry;
+    QVERIFY(manifest.find(prune, "edited", &entry).isEmpty());
+    QVERIFY(manifest.save());
+  }
+
+  QFile file(prune + "/.ssuks-manifest");
+  QVERIFY(file.open(QIODevice::ReadOnly));
+  QByteArray content = file.readAll();
+  QVERIFY(content.contains("kept.ks"));
+  QVERIFY(!content.contains("deleted.ks"));
+  QVERIFY(!content.contains("edited.ks"));
+
+  QCOMPARE(find(prune, "kept"), QFileInfo(kept).absoluteFilePath());
+}
+
+void KsManifestTest::testSaveOnlyChanged(){
+  const QString other = directory + "/other";
+  QVERIFY(QDir().mkpath(other));
+
+  // nothing recorded, nothing written
+  {
+    SsuKsManifest manifest;
+    SsuKsManifest::Entry entry;
+    QVERIFY(manifest.find(other, "parameters", &entry).isEmpty());
+    QVERIFY(manifest.save());
+  }
+  QVERIFY(!QFile::exists(other + "/.ssuks-manifest"));
+
+  // entries of other kickstarts survive rewriting the manifest, with
+  // their inputs
+  const QString first = other + "/first.ks", second = other + "/second.ks";
+  QVERIFY(writeFile(first, "first\n"));
+  QVERIFY(writeFile(second, "second\n"));
+  {
+    SsuKsManifest manifest;
+    manifest.record(other, first, "first", QStringList() << "value:ssu:arch", "input");
+    QVERIFY(manifest.save());
+  }
+  {
+    SsuKsManifest manifest;
+    manifest.record(other, second, "second", QStringList() << "value:ssu:release", "input");
+    QVERIFY(manifest.save());
+  }
+
+  SsuKsManifest manifest;
+  SsuKsManifest::Entry entry;
+  QCOMPARE(manifest.find(other, "first", &entry), QFileInfo(first).absoluteFilePath());
+  QCOMPARE(entry.inputs, QStringList() << "value:ssu:arch");
+  QCOMPARE(manifest.find(other, "second", &entry), QFileInfo(second).absoluteFilePath());
+  QCOMPARE(entry.inputs, QStringList() << "value:ssu:release");
+
+  QDir dir(other);
+  foreach (const QString &entry, dir.entryList(QDir::Files|QDir::Hidden))
+    dir.remove(entry);
+  QVERIFY(QDir().rmdir(other));
+}
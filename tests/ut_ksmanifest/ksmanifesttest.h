@@ -0,0 +1,29 @@
+/**
+ * @file ksmanifesttest.h
+ * @copyright 2013 Jolla Ltd.
+ * @author Bernd Wachter <bwachter@lart.info>
+ * @date 2013
+ */
+
+#ifndef _KSMANIFESTTEST_H
+#define _KSMANIFESTTEST_H
+
+#include <QObject>
+#include <QString>
+
+class KsManifestTest: public QObject {
+    Q_OBJECT
+
+  private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void testRecord();
+    void testModifiedOutput();
+    void testPrune();
+    void testSaveOnlyChanged();
+
+  private:
+    QString directory;
+};
+
+#endif
@@ -0,0 +1,19 @@
+/**
+ * @file main.cpp
+ * @copyright 2013 Jolla Ltd.
+ * @author Bernd Wachter <bwachter@lart.info>
+ * @date 2013
+ */
+
+#include <QtTest/QtTest>
+
+#include "ksmanifesttest.h"
+
+int main(int argc, char **argv){
+  KsManifestTest ksManifestTest;
+
+  if (QTest::qExec(&ksManifestTest, argc, argv))
+    return 1;
+
+  return 0;
+}
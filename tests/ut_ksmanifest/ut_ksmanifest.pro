@@ -0,0 +1,9 @@
+TARGET = ut_ksmanifest
+include(../testapplication.pri)
+include(ut_ksmanifest_dependencies.pri)
+
+HEADERS = ksmanifesttest.h \
+        ../../ssuks/ssuksmanifest.h
+SOURCES = main.cpp \
+        ksmanifesttest.cpp \
+        ../../ssuks/ssuksmanifest.cpp
@@ -0,0 +1 @@
+include(../../ssuks/ssuks_dependencies.pri)
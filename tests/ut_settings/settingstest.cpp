@@ -9,7 +9,12 @@
 
 #include <QtTest/QtTest>
 
+#include <sys/types.h>
+#include <utime.h>
+
 #include "libssu/ssusettings.h"
+#include "libssu/ssusettingssnapshot_p.h"
+#include "libssu/ssusettingsview.h"
 #include "upgradetesthelper.h"
 
 void SettingsTest::initTestCase(){
@@ -63,6 +68,280 @@ void SettingsTest::testMerge(){
   QCOMPARE(actualValue, expectedValue);
 }
 
+static bool writeFile(const QString &path, const QByteArray &data){
+  QFile file(path);
+  if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    return false;
+  return file.write(data) == data.size();
+}
+
+static QByteArray readFile(const QString &path){
+  QFile file(path);
+  if (!file.open(QIODevice::ReadOnly))
+    return QByteArray();
+  return file.readAll();
+}
+
+static bool setModified(const QString &path, time_t mtime){
+  struct utimbuf times;
+  times.actime = mtime;
+  times.modtime = mtime;
+  return utime(QFile::encodeName(path).constData(), &times) == 0;
+}
+
+static bool removePath(const QString &path){
+  QFileInfo info(path);
+  if (info.isDir() && !info.isSymLink()){
+    QDir dir(path);
+    foreach (const QString &entry, dir.entryList(QDir::AllEntries|QDir::Hidden|QDir::System|QDir::NoDotAndDotDot))
+      removePath(dir.filePath(entry));
+    return QDir().rmdir(path);
+  }
+  return QFile::remove(path);
+}
+
+// a directory removed with all its content on destruction, as QTemporaryDir
+// is not available with Qt 4
+class TemporaryDirectory {
+  public:
+    TemporaryDirectory(){
+      static int count = 0;
+      dirPath = QString("%1/ut_settings-%2-%3")
+        .arg(QDir::tempPath())
+        .arg(QCoreApplication::applicationPid())
+        .arg(count++);
+      removePath(dirPath);
+      valid = QDir().mkpath(dirPath);
+    }
+    ~TemporaryDirectory(){
+      removePath(dirPath);
+    }
+    bool isValid() const { return valid; }
+    QString path() const { return dirPath; }
+
+  private:
+    QString dirPath;
+    bool valid;
+};
+
+void SettingsTest::testMergeManifest(){
+  TemporaryDirectory tempDir;
+  QVERIFY(tempDir.isValid());
+
+  const QString fileName = tempDir.path() + "/settings.ini";
+  const QString settingsDirectory = tempDir.path() + "/settings.d";
+  const QString foo = settingsDirectory + "/foo.ini";
+  const QString bar = settingsDirectory + "/bar.ini";
+  const QByteArray fooData = readFile(":/testdata/merge/settings.d/foo.ini");
+
+  QVERIFY(QDir().mkpath(settingsDirectory));
+  QVERIFY(writeFile(foo, fooData));
+  QVERIFY(writeFile(bar, readFile(":/testdata/merge/settings.d/bar.ini")));
+
+  {
+    SsuSettings settings(fileName, settingsDirectory);
+    QCOMPARE(settings.value("groupA/foo-bar").toString(), QString("foo-value"));
+    QCOMPARE(settings.value("groupA/bar-only").toString(), QString("bar-value"));
+  }
+  QVERIFY(QFileInfo(fileName + ".manifest").exists());
+
+  // move the merged file into the past, so a rewrite shows in its mtime
+  const time_t past = QDateTime::currentDateTime().toTime_t() - 3600;
+  QVERIFY(setModified(fileName, past));
+  const QDateTime merged = QFileInfo(fileName).lastModified();
+
+  // touching a file must not cause the merged file to be written
+  QVERIFY(writeFile(foo, fooData));
+  QVERIFY(setModified(foo, past + 1));
+  {
+    SsuSettings settings(fileName, settingsDirectory);
+    QCOMPARE(settings.value("groupA/foo-bar").toString(), QString("foo-value"));
+  }
+  QCOMPARE(QFileInfo(fileName).lastModified(), merged);
+
+  // neither must a change without effect on the merge result
+  QVERIFY(writeFile(foo, fooData + "\n; just a comment\n"));
+  QVERIFY(setModified(foo, past + 2));
+  {
+    SsuSettings settings(fileName, settingsDirectory);
+  }
+  QCOMPARE(QFileInfo(fileName).lastModified(), merged);
+
+  QVERIFY(writeFile(foo, "[groupA]\nfoo-bar = changed-value\n"));
+  QVERIFY(setModified(foo, past + 3));
+  {
+    SsuSettings settings(fileName, settingsDirectory);
+    QCOMPARE(settings.value("groupA/foo-bar").toString(), QString("changed-value"));
+    QVERIFY(!settings.contains("groupA/foo-only"));
+  }
+  QVERIFY(QFileInfo(fileName).lastModified() != merged);
+
+  QVERIFY(QFile::remove(foo));
+  {
+    SsuSettings settings(fileName, settingsDirectory);
+    QCOMPARE(settings.value("groupA/foo-bar").toString(), QString("bar-value"));
+  }
+}
+
+void SettingsTest::testLayered(){
+  TemporaryDirectory tempDir;
+  QVERIFY(tempDir.isValid());
+
+  const QString fileName = tempDir.path() + "/settings.ini";
+  const QString settingsDirectory = tempDir.path() + "/settings.d";
+  const QByteArray masterData = readFile(":/testdata/merge/settings.ini");
+
+  QVERIFY(QDir().mkpath(settingsDirectory));
+  QVERIFY(writeFile(fileName, masterData));
+  QVERIFY(writeFile(settingsDirectory + "/foo.ini", readFile(":/testdata/merge/settings.d/foo.ini")));
+  QVERIFY(writeFile(settingsDirectory + "/bar.ini", readFile(":/testdata/merge/settings.d/bar.ini")));
+  QVERIFY(writeFile(settingsDirectory + "/syntax.ini",
+                    "; comment\n"
+                    "# comment\n"
+                    "top-level = ignored\n"
+                    "[groupB]\n"
+                    "list = one, two , three\n"
+                    "quoted = \"a, b\" ; comment\n"
+                    "escaped = \"line\\nbreak\" tail\n"
+                    "empty =\n"
+                    "nested\\key = value\n"
+                    "%41key = percent\n"
+                    "at = @@at\n"
+                    "[%67eneral]\n"
+                    "key = value\n"));
+
+  // the layers read the same as a merge of the directory
+  SsuSettingsView layered(fileName, settingsDirectory);
+  SsuSettings merged(tempDir.path() + "/merged.ini", settingsDirectory);
+
+  QCOMPARE(layered.allKeys().toSet(), merged.allKeys().toSet());
+  foreach (const QString &key, merged.allKeys())
+    QCOMPARE(layered.value(key), merged.value(key));
+  QCOMPARE(layered.value("groupA/foo-bar").toString(), QString("foo-value"));
+  QVERIFY(!layered.contains("groupA/master-only"));
+  QCOMPARE(readFile(fileName), masterData);
+
+  QCOMPARE(layered.fileName(), fileName);
+  QCOMPARE(layered.sourceFiles(), QStringList()
+           << settingsDirectory + "/bar.ini"
+           << settingsDirectory + "/foo.ini"
+           << settingsDirectory + "/syntax.ini");
+
+  // the layered values are kept apart from readers of the file itself
+  QSettings plain(fileName, QSettings::IniFormat);
+  QVERIFY(plain.contains("groupA/master-only"));
+  QVERIFY(!plain.contains("groupA/foo-only"));
+
+  // children of a group are listed as QSettings does inside the group
+  merged.beginGroup("groupA");
+  QCOMPARE(layered.childKeys("groupA"), merged.childKeys());
+  QCOMPARE(layered.allKeys("groupA"), merged.allKeys());
+  QCOMPARE(layered.childGroups("groupA"), merged.childGroups());
+  merged.endGroup();
+  QCOMPARE(layered.childGroups(), merged.childGroups());
+  QVERIFY(layered.childKeys().isEmpty());
+  QCOMPARE(layered.value("/groupA//foo-bar"), merged.value("groupA/foo-bar"));
+
+  // copies hold the keys of the settings at the time they were made
+  SsuSettingsView copy(merged);
+  QCOMPARE(copy.allKeys(), merged.allKeys());
+  merged.setValue("groupA/foo-bar", "changed");
+  QCOMPARE(copy.value("groupA/foo-bar").toString(), QString("foo-value"));
+
+  // without any layers the base file is used as it is
+  foreach (const QString &file, QDir(settingsDirectory).entryList(QDir::Files))
+    QVERIFY(QFile::remove(settingsDirectory + "/" + file));
+
+  SsuSettingsView baseOnly(fileName, settingsDirectory);
+  QSettings expected(":/testdata/merge/settings.ini", QSettings::IniFormat);
+  QCOMPARE(baseOnly.allKeys().toSet(), expected.allKeys().toSet());
+  foreach (const QString &key, expected.allKeys())
+    QCOMPARE(baseOnly.value(key), expected.value(key));
+  QCOMPARE(baseOnly.sourceFiles(), QStringList() << fileName);
+}
+
+void SettingsTest::testSnapshot(){
+  TemporaryDirectory tempDir;
+  QVERIFY(tempDir.isValid());
+
+  const QString input = tempDir.path() + "/settings.ini";
+  const QString snapshotPath = tempDir.path() + "/settings.snapshot";
+  QVERIFY(writeFile(input, "[groupA]\nkey = value\n"));
+
+  SsuSettingsSnapshot::Source source;
+  source.name = "settings";
+  source.inputs << input << tempDir.path() + "/missing.ini";
+  foreach (const QString &path, source.inputs)
+    source.stamps << SsuSettingsSnapshot::Stamp::read(path);
+  source.values.insert("groupA/key", QString("value"));
+  source.values.insert("groupA/list", QStringList() << "one" << "two");
+  source.values.insert("groupB/key", QString("value"));
+  source.values.insert("empty", QString());
+
+  QVERIFY(SsuSettingsSnapshot::write(snapshotPath, QList<SsuSettingsSnapshot::Source>() << source));
+
+  SsuSettingsSnapshot snapshot;
+  QVERIFY(snapshot.map(snapshotPath));
+  QVERIFY(snapshot.isValid());
+  QVERIFY(snapshot.isCurrent("settings"));
+  QVERIFY(!snapshot.isCurrent("other"));
+
+  QSettings::SettingsMap values;
+  QVERIFY(snapshot.read("settings", &values));
+  QCOMPARE(values, source.values);
+
+  QCOMPARE(values.value("groupA/list").toStringList(), QStringList() << "one" << "two");
+  QVERIFY(values.contains("empty"));
+
+  // values and group keys are looked up without copying the source
+  int index = snapshot.source("settings");
+  QVERIFY(index >= 0);
+  QCOMPARE(snapshot.source("other"), -1);
+  QVERIFY(snapshot.isCurrent(index));
+
+  QVariant value;
+  QVERIFY(snapshot.value(index, "groupA/key", &value));
+  QCOMPARE(value.toString(), QString("value"));
+  QVERIFY(snapshot.value(index, "groupA/list", &value));
+  QCOMPARE(value.toStringList(), QStringList() << "one" << "two");
+  QVERIFY(snapshot.value(index, "empty", &value));
+  QVERIFY(!snapshot.value(index, "groupA/missing", &value));
+  QVERIFY(!snapshot.value(-1, "groupA/key", &value));
+
+  QCOMPARE(snapshot.keys(index, "groupA/"), QStringList() << "groupA/key" << "groupA/list");
+  QCOMPARE(snapshot.keys(index, "groupB/"), QStringList() << "groupB/key");
+  QVERIFY(snapshot.keys(index, "groupC/").isEmpty());
+  QCOMPARE(snapshot.keys(index, QString()).size(), 4);
+
+  // changed or added inputs invalidate the source
+  QVERIFY(writeFile(input, "[groupA]\nkey = changed-value\n"));
+  QVERIFY(!snapshot.isCurrent("settings"));
+
+  // values read before the change are not written with the new stamp
+  QVERIFY(!SsuSettingsSnapshot::write(snapshotPath, QList<SsuSettingsSnapshot::Source>() << source));
+  QVERIFY(snapshot.isValid());
+
+  source.stamps.clear();
+  foreach (const QString &path, source.inputs)
+    source.stamps << SsuSettingsSnapshot::Stamp::read(path);
+  QVERIFY(SsuSettingsSnapshot::write(snapshotPath, QList<SsuSettingsSnapshot::Source>() << source));
+  SsuSettingsSnapshot updated;
+  QVERIFY(updated.map(snapshotPath));
+  QVERIFY(updated.isCurrent("settings"));
+  QVERIFY(writeFile(tempDir.path() + "/missing.ini", "[groupA]\n"));
+  QVERIFY(!updated.isCurrent("settings"));
+
+  // the mapping of the replaced snapshot stays usable
+  QSettings::SettingsMap oldValues;
+  QVERIFY(snapshot.read("settings", &oldValues));
+  QCOMPARE(oldValues.value("groupB/key").toString(), QString("value"));
+
+  QVERIFY(writeFile(snapshotPath, "garbage"));
+  SsuSettingsSnapshot invalid;
+  QVERIFY(!invalid.map(snapshotPath));
+  QVERIFY(!invalid.isCurrent("settings"));
+}
+
 void SettingsTest::testUpgrade_data(){
   // Read recipe
   QFile recipe(":/testdata/upgrade/recipe");
@@ -134,3 +413,46 @@ void SettingsTest::testUpgrade(){
     QCOMPARE(actualValue, expectedValue);
   }
 }
+
+void SettingsTest::benchmarkUpgrade_data(){
+  QTest::addColumn<int>("versions");
+
+  QTest::newRow("50 versions") << 50;
+  QTest::newRow("200 versions") << 200;
+  QTest::newRow("800 versions") << 800;
+}
+
+void SettingsTest::benchmarkUpgrade(){
+  QFETCH(int, versions);
+  const int keyCount = 20;
+
+  TemporaryDirectory tempDir;
+  QVERIFY(tempDir.isValid());
+
+  const QString settingsTemplate = tempDir.path() + "/settings.ini";
+  const QString defaultsFile = tempDir.path() + "/defaults.ini";
+
+  {
+    QSettings settings(settingsTemplate, QSettings::IniFormat);
+    QSettings defaultSettings(defaultsFile, QSettings::IniFormat);
+    UpgradeTestHelper::fillLongHistory(&settings, &defaultSettings, versions, keyCount);
+  }
+
+  const QByteArray settingsData = readFile(settingsTemplate);
+  int run = 0;
+
+  QBENCHMARK {
+    // a new file each run, as QSettings caches files by name
+    const QString settingsFile = QString("%1/settings-%2.ini").arg(tempDir.path()).arg(run++);
+    QVERIFY(writeFile(settingsFile, settingsData));
+
+    SsuSettings ssuSettings(settingsFile, QSettings::IniFormat, defaultsFile);
+    QCOMPARE(ssuSettings.value("configVersion").toInt(), versions);
+  }
+
+  // keys still at the old default follow it, custom values stay
+  SsuSettings upgraded(settingsTemplate, QSettings::IniFormat, defaultsFile);
+  QCOMPARE(upgraded.value("key0").toString(), QString("custom"));
+  QVERIFY(upgraded.value("key1").toString() != QString("v1-default"));
+  QVERIFY(upgraded.value("groupA/key1").toString() != QString("v1-default"));
+}
@@ -18,8 +18,13 @@ class SettingsTest: public QObject {
     void cleanupTestCase();
     void testMerge_data();
     void testMerge();
+    void testMergeManifest();
+    void testLayered();
+    void testSnapshot();
     void testUpgrade_data();
     void testUpgrade();
+    void benchmarkUpgrade_data();
+    void benchmarkUpgrade();
 
   private:
 };
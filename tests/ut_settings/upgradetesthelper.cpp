@@ -250,6 +250,49 @@ bool UpgradeTestHelper::generateSnapshotRecipe(QTextStream *out){
   return true;
 }
 
+/**
+ * Generate settings at version 1 and defaults with historyLength versions for
+ * keyCount keys in each of groups(), for measuring how upgrading scales with
+ * the number of versions.
+ *
+ * Every key is set in the first version, and then changed, kept or left out
+ * in a pattern differing between keys. Each fifth key has a custom value in
+ * settings, all others still have the default of version 1.
+ */
+void UpgradeTestHelper::fillLongHistory(QSettings *settings, QSettings *defaultSettings,
+    int historyLength, int keyCount){
+  settings->setValue("configVersion", 1);
+  defaultSettings->setValue("configVersion", historyLength);
+
+  foreach (const QString &group, groups()){
+    const QString prefix = group.isEmpty() ? group : group + "/";
+
+    for (int key = 0; key < keyCount; ++key){
+      const QString keyName = QString("%1key%2").arg(prefix).arg(key);
+      int lastSet = 1;
+
+      settings->setValue(keyName, key % 5 == 0 ? QString("custom") : QString("v1-default"));
+
+      for (int revision = 1; revision <= historyLength; ++revision){
+        if (revision == 1 || (revision + key) % 7 == 0){
+          // (S)et value
+          lastSet = revision;
+        } else if ((revision + key) % 3 == 0){
+          // (N)oop
+          continue;
+        }
+
+        // (S)et or (K)eep value
+        defaultSettings->setValue(QString("%1/%2").arg(revision).arg(keyName),
+            QString("v%1-default").arg(lastSet));
+      }
+    }
+  }
+
+  settings->sync();
+  defaultSettings->sync();
+}
+
 QStringList UpgradeTestHelper::groups(){
   static const QStringList groups = QStringList() << "" /* General */ << "groupA";
   return groups;
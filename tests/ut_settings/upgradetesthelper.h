@@ -25,6 +25,8 @@ class UpgradeTestHelper {
     static void fillSettings(QSettings *settings, const QList<TestCase> &testCases);
     static void fillDefaultSettings(QSettings *defaultSettings, const QList<TestCase> &testCases);
     static bool generateSnapshotRecipe(QTextStream *out);
+    static void fillLongHistory(QSettings *settings, QSettings *defaultSettings,
+        int historyLength, int keyCount);
 
     static QStringList groups();
 };
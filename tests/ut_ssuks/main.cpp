@@ -0,0 +1,19 @@
+/**
+ * @file main.cpp
+ * @copyright 2013 Jolla Ltd.
+ * @author Bernd Wachter <bwachter@lart.info>
+ * @date 2013
+ */
+
+#include <QtTest/QtTest>
+
+#include "ssukstest.h"
+
+int main(int argc, char **argv){
+  SsuKsTest ssuKsTest;
+
+  if (QTest::qExec(&ssuKsTest, argc, argv))
+    return 1;
+
+  return 0;
+}
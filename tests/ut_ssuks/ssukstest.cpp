@@ -0,0 +1,82 @@
+/**
+ * @file ssukstest.cpp
+ * @copyright 2013 Jolla Ltd.
+ * @author Bernd Wachter <bwachter@lart.info>
+ * @date 2013
+ */
+
+#include "ssukstest.h"
+
+#include <stdlib.h>
+
+#include <QtTest/QtTest>
+
+#include "libssu/sandbox_p.h"
+#include "testutils/process.h"
+
+typedef QStringList Args; // improve readability
+
+void SsuKsTest::init(){
+  Q_ASSERT(m_sandbox == 0);
+
+  m_sandbox = new Sandbox(QString("%1/configroot").arg(TESTS_DATA_PATH),
+      Sandbox::UseAsSkeleton, Sandbox::ChildProcesses);
+  if (!m_sandbox->activate()){
+    QFAIL("Failed to activate sandbox");
+  }
+  setenv("LD_PRELOAD", qPrintable(QString("%1/libsandboxhook.so").arg(TESTS_PATH)), 1);
+
+  m_directory = QString("%1/ut_ssuks-%2")
+    .arg(QDir::tempPath())
+    .arg(QCoreApplication::applicationPid());
+  QVERIFY(QDir().mkpath(m_directory));
+}
+
+void SsuKsTest::cleanup(){
+  Process rm;
+  rm.execute("rm", Args() << "-rf" << m_directory);
+  if (rm.hasError()){
+    qWarning("%s: Failed to remove temporary directory '%s': %s", Q_FUNC_INFO,
+        qPrintable(m_directory), qPrintable(rm.fmtErrorMessage()));
+  }
+
+  delete m_sandbox;
+  m_sandbox = 0;
+}
+
+void SsuKsTest::testParallelMatrix(){
+  // the same matrix is written sequentially and in parallel; the kickstarts
+  // and their names must not depend on the number of jobs
+  QStringList directories;
+  foreach (const QString &jobs, Args() << "1" << "4"){
+    QString directory = QString("%1/jobs%2").arg(m_directory).arg(jobs);
+    QVERIFY(QDir().mkpath(directory));
+    directories.append(directory);
+
+    Process ssuks;
+    ssuks.execute("ssuks", Args()
+                  << QString("matrix=%1/matrix").arg(TESTS_DATA_PATH)
+                  << "jobs=" + jobs
+                  << "outputdir=" + directory);
+    QVERIFY2(!ssuks.hasError(), qPrintable(ssuks.fmtErrorMessage()));
+  }
+
+  QStringList files = QDir(directories.at(0)).entryList(QDir::Files, QDir::Name);
+  QCOMPARE(QDir(directories.at(1)).entryList(QDir::Files, QDir::Name), files);
+
+  // four models in both modes, and the one with its own file name
+  QCOMPARE(files.count(), 9);
+  QVERIFY(files.contains("custom-N950.ks"));
+  QVERIFY(files.contains("example-N9-latest.ks"));
+
+  foreach (const QString &file, files){
+    QFile sequential(QDir(directories.at(0)).filePath(file));
+    QFile parallel(QDir(directories.at(1)).filePath(file));
+    QVERIFY(sequential.open(QIODevice::ReadOnly));
+    QVERIFY(parallel.open(QIODevice::ReadOnly));
+
+    QByteArray content = sequential.readAll();
+    QVERIFY2(!content.isEmpty(), qPrintable(file));
+    QVERIFY2(parallel.readAll() == content, qPrintable(file));
+  }
+}
@@ -0,0 +1,33 @@
+/**
+ * @file ssukstest.h
+ * @copyright 2013 Jolla Ltd.
+ * @author Bernd Wachter <bwachter@lart.info>
+ * @date 2013
+ */
+
+#ifndef _SSUKSTEST_H
+#define _SSUKSTEST_H
+
+#include <QObject>
+#include <QString>
+
+class Sandbox;
+
+class SsuKsTest: public QObject {
+    Q_OBJECT
+
+  public:
+    SsuKsTest(): m_sandbox(0) {}
+
+  private slots:
+    void init();
+    void cleanup();
+
+    void testParallelMatrix();
+
+  private:
+    Sandbox *m_sandbox;
+    QString m_directory;
+};
+
+#endif
@@ -0,0 +1,22 @@
+TARGET = ut_ssuks
+include(../testapplication.pri)
+include(ut_ssuks_dependencies.pri)
+
+HEADERS = \
+        ssukstest.h \
+
+SOURCES = \
+        main.cpp \
+        ssukstest.cpp \
+
+test_data.files = \
+	testdata/matrix \
+
+test_data_etc.files = \
+	testdata/ssu.ini \
+
+test_data_usr_share.files = \
+	testdata/ssu-defaults.ini \
+	testdata/repos.ini \
+	testdata/board-mappings.ini \
+	testdata/kickstart \
@@ -0,0 +1,2 @@
+include(../../libssu/libssu.pri)
+include(../testutils/testutils.pri)
@@ -6,9 +6,24 @@
  */
 
 #include "urlresolvertest.h"
+
+#include <QtXml/QDomDocument>
+
+#include "libssu/sandbox_p.h"
+#include "libssu/ssudevicequery.h"
+#include "libssu/ssurepomanager.h"
+#include "libssu/ssureporesolver.h"
+#include "libssu/ssuserverresponse_p.h"
 #include "constants.h"
 #include "testutils/process.h"
 
+static SsuServerResponse parsedResponse(const QDomDocument &doc){
+  SsuServerResponse response;
+  if (!response.parse(doc.toByteArray()))
+    qWarning("Unable to parse response: %s", qPrintable(response.errorString()));
+  return response;
+}
+
 void UrlResolverTest::initTestCase(){
 #ifdef TARGET_ARCH
   // test will fail if executed without proper installation of libssu and repos
@@ -126,6 +141,69 @@ void UrlResolverTest::checkReleaseRepoUrls(){
   }
 }
 
+void UrlResolverTest::checkRepoResolver(){
+  QSettings repoSettings(Sandbox::map(SSU_REPO_CONFIGURATION), QSettings::IniFormat);
+  QStringList repos;
+  repos << repoSettings.childKeys() << "adaptation0" << "mer-core-debuginfo";
+  foreach (const QString &section, QStringList() << "release" << "rnd"){
+    repoSettings.beginGroup(section);
+    repos << repoSettings.childKeys();
+    repoSettings.endGroup();
+  }
+  repos.removeDuplicates();
+
+  QHash<QString, QString> debugParameters;
+  debugParameters.insert("debugSplit", "debug");
+
+  QList<QHash<QString, QString> > overrides;
+  QHash<QString, QString> override;
+  overrides << override;
+  override.insert("domain", "example");
+  overrides << override;
+  override.insert("model", "N950");
+  overrides << override;
+
+  // one context resolving all repositories gives the same URLs as a
+  // context per URL, in both modes and with any overrides
+  SsuDeviceQuery query;
+  foreach (bool rnd, QList<bool>() << false << true){
+    foreach (override, overrides){
+      SsuRepoResolver resolver(rnd, override);
+      SsuRepoResolver queryResolver(query, "N9", rnd, override);
+
+      foreach (const QString &repo, repos){
+        QString expected = SsuRepoManager().url(repo, rnd, QHash<QString, QString>(), override);
+        QCOMPARE(resolver.url(repo), expected);
+
+        if (!override.contains("model")){
+          QHash<QString, QString> modelOverride = override;
+          modelOverride.insert("model", "N9");
+          expected = SsuRepoManager().url(repo, rnd, QHash<QString, QString>(), modelOverride);
+        }
+        QCOMPARE(queryResolver.url(repo), expected);
+
+        expected = SsuRepoManager().url(repo, rnd, debugParameters, override);
+        QCOMPARE(resolver.url(repo, debugParameters), expected);
+      }
+    }
+  }
+
+  // values from the flavour section take precedence over repository
+  // parameters, which in turn take precedence over the defaults
+  const QString flavourKey = ssu.flavour() + "-flavour/debugSplit";
+  repoSettings.setValue(flavourKey, "flavoured");
+  repoSettings.sync();
+
+  SsuRepoResolver resolver(true);
+  QString expected = SsuRepoManager().url("mer-core", true, debugParameters);
+  QVERIFY(expected.endsWith("/flavoured/"));
+  QCOMPARE(resolver.url("mer-core", debugParameters), expected);
+  QCOMPARE(resolver.url("mer-core"), expected);
+
+  repoSettings.remove(flavourKey);
+  repoSettings.sync();
+}
+
 void UrlResolverTest::checkRegisterDevice(){
   QDomDocument doc("foo");
 
@@ -135,7 +213,7 @@ void UrlResolverTest::checkRegisterDevice(){
   QDomElement certificate = doc.createElement("certificate");
   root.appendChild(certificate);
 
-  QVERIFY2(!ssu.registerDevice(&doc),
+  QVERIFY2(!ssu.registerDevice(parsedResponse(doc)),
       "Ssu::registerDevice() should fail when 'certificate' is empty");
 
   QFile certificateFile(TESTS_DATA_PATH "/mycert.crt");
@@ -146,7 +224,7 @@ void UrlResolverTest::checkRegisterDevice(){
   QDomElement privateKey = doc.createElement("privateKey");
   root.appendChild(privateKey);
 
-  QVERIFY2(!ssu.registerDevice(&doc),
+  QVERIFY2(!ssu.registerDevice(parsedResponse(doc)),
       "Ssu::registerDevice() should fail when 'privateKey' is empty");
 
   QFile privateKeyFile(TESTS_DATA_PATH "/mykey.key");
@@ -160,7 +238,7 @@ void UrlResolverTest::checkRegisterDevice(){
 
   QSignalSpy registrationStatusChanged_spy(&ssu, SIGNAL(registrationStatusChanged()));
 
-  QVERIFY(ssu.registerDevice(&doc));
+  QVERIFY(ssu.registerDevice(parsedResponse(doc)));
 
   QVERIFY(registrationStatusChanged_spy.count() == 1);
   QVERIFY(ssu.isRegistered());
@@ -180,26 +258,30 @@ void UrlResolverTest::checkSetCredentials(){
   QDomElement credentials1 = doc.createElement("credentials");
   root.appendChild(credentials1);
 
-  QVERIFY2(!ssu.setCredentials(&doc),
-      "Ssu::setCredentials() should fail when 'scope' is not defined");
+  SsuServerResponse response;
+
+  QVERIFY2(!response.parse(doc.toByteArray()),
+      "SsuServerResponse::parse() should fail when 'scope' is not defined");
 
   credentials1.setAttribute("scope", "utscope1");
 
-  QVERIFY2(!ssu.setCredentials(&doc),
-      "Ssu::setCredentials() should fail when username/password is missing");
+  QVERIFY2(!response.parse(doc.toByteArray()),
+      "SsuServerResponse::parse() should fail when username/password is missing");
 
   QDomElement username1 = doc.createElement("username");
   credentials1.appendChild(username1);
   username1.appendChild(doc.createTextNode("john.doe1"));
 
-  QVERIFY2(!ssu.setCredentials(&doc),
-      "Ssu::setCredentials() should fail when password is missing");
+  QVERIFY2(!response.parse(doc.toByteArray()),
+      "SsuServerResponse::parse() should fail when password is missing");
 
   QDomElement password1 = doc.createElement("password");
   credentials1.appendChild(password1);
   password1.appendChild(doc.createTextNode("SeCrEt1"));
 
-  QVERIFY2(ssu.setCredentials(&doc),
+  QVERIFY2(response.parse(doc.toByteArray()),
+      qPrintable(QString("parse() failed: %1").arg(response.errorString())));
+  QVERIFY2(ssu.setCredentials(response),
       qPrintable(QString("setCredentials() failed: %1").arg(ssu.lastError())));
 
   QVERIFY2(ssu.lastCredentialsUpdate() > QDateTime::currentDateTime().addSecs(-5) &&
@@ -223,7 +305,9 @@ void UrlResolverTest::checkSetCredentials(){
   credentials2.appendChild(password2);
   password2.appendChild(doc.createTextNode("SeCrEt2"));
 
-  QVERIFY2(ssu.setCredentials(&doc),
+  QVERIFY2(response.parse(doc.toByteArray()),
+      qPrintable(QString("parse() failed: %1").arg(response.errorString())));
+  QVERIFY2(ssu.setCredentials(response),
       qPrintable(QString("setCredentials() failed: %1").arg(ssu.lastError())));
 
   QVERIFY2(ssu.lastCredentialsUpdate() > QDateTime::currentDateTime().addSecs(-5) &&
@@ -316,10 +400,37 @@ void UrlResolverTest::checkVerifyResponse(){
   QDomText protocolVersionText = doc.createTextNode(SSU_PROTOCOL_VERSION);
   protocolVersion.appendChild(protocolVersionText);
 
-  QVERIFY(ssu.verifyResponse(&doc));
+  QVERIFY(ssu.verifyResponse(parsedResponse(doc)));
 
   protocolVersionText.setData(SSU_PROTOCOL_VERSION ".invalid");
 
-  QVERIFY2(!ssu.verifyResponse(&doc),
+  QVERIFY2(!ssu.verifyResponse(parsedResponse(doc)),
       "Ssu::verifyResponse() should fail when protocolVersion does not match SSU_PROTOCOL_VERSION");
 }
+
+void UrlResolverTest::checkParseResponse(){
+  SsuServerResponse response;
+
+  QVERIFY2(!response.parse("<response><action>register</action>"),
+      "SsuServerResponse::parse() should fail on truncated responses");
+  QVERIFY(!response.errorString().isEmpty());
+
+  QVERIFY(response.parse(
+      "<response>"
+      "<action>credentials</action>"
+      "<protocolVersion>" SSU_PROTOCOL_VERSION "</protocolVersion>"
+      "<credentials scope=\"a\"><username>ua</username><password>pa</password></credentials>"
+      "<credentials scope=\"b\"><password>pb</password><username>ub</username></credentials>"
+      "<action>ignored</action>"
+      "</response>"));
+
+  QCOMPARE(response.action, QString("credentials"));
+  QCOMPARE(response.protocolVersion, QString(SSU_PROTOCOL_VERSION));
+  QCOMPARE(response.credentials.count(), 2);
+  QCOMPARE(response.credentials.at(0).scope, QString("a"));
+  QCOMPARE(response.credentials.at(0).username, QString("ua"));
+  QCOMPARE(response.credentials.at(0).password, QString("pa"));
+  QCOMPARE(response.credentials.at(1).scope, QString("b"));
+  QCOMPARE(response.credentials.at(1).username, QString("ub"));
+  QCOMPARE(response.credentials.at(1).password, QString("pb"));
+}
@@ -26,10 +26,12 @@ class UrlResolverTest: public QObject {
     void checkCleanUrl();
     void simpleRepoUrlLookup();
     void checkReleaseRepoUrls();
+    void checkRepoResolver();
     void checkRegisterDevice();
     void checkSetCredentials();
     void checkStoreAuthorizedKeys();
     void checkVerifyResponse();
+    void checkParseResponse();
 
   private:
     Ssu ssu;
@@ -14,6 +14,7 @@ void VariablesTest::initTestCase(){
   variables.insert("release", "devel");
   variables.insert("arch", "armv8");
   variables.insert("flavourName", "flavour");
+  variables.insert("nestedDomain", "%(releaseDomain)/nested");
 
   urls.insert("http://%(packagesDomain)/releases/%(release)/jolla/%(arch)/",
               "http://packages.example.com/releases/devel/jolla/armv8/");
@@ -49,7 +50,16 @@ void VariablesTest::initTestCase(){
               "https://releases.example.com/devel-flavour");
   urls.insert("%(%(rndProtocol):=http?https://%(releaseDomain)/%(release)-%(flavourName)|http://%(releaseDomain)/%(release)-%(flavourName))",
               "http://releases.example.com/devel-flavour");
-
+  // variables containing variables
+  urls.insert("%(rndProtocol)://%(nestedDomain)/%(release)/",
+              "https://releases.example.com/nested/devel/");
+  urls.insert("%(rndProtocol)://%(unsetDomain:-%(nestedDomain))/%(release)/",
+              "https://releases.example.com/nested/devel/");
+  // unterminated variables are kept as they are
+  urls.insert("http://%(packagesDomain)/%(release",
+              "http://packages.example.com/%(release");
+  urls.insert("http://%(packagesDomain%(release)/",
+              "http://%(packagesDomaindevel/");
 }
 
 void VariablesTest::cleanupTestCase(){
@@ -66,3 +76,130 @@ void VariablesTest::checkResolveString(){
     QCOMPARE(result, i.value());
   }
 }
+
+void VariablesTest::checkVariableSection(){
+  QTemporaryFile file;
+  QVERIFY(file.open());
+  file.write("[default-domain]\n"
+             "variables = common\n"
+             "name = default\n"
+             "[var-common]\n"
+             "common = common-value\n"
+             "name = common\n"
+             "[test-domain]\n"
+             "name = test\n"
+             "_local = local-value\n");
+  file.close();
+
+  SsuSettings settings(file.fileName(), QSettings::IniFormat);
+  QHash<QString, QString> section;
+  section.insert("existing", "existing-value");
+  section.insert("name", "existing-name");
+
+  SsuVariables::variableSection(&settings, "test-domain", &section);
+  QCOMPARE(section.value("existing"), QString("existing-value"));
+  QCOMPARE(section.value("common"), QString("common-value"));
+  QCOMPARE(section.value("name"), QString("test"));
+  QVERIFY(!section.contains("_local"));
+
+  QCOMPARE(SsuVariables::variable(&settings, "test-domain", "_local").toString(),
+           QString("local-value"));
+  QCOMPARE(SsuVariables::variable(&settings, "test-domain", "common").toString(),
+           QString("common-value"));
+
+  // views cache the sections, and don't see later changes of the settings
+  SsuSettingsView view(settings);
+  section.clear();
+  SsuVariables::variableSection(&view, "test-domain", &section);
+  QCOMPARE(section.value("name"), QString("test"));
+  QCOMPARE(section.value("common"), QString("common-value"));
+
+  // lookups through settings are cached as well, but changes made with
+  // setValue() show up right away
+  settings.setValue("test-domain/name", "changed");
+  section.clear();
+  SsuVariables::variableSection(&settings, "test-domain", &section);
+  QCOMPARE(section.value("name"), QString("changed"));
+  QCOMPARE(SsuVariables::variable(&settings, "test-domain", "name").toString(),
+           QString("changed"));
+
+  section.clear();
+  SsuVariables::variableSection(&view, "test-domain", &section);
+  QCOMPARE(section.value("name"), QString("test"));
+  QCOMPARE(SsuVariables::variable(&view, "test-domain", "name").toString(), QString("test"));
+
+  // as do keys removed between two lookups
+  settings.remove("var-common/common");
+  section.clear();
+  SsuVariables::variableSection(&settings, "test-domain", &section);
+  QVERIFY(!section.contains("common"));
+  QVERIFY(!SsuVariables::variable(&settings, "test-domain", "common").isValid());
+
+  // and changes of the file by someone else, once they are read with sync()
+  settings.sync();
+  {
+    QSettings other(file.fileName(), QSettings::IniFormat);
+    other.setValue("test-domain/name", "external");
+    other.sync();
+  }
+  settings.sync();
+  QCOMPARE(SsuVariables::variable(&settings, "test-domain", "name").toString(),
+           QString("external"));
+}
+
+void VariablesTest::checkCycles(){
+  QTemporaryFile file;
+  QVERIFY(file.open());
+  file.write("[test-domain]\n"
+             "variables = a\n"
+             "name = test\n"
+             "[var-a]\n"
+             "variables = b\n"
+             "a = a-value\n"
+             "[var-b]\n"
+             "variables = a, b\n"
+             "b = b-value\n");
+  file.close();
+
+  SsuSettings settings(file.fileName(), QSettings::IniFormat);
+  QHash<QString, QString> section;
+  SsuVariables::variableSection(&settings, "test-domain", &section);
+  QCOMPARE(section.value("name"), QString("test"));
+  QCOMPARE(section.value("a"), QString("a-value"));
+  QCOMPARE(section.value("b"), QString("b-value"));
+
+  QVERIFY(!SsuVariables::variable(&settings, "test-domain", "missing").isValid());
+
+  QHash<QString, QString> cyclic;
+  cyclic.insert("self", "%(self)%(self)%(self)");
+  cyclic.insert("first", "x%(second)");
+  cyclic.insert("second", "%(first)");
+  cyclic.insert("plain", "%(first:+set)");
+  QCOMPARE(var.resolveString("%(plain)", &cyclic), QString("set"));
+  QVERIFY(var.resolveString("%(self)", &cyclic).contains("maximum-recursion-level-reached"));
+  QCOMPARE(var.resolveString("%(first)", &cyclic), QString("xmaximum-recursion-level-reached"));
+}
+
+void VariablesTest::checkDefaultSection(){
+  QTemporaryFile file;
+  QVERIFY(file.open());
+  file.write("[default-domain]\n"
+             "name = default\n"
+             "[test-domain]\n"
+             "name = test\n"
+             "[var-default-device]\n"
+             "name = default\n");
+  file.close();
+
+  SsuSettings settings(file.fileName(), QSettings::IniFormat);
+  QCOMPARE(SsuVariables::defaultSection(&settings, "test-domain"), QString("default-domain"));
+  QCOMPARE(SsuVariables::defaultSection(&settings, "missing-domain"), QString("default-domain"));
+  QCOMPARE(SsuVariables::defaultSection(&settings, "var-device"), QString("var-default-device"));
+  QCOMPARE(SsuVariables::defaultSection(&settings, "test-flavour"), QString());
+
+  settings.setValue("default-flavour/name", "default");
+  QCOMPARE(SsuVariables::defaultSection(&settings, "test-flavour"), QString("default-flavour"));
+
+  settings.remove("default-flavour");
+  QCOMPARE(SsuVariables::defaultSection(&settings, "test-flavour"), QString());
+}
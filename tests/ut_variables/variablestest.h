@@ -22,6 +22,9 @@ class VariablesTest: public QObject {
     void initTestCase();
     void cleanupTestCase();
     void checkResolveString();
+    void checkVariableSection();
+    void checkCycles();
+    void checkDefaultSection();
 
 
   private: